@@ -1,11 +1,22 @@
+#include "headless.hpp"
 #include "rayner.hpp"
 #include <cstdlib>
 #include <iostream>
 
 int main(int argc, char *argv[]) {
   try {
-    rn::Rayner ray;
-    ray.run();
+    // batch runs never touch the renderer
+    if (rn::Headless::requested(argc, argv)) {
+      rn::Headless headless(rn::Headless::parse(argc, argv));
+      headless.run();
+    } else {
+      rn::Rayner ray;
+      ray.run();
+    }
+  } catch (rn::Headless::UsageError &err) {
+    std::cout << err.what() << "\n";
+    rn::Headless::usage(std::cout);
+    exit(-1);
   } catch (vk::SystemError &err) {
     std::cout << "vk::SystemError: " << err.what() << std::endl;
     exit(-1);
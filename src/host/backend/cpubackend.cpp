@@ -0,0 +1,51 @@
+#include "cpubackend.hpp"
+#include <vector>
+
+#include "raytracer/correction.hpp"
+
+namespace rn {
+CpuBackend::CpuBackend(const std::string &objPath,
+                       const CpuTracer::Options &options_)
+    : options(options_), geom(nullptr, objPath),
+      tracer(std::make_unique<CpuTracer>(geom, options)) {}
+
+void CpuBackend::updateGeometry() {
+  geom.updateBuffers();
+  tracer = std::make_unique<CpuTracer>(geom, options);
+}
+
+void CpuBackend::traceAll(const Launch &launch) {
+  options.sobol = launch.sobol;
+  tracer->setSobol(launch.sobol);
+  if (launch.global) {
+    tracer->traceGlobal(launch.nRays, launch.seed);
+  } else {
+    tracer->traceAll(launch.nRays, launch.seed);
+  }
+  viewFactors = tracer->getViewFactors();
+  if (launch.correct || launch.closed) {
+    // what vfCorrect.comp does to the device matrix
+    std::vector<float> areas(geom.frames.size());
+    for (size_t i = 0; i < areas.size(); ++i) {
+      areas[i] = geom.frames[i].normal.w;
+    }
+    correctViewFactors(viewFactors, areas, launch.closed,
+                       launch.closureIterations);
+  }
+}
+
+void CpuBackend::traceEmitter(uint32_t emitter, const Launch &launch) {
+  options.sobol = launch.sobol;
+  tracer->setSobol(launch.sobol);
+  tracer->traceRays(emitter, launch.nRays, launch.seed);
+}
+
+std::vector<TraceBackend::Bin> CpuBackend::getBins() {
+  const std::vector<CpuTracer::Bin> &bins = tracer->getBins();
+  std::vector<Bin> out(bins.size());
+  for (size_t i = 0; i < bins.size(); ++i) {
+    out[i] = {bins[i].energy, bins[i].count};
+  }
+  return out;
+}
+} // namespace rn
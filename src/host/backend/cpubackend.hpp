@@ -0,0 +1,33 @@
+#pragma once
+#include <memory>
+#include <string>
+
+#include "cputracer/cputracer.hpp"
+#include "tracebackend.hpp"
+
+namespace rn {
+// CpuTracer on host only geometry, needs no device at all
+class CpuBackend : public TraceBackend {
+public:
+  CpuBackend(const std::string &objPath, const CpuTracer::Options &options_);
+
+  Kind kind() const override { return Kind::eCpu; };
+  GeometryHandler &getGeometry() override { return geom; };
+  // the tracer copies the frames and alias table, so it is built anew
+  void updateGeometry() override;
+  void traceAll(const Launch &launch) override;
+  void traceEmitter(uint32_t emitter, const Launch &launch) override;
+  std::vector<Bin> getBins() override;
+  std::vector<float> getViewFactors() override { return viewFactors; };
+
+  CpuTracer &getTracer() { return *tracer; };
+
+private:
+  CpuTracer::Options options;
+  GeometryHandler geom;
+  std::unique_ptr<CpuTracer> tracer;
+  // of the last traceAll, the bins of later single emitter launches do not
+  // replace them
+  std::vector<float> viewFactors;
+};
+} // namespace rn
@@ -0,0 +1,99 @@
+#include "tracebackend.hpp"
+#include <iostream>
+#include <stdexcept>
+
+#include "cpubackend.hpp"
+#include "vknhandler.hpp"
+#include "vulkanbackend.hpp"
+
+namespace rn {
+TraceBackend::Kind TraceBackend::parseKind(const std::string &name) {
+  if (name == "auto") {
+    return Kind::eAuto;
+  } else if (name == "rt") {
+    return Kind::eRayTracing;
+  } else if (name == "rq") {
+    return Kind::eRayQuery;
+  } else if (name == "cpu") {
+    return Kind::eCpu;
+  }
+  throw std::invalid_argument("unknown backend " + name +
+                              ", expected auto, rt, rq or cpu");
+}
+
+const char *TraceBackend::name(Kind kind) {
+  switch (kind) {
+  case Kind::eAuto:
+    return "auto";
+  case Kind::eRayTracing:
+    return "ray tracing pipeline";
+  case Kind::eRayQuery:
+    return "ray query";
+  case Kind::eCpu:
+    return "cpu";
+  }
+  return "unknown";
+}
+
+std::vector<float> TraceBackend::getMeshViewFactors() {
+  std::vector<float> vf = getViewFactors();
+  GeometryHandler &geom = getGeometry();
+  uint32_t n = getTriCount();
+  uint32_t m = getMeshCount();
+  std::vector<float> meshVf;
+  if (vf.size() != static_cast<size_t>(n) * n || m == 0) {
+    return meshVf;
+  }
+  // F_MN = sum_{i in M} A_i sum_{j in N} F_ij / sum_{i in M} A_i
+  meshVf.assign(static_cast<size_t>(m) * m, 0.f);
+  const std::vector<uint32_t> &offsets = geom.meshOffsets;
+  for (uint32_t emitter = 0; emitter < m; ++emitter) {
+    double area = 0.;
+    std::vector<double> sums(m, 0.);
+    for (uint32_t i = offsets[emitter]; i < offsets[emitter + 1]; ++i) {
+      float a = geom.frames[i].normal.w;
+      area += a;
+      for (uint32_t mesh = 0; mesh < m; ++mesh) {
+        double sum = 0.;
+        for (uint32_t j = offsets[mesh]; j < offsets[mesh + 1]; ++j) {
+          sum += vf[static_cast<size_t>(i) * n + j];
+        }
+        sums[mesh] += a * sum;
+      }
+    }
+    for (uint32_t mesh = 0; area > 0. && mesh < m; ++mesh) {
+      meshVf[static_cast<size_t>(emitter) * m + mesh] =
+          static_cast<float>(sums[mesh] / area);
+    }
+  }
+  return meshVf;
+}
+
+std::unique_ptr<TraceBackend>
+TraceBackend::create(const std::string &objPath, const Options &options) {
+  CpuTracer::Options cpuOptions;
+  cpuOptions.nThreads = options.nThreads;
+  if (options.kind == Kind::eCpu) {
+    return std::make_unique<CpuBackend>(objPath, cpuOptions);
+  }
+
+  // no loader, no device with ray tracing, one that fails to come up or
+  // fails to build the pipelines and structures all end here
+  try {
+    auto vlkn = std::make_shared<VulkanHandler>(true);
+    // binned ray query launches accumulate in shared memory before they
+    // touch the bins, which beats the pipeline on view factor launches.
+    // Devices without the pipeline always have them
+    bool rayQuery = options.kind == Kind::eRayQuery ||
+                    (options.kind == Kind::eAuto && vlkn->hasRayQuery());
+    return std::make_unique<VulkanBackend>(vlkn, objPath, rayQuery);
+  } catch (std::exception &err) {
+    if (options.kind != Kind::eAuto) {
+      throw;
+    }
+    std::cerr << "no usable ray tracing device (" << err.what()
+              << "), tracing on the cpu\n";
+  }
+  return std::make_unique<CpuBackend>(objPath, cpuOptions);
+}
+} // namespace rn
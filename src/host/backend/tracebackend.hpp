@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "geometryloader/geometry.hpp"
+
+namespace rn {
+// what a view factor launch needs from a tracing engine: the geometry of an
+// obj file, rays traced from the emitters into bins and the bins read back.
+// Implemented on the ray tracing pipeline, on ray queries and on the cpu
+// BVH, create() picks the fastest one the machine has
+class TraceBackend {
+public:
+  enum class Kind { eAuto, eRayTracing, eRayQuery, eCpu };
+  // "auto", "rt", "rq" or "cpu", throws std::invalid_argument otherwise
+  static Kind parseKind(const std::string &name);
+  static const char *name(Kind kind);
+
+  struct Options {
+    // eAuto takes ray queries, then the ray tracing pipeline of a headless
+    // device and falls back to the cpu if there is no usable device
+    Kind kind = Kind::eAuto;
+    // cpu only, 0 = hardware concurrency
+    uint32_t nThreads = 0;
+  };
+  // loads objPath for the selected backend, throws if a forced backend is
+  // not available
+  static std::unique_ptr<TraceBackend> create(const std::string &objPath,
+                                              const Options &options);
+
+  virtual ~TraceBackend() = default;
+  virtual Kind kind() const = 0;
+  const char *name() const { return name(kind()); };
+  virtual GeometryHandler &getGeometry() = 0;
+  uint32_t getTriCount() {
+    return static_cast<uint32_t>(getGeometry().indices.size() / 3);
+  };
+  // picks up meshes moved with GeometryHandler::setMeshTransform or
+  // setMeshVertices
+  virtual void updateGeometry() = 0;
+
+  struct Launch {
+    // per emitter, in total for global launches
+    uint64_t nRays = 0;
+    // key of the random streams, every backend draws the same rays for it
+    uint32_t seed = 0;
+    // emitters are drawn from GeometryHandler::aliasTable
+    bool global = false;
+    bool sobol = false;
+    // reciprocity and closure correction of the view factors, with
+    // State::closureIterations scaling passes
+    bool correct = false;
+    bool closed = false;
+    uint32_t closureIterations = 20;
+  };
+  // nRays rays from every triangle into one row of bins each, blocks until
+  // the launch has finished
+  virtual void traceAll(const Launch &launch) = 0;
+  // nRays rays of emitter into a single row
+  virtual void traceEmitter(uint32_t emitter, const Launch &launch) = 0;
+
+  // layout of Raytracer::Bin and CpuTracer::Bin, energy is fixed point
+  // scaled by BIN_SCALE
+  struct Bin {
+    uint64_t energy;
+    uint64_t count;
+  };
+  static constexpr double BIN_SCALE = 1048576.0;
+  // rows x (nTris + 1) bins of the last launch, the last column holds the
+  // rays that escaped
+  virtual std::vector<Bin> getBins() = 0;
+  // row major nTris x nTris view factors of the last traceAll
+  virtual std::vector<float> getViewFactors() = 0;
+  // row major nMeshes x nMeshes area weighted view factors of the meshes,
+  // as src/shaders/meshReduce.comp reduces them
+  virtual std::vector<float> getMeshViewFactors();
+  uint32_t getMeshCount() {
+    return static_cast<uint32_t>(getGeometry().meshOffsets.size() - 1);
+  };
+};
+} // namespace rn
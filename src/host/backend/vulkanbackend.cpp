@@ -0,0 +1,67 @@
+#include "vulkanbackend.hpp"
+#include <stdexcept>
+
+namespace rn {
+VulkanBackend::VulkanBackend(std::shared_ptr<VulkanHandler> vlkn_,
+                             const std::string &objPath, bool rayQuery_)
+    : vlkn(vlkn_), rayQuery(rayQuery_), geom(vlkn->getVma(), objPath),
+      raytracer(vlkn, geom) {
+  if (rayQuery && !raytracer.hasRayQuery()) {
+    throw std::runtime_error("the device has no ray queries");
+  }
+  if (!rayQuery && !raytracer.hasRayTracingPipeline()) {
+    throw std::runtime_error("the device has no ray tracing pipeline");
+  }
+}
+
+void VulkanBackend::updateGeometry() {
+  raytracer.refitAccelerationStructures(geom);
+}
+
+std::shared_ptr<State> VulkanBackend::launchState(const Launch &launch) {
+  auto state = std::make_shared<State>();
+  state->nRays = launch.nRays;
+  state->global = launch.global;
+  state->globalRays = launch.nRays;
+  state->sobol = launch.sobol;
+  state->rayQuery = rayQuery;
+  state->seed = launch.seed;
+  state->pinSeed = true;
+  state->meshNames = geom.meshNames;
+  return state;
+}
+
+void VulkanBackend::traceAll(const Launch &launch) {
+  auto state = launchState(launch);
+  state->binned = true;
+  state->correct = launch.correct || launch.closed;
+  state->closed = launch.closed;
+  state->closureIterations = launch.closureIterations;
+  raytracer.traceAll(state);
+  raytracer.wait();
+}
+
+void VulkanBackend::traceEmitter(uint32_t emitter, const Launch &launch) {
+  auto state = launchState(launch);
+  state->currTri = emitter;
+  raytracer.traceRays(state);
+  raytracer.wait();
+}
+
+std::vector<TraceBackend::Bin> VulkanBackend::getBins() {
+  std::vector<Raytracer::Bin> bins = raytracer.getBins();
+  std::vector<Bin> out(bins.size());
+  for (size_t i = 0; i < bins.size(); ++i) {
+    out[i] = {bins[i].energy, bins[i].count};
+  }
+  return out;
+}
+
+std::vector<float> VulkanBackend::getViewFactors() {
+  return raytracer.getViewFactors();
+}
+
+std::vector<float> VulkanBackend::getMeshViewFactors() {
+  return raytracer.getMeshViewFactors();
+}
+} // namespace rn
@@ -0,0 +1,41 @@
+#pragma once
+#include <memory>
+#include <string>
+
+#include "raytracer/raytracer.hpp"
+#include "tracebackend.hpp"
+#include "vknhandler.hpp"
+
+namespace rn {
+// Raytracer on a device, tracing with the ray tracing pipeline or with ray
+// queries from a compute shader
+class VulkanBackend : public TraceBackend {
+public:
+  VulkanBackend(std::shared_ptr<VulkanHandler> vlkn_,
+                const std::string &objPath, bool rayQuery_);
+
+  Kind kind() const override {
+    return rayQuery ? Kind::eRayQuery : Kind::eRayTracing;
+  };
+  GeometryHandler &getGeometry() override { return geom; };
+  void updateGeometry() override;
+  void traceAll(const Launch &launch) override;
+  void traceEmitter(uint32_t emitter, const Launch &launch) override;
+  std::vector<Bin> getBins() override;
+  std::vector<float> getViewFactors() override;
+  // reduced on the device
+  std::vector<float> getMeshViewFactors() override;
+
+  Raytracer &getRaytracer() { return raytracer; };
+
+private:
+  // State of a launch, the seed is pinned so every backend traces the same
+  // rays for it
+  std::shared_ptr<State> launchState(const Launch &launch);
+
+  std::shared_ptr<VulkanHandler> vlkn;
+  bool rayQuery;
+  GeometryHandler geom;
+  Raytracer raytracer;
+};
+} // namespace rn
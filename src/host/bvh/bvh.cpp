@@ -0,0 +1,403 @@
+#include "bvh.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+namespace rn {
+namespace {
+// root, one unused slot so that the sibling pairs from 2 on start on a
+// cache line, then at most nTris - 1 pairs
+uint32_t maxNodes(size_t nTris) {
+  return static_cast<uint32_t>(2 + 2 * std::max<size_t>(nTris, 1));
+}
+
+float axisOf(const glm::vec3 &v, uint32_t axis) { return v[axis]; }
+
+// levels below a node with count triangles if every split halves them
+uint32_t ceilLog2(uint32_t count) {
+  uint32_t levels = 0;
+  while (levels < 32 && (uint64_t{1} << levels) < count) {
+    ++levels;
+  }
+  return levels;
+}
+} // namespace
+
+Bvh::Bvh(const std::vector<glm::vec3> &vertices_,
+         const std::vector<uint32_t> &indices_, const BuildOptions &options_)
+    : options(options_), vertices(vertices_), indices(indices_) {
+  auto start = std::chrono::steady_clock::now();
+  options.bins = std::max(options.bins, 2u);
+  options.maxLeafSize = std::max(options.maxLeafSize, 1u);
+  if (options.nThreads == 0) {
+    options.nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  size_t n = indices.size() / 3;
+  triIndices.resize(n);
+  triBounds.resize(n);
+  centroids.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    triIndices[i] = static_cast<uint32_t>(i);
+    Aabb box;
+    box.grow(vertices[indices[3 * i + 0]]);
+    box.grow(vertices[indices[3 * i + 1]]);
+    box.grow(vertices[indices[3 * i + 2]]);
+    triBounds[i] = box;
+    centroids[i] = (box.min + box.max) * 0.5f;
+    rootBounds.grow(box);
+  }
+
+  nodes.resize(maxNodes(n));
+  nodesUsed = 2;
+  if (n != 0) {
+    // every level doubles the threads in flight
+    uint32_t threadDepth = 0;
+    while ((1u << threadDepth) < options.nThreads) {
+      ++threadDepth;
+    }
+    build(0, 0, static_cast<uint32_t>(n), 1, threadDepth);
+  }
+  nodes.resize(nodesUsed);
+  nodes.shrink_to_fit();
+
+  triBounds.clear();
+  triBounds.shrink_to_fit();
+  centroids.clear();
+  centroids.shrink_to_fit();
+
+  computeStats();
+  if (stats.maxDepth > MAX_DEPTH) {
+    throw std::runtime_error("BVH deeper than the traversal stack");
+  }
+  stats.buildMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+}
+
+uint32_t Bvh::allocPair() { return nodesUsed.fetch_add(2); }
+
+uint32_t Bvh::medianSplit(uint32_t first, uint32_t count,
+                          const Aabb &centroidBounds) {
+  glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+  uint32_t axis = extent.x > extent.y ? 0 : 1;
+  axis = extent.z > extent[axis] ? 2 : axis;
+  uint32_t mid = first + count / 2;
+  std::nth_element(triIndices.begin() + first, triIndices.begin() + mid,
+                   triIndices.begin() + first + count,
+                   [&](uint32_t a, uint32_t b) {
+                     return axisOf(centroids[a], axis) <
+                            axisOf(centroids[b], axis);
+                   });
+  return mid;
+}
+
+Bvh::Split Bvh::findSplit(uint32_t first, uint32_t count,
+                          const Aabb &centroidBounds) {
+  struct Bin {
+    Aabb bounds;
+    uint32_t count = 0;
+  };
+  uint32_t nBins = options.bins;
+  std::vector<Bin> bins(nBins);
+  std::vector<float> leftArea(nBins), rightArea(nBins);
+  std::vector<uint32_t> leftCount(nBins), rightCount(nBins);
+
+  Split best;
+  for (uint32_t axis = 0; axis < 3; ++axis) {
+    float lo = axisOf(centroidBounds.min, axis);
+    float extent = axisOf(centroidBounds.max, axis) - lo;
+    if (extent <= 0.f) {
+      continue;
+    }
+    float scale = nBins / extent;
+    std::fill(bins.begin(), bins.end(), Bin{});
+    for (uint32_t i = first; i < first + count; ++i) {
+      uint32_t tri = triIndices[i];
+      uint32_t b = std::min(
+          nBins - 1,
+          static_cast<uint32_t>((axisOf(centroids[tri], axis) - lo) * scale));
+      bins[b].bounds.grow(triBounds[tri]);
+      bins[b].count++;
+    }
+
+    // sweep from both sides, split b puts bins 0 .. b - 1 to the left
+    Aabb left, right;
+    uint32_t nLeft = 0, nRight = 0;
+    for (uint32_t b = 1; b < nBins; ++b) {
+      left.grow(bins[b - 1].bounds);
+      nLeft += bins[b - 1].count;
+      leftArea[b] = left.halfArea();
+      leftCount[b] = nLeft;
+
+      right.grow(bins[nBins - b].bounds);
+      nRight += bins[nBins - b].count;
+      rightArea[nBins - b] = right.halfArea();
+      rightCount[nBins - b] = nRight;
+    }
+    for (uint32_t b = 1; b < nBins; ++b) {
+      if (leftCount[b] == 0 || rightCount[b] == 0) {
+        continue;
+      }
+      float cost = leftArea[b] * leftCount[b] + rightArea[b] * rightCount[b];
+      if (cost < best.cost) {
+        best.axis = axis;
+        best.bin = b;
+        best.cost = cost;
+      }
+    }
+  }
+  return best;
+}
+
+void Bvh::build(uint32_t node, uint32_t first, uint32_t count,
+                uint32_t depth, uint32_t threadDepth) {
+  Aabb bounds, centroidBounds;
+  for (uint32_t i = first; i < first + count; ++i) {
+    bounds.grow(triBounds[triIndices[i]]);
+    centroidBounds.grow(centroids[triIndices[i]]);
+  }
+  Node &current = nodes[node];
+  current.min = bounds.min;
+  current.max = bounds.max;
+  current.leftFirst = first;
+  current.count = count;
+  if (count == 1) {
+    return;
+  }
+
+  uint32_t mid = first;
+  if (depth + 1 + ceilLog2(count) > MAX_DEPTH) {
+    // a lopsided SAH split could push the leaves below MAX_DEPTH
+    if (count <= options.maxLeafSize) {
+      return;
+    }
+    mid = medianSplit(first, count, centroidBounds);
+  } else {
+    Split split = findSplit(first, count, centroidBounds);
+    if (split.cost == std::numeric_limits<float>::max()) {
+      // all centroids coincide, there is nothing to bin
+      if (count <= options.maxLeafSize) {
+        return;
+      }
+      mid = first + count / 2;
+    } else {
+      float area = bounds.halfArea();
+      float splitCost =
+          options.traversalCost +
+          options.intersectionCost * (area > 0.f ? split.cost / area : count);
+      float leafCost = options.intersectionCost * count;
+      if (splitCost >= leafCost && count <= options.maxLeafSize) {
+        return;
+      }
+      float lo = axisOf(centroidBounds.min, split.axis);
+      float scale = options.bins /
+                    (axisOf(centroidBounds.max, split.axis) - lo);
+      // the same binning as findSplit, so no triangle changes sides
+      auto isLeft = [&](uint32_t tri) {
+        uint32_t b = std::min(
+            options.bins - 1,
+            static_cast<uint32_t>((axisOf(centroids[tri], split.axis) - lo) *
+                                  scale));
+        return b < split.bin;
+      };
+      mid = static_cast<uint32_t>(
+          std::partition(triIndices.begin() + first,
+                         triIndices.begin() + first + count, isLeft) -
+          triIndices.begin());
+    }
+  }
+
+  uint32_t left = allocPair();
+  current.leftFirst = left;
+  current.count = 0;
+  uint32_t nLeft = mid - first;
+  uint32_t nRight = count - nLeft;
+  // children write to their own nodes and ranges of triIndices only
+  if (threadDepth > 0 && count > options.parallelThreshold) {
+    auto task = std::async(std::launch::async, [this, left, first, nLeft,
+                                                depth, threadDepth]() {
+      build(left, first, nLeft, depth + 1, threadDepth - 1);
+    });
+    build(left + 1, mid, nRight, depth + 1, threadDepth - 1);
+    task.get();
+  } else {
+    build(left, first, nLeft, depth + 1, 0);
+    build(left + 1, mid, nRight, depth + 1, 0);
+  }
+}
+
+void Bvh::computeStats() {
+  stats = BuildStats{};
+  stats.nodes = nTris() != 0 ? static_cast<uint32_t>(nodes.size()) - 1 : 0;
+  stats.leafSizes.assign(options.maxLeafSize + 1, 0);
+  stats.minLeafSize = std::numeric_limits<uint32_t>::max();
+  float rootArea = rootBounds.halfArea();
+  if (nTris() == 0) {
+    stats.minLeafSize = 0;
+    return;
+  }
+
+  struct Entry {
+    uint32_t node;
+    uint32_t depth;
+  };
+  std::vector<Entry> stack{{0, 1}};
+  double cost = 0.;
+  while (!stack.empty()) {
+    Entry e = stack.back();
+    stack.pop_back();
+    const Node &node = nodes[e.node];
+    Aabb box{node.min, node.max};
+    float relArea = rootArea > 0.f ? box.halfArea() / rootArea : 1.f;
+    stats.maxDepth = std::max(stats.maxDepth, e.depth);
+    if (node.leaf()) {
+      cost += options.intersectionCost * node.count * relArea;
+      stats.leaves++;
+      stats.minLeafSize = std::min(stats.minLeafSize, node.count);
+      stats.maxLeafSize = std::max(stats.maxLeafSize, node.count);
+      if (node.count >= stats.leafSizes.size()) {
+        stats.leafSizes.resize(node.count + 1, 0);
+      }
+      stats.leafSizes[node.count]++;
+    } else {
+      cost += options.traversalCost * relArea;
+      stack.push_back({node.leftFirst, e.depth + 1});
+      stack.push_back({node.leftFirst + 1, e.depth + 1});
+    }
+  }
+  stats.sahCost = static_cast<float>(cost / options.intersectionCost);
+  stats.avgLeafSize = static_cast<float>(nTris()) / stats.leaves;
+}
+
+Bvh::Shear Bvh::shear(const float *dir) {
+  Shear s;
+  s.kz = 0;
+  for (uint32_t k = 1; k < 3; ++k) {
+    if (std::abs(dir[k]) > std::abs(dir[s.kz])) {
+      s.kz = k;
+    }
+  }
+  s.kx = (s.kz + 1) % 3;
+  s.ky = (s.kx + 1) % 3;
+  // keeps the winding, so both sides have the same sign convention
+  if (dir[s.kz] < 0.f) {
+    std::swap(s.kx, s.ky);
+  }
+  s.sx = dir[s.kx] / dir[s.kz];
+  s.sy = dir[s.ky] / dir[s.kz];
+  s.sz = 1.f / dir[s.kz];
+  return s;
+}
+
+bool Bvh::intersectTri(uint32_t tri, const glm::vec3 &ori, const Shear &s,
+                       float tMin, Hit &hit) const {
+  const glm::vec3 &p0 = vertices[indices[3 * tri + 0]];
+  const glm::vec3 &p1 = vertices[indices[3 * tri + 1]];
+  const glm::vec3 &p2 = vertices[indices[3 * tri + 2]];
+  float az = p0[s.kz] - ori[s.kz];
+  float bz = p1[s.kz] - ori[s.kz];
+  float cz = p2[s.kz] - ori[s.kz];
+  float ax = (p0[s.kx] - ori[s.kx]) - s.sx * az;
+  float ay = (p0[s.ky] - ori[s.ky]) - s.sy * az;
+  float bx = (p1[s.kx] - ori[s.kx]) - s.sx * bz;
+  float by = (p1[s.ky] - ori[s.ky]) - s.sy * bz;
+  float cx = (p2[s.kx] - ori[s.kx]) - s.sx * cz;
+  float cy = (p2[s.ky] - ori[s.ky]) - s.sy * cz;
+  // edge functions, the barycentrics of p0, p1 and p2 times det
+  float u = cx * by - cy * bx;
+  float v = ax * cy - ay * cx;
+  float w = bx * ay - by * ax;
+  // both sides are hit, like the opaque rays of rttri.rgen
+  if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f)) {
+    return false;
+  }
+  float det = (u + v) + w;
+  if (det == 0.f) {
+    return false;
+  }
+  float tScaled = (u * (s.sz * az) + v * (s.sz * bz)) + w * (s.sz * cz);
+  float invDet = 1.f / det;
+  float t = tScaled * invDet;
+  if (!(t > tMin && t < hit.t)) {
+    return false;
+  }
+  hit.t = t;
+  hit.u = v * invDet;
+  hit.v = w * invDet;
+  hit.tri = tri;
+  return true;
+}
+
+namespace {
+// entry distance of the ray into the box, max if it misses or enters
+// behind tMax
+float slab(const Bvh::Node &node, const glm::vec3 &ori,
+           const glm::vec3 &invDir, float tMin, float tMax) {
+  glm::vec3 t0 = (node.min - ori) * invDir;
+  glm::vec3 t1 = (node.max - ori) * invDir;
+  glm::vec3 tNear = glm::min(t0, t1);
+  glm::vec3 tFar = glm::max(t0, t1);
+  float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tMin));
+  float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax)) *
+               Bvh::EXIT_SCALE;
+  return enter <= exit ? enter : std::numeric_limits<float>::max();
+}
+} // namespace
+
+Bvh::Hit Bvh::intersect(const glm::vec3 &ori, const glm::vec3 &dir,
+                        float tMin, float tMax) const {
+  Hit hit;
+  hit.t = tMax;
+  if (nTris() == 0) {
+    return hit;
+  }
+  glm::vec3 invDir = 1.f / dir;
+  Shear s = shear(&dir[0]);
+  if (slab(nodes[0], ori, invDir, tMin, tMax) ==
+      std::numeric_limits<float>::max()) {
+    return hit;
+  }
+
+  // the far children of the nodes above the current one
+  uint32_t stack[MAX_DEPTH];
+  uint32_t size = 0;
+  uint32_t current = 0;
+  while (true) {
+    const Node &node = nodes[current];
+    if (node.leaf()) {
+      for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i) {
+        intersectTri(triIndices[i], ori, s, tMin, hit);
+      }
+    } else {
+      // nearer child first, the other one goes on the stack
+      uint32_t near = node.leftFirst;
+      uint32_t far = node.leftFirst + 1;
+      float dNear = slab(nodes[near], ori, invDir, tMin, hit.t);
+      float dFar = slab(nodes[far], ori, invDir, tMin, hit.t);
+      if (dFar < dNear) {
+        std::swap(near, far);
+        std::swap(dNear, dFar);
+      }
+      if (dNear != std::numeric_limits<float>::max()) {
+        if (dFar != std::numeric_limits<float>::max()) {
+          stack[size++] = far;
+        }
+        current = near;
+        continue;
+      }
+    }
+    if (size == 0) {
+      break;
+    }
+    current = stack[--size];
+  }
+  if (hit.t >= tMax) {
+    hit = Hit{};
+  }
+  return hit;
+}
+} // namespace rn
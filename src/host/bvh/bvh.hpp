@@ -0,0 +1,200 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+namespace rn {
+// axis aligned bounding box, an empty box has min > max
+struct Aabb {
+  glm::vec3 min{std::numeric_limits<float>::max()};
+  glm::vec3 max{-std::numeric_limits<float>::max()};
+
+  void grow(const glm::vec3 &p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  void grow(const Aabb &b) {
+    min = glm::min(min, b.min);
+    max = glm::max(max, b.max);
+  }
+  bool empty() const { return min.x > max.x; }
+  // half the surface area, the factor 2 cancels in every SAH ratio
+  float halfArea() const {
+    if (empty()) {
+      return 0.f;
+    }
+    glm::vec3 e = max - min;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+  }
+};
+
+// std::allocator with the alignment of a cache line, std::vector only
+// guarantees alignof(T)
+template <typename T, size_t ALIGNMENT = 64> struct AlignedAllocator {
+  using value_type = T;
+  template <typename U> struct rebind {
+    using other = AlignedAllocator<U, ALIGNMENT>;
+  };
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, ALIGNMENT> &) {}
+  T *allocate(size_t n) {
+    return static_cast<T *>(
+        ::operator new(n * sizeof(T), std::align_val_t{ALIGNMENT}));
+  }
+  void deallocate(T *p, size_t) {
+    ::operator delete(p, std::align_val_t{ALIGNMENT});
+  }
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, ALIGNMENT> &) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, ALIGNMENT> &) const {
+    return false;
+  }
+};
+
+// binary BVH over the triangles of a GeometryHandler, built on the CPU
+// with binned SAH. Nodes live in one flat array, the two children of an
+// interior node are stored next to each other in the same cache line.
+class Bvh {
+public:
+  // 32 bytes, two siblings fill a cache line
+  struct alignas(32) Node {
+    glm::vec3 min;
+    // interior: index of the left child, the right one follows it
+    // leaf: first entry of triIndices
+    uint32_t leftFirst;
+    glm::vec3 max;
+    // triangles in the leaf, 0 for interior nodes
+    uint32_t count;
+    bool leaf() const { return count != 0; }
+  };
+
+  struct BuildOptions {
+    // bins per axis of the SAH sweep
+    uint32_t bins = 16;
+    // leaves are split further as long as they hold more triangles
+    uint32_t maxLeafSize = 8;
+    // relative cost of a node traversal to a triangle test
+    float traversalCost = 1.f;
+    float intersectionCost = 1.f;
+    // subtrees with more triangles are built on their own thread,
+    // 0 = hardware concurrency
+    uint32_t nThreads = 0;
+    uint32_t parallelThreshold = 4096;
+  };
+  // levels including the root and the leaves. Subtrees that could grow
+  // deeper with SAH splits are split at the median instead, which bounds
+  // the stack of intersect
+  static constexpr uint32_t MAX_DEPTH = 64;
+
+  struct BuildStats {
+    // expected cost of a random ray relative to the root, in units of
+    // BuildOptions::intersectionCost
+    float sahCost = 0.f;
+    uint32_t nodes = 0;
+    uint32_t leaves = 0;
+    uint32_t maxDepth = 0;
+    uint32_t minLeafSize = 0;
+    uint32_t maxLeafSize = 0;
+    float avgLeafSize = 0.f;
+    // leafSizes[n] = leaves with n triangles
+    std::vector<uint32_t> leafSizes{};
+    double buildMs = 0.;
+  };
+
+  // vertices and indices as in GeometryHandler::vertices / indices,
+  // triangle i is indices[3i .. 3i + 2]
+  Bvh(const std::vector<glm::vec3> &vertices,
+      const std::vector<uint32_t> &indices, const BuildOptions &options);
+  Bvh(const std::vector<glm::vec3> &vertices,
+      const std::vector<uint32_t> &indices)
+      : Bvh(vertices, indices, BuildOptions{}) {}
+
+  // closest hit of a ray with tMin < t < tMax, scalar reference traversal
+  struct Hit {
+    float t = std::numeric_limits<float>::max();
+    float u = 0.f;
+    float v = 0.f;
+    uint32_t tri = std::numeric_limits<uint32_t>::max();
+    bool valid() const { return tri != std::numeric_limits<uint32_t>::max(); }
+  };
+  Hit intersect(const glm::vec3 &ori, const glm::vec3 &dir, float tMin,
+                float tMax) const;
+
+  const std::vector<Node, AlignedAllocator<Node>> &getNodes() const {
+    return nodes;
+  };
+  // leaves reference the triangles triIndices[first .. first + count]
+  const std::vector<uint32_t> &getTriIndices() const { return triIndices; };
+  const std::vector<glm::vec3> &getVertices() const { return vertices; };
+  const std::vector<uint32_t> &getIndices() const { return indices; };
+  const BuildStats &getStats() const { return stats; };
+  const Aabb &bounds() const { return rootBounds; };
+  uint32_t nTris() const { return static_cast<uint32_t>(triIndices.size()); };
+
+  // the ray shear of the watertight test of Woop et al. 2013: axis kz is
+  // the largest of the direction and the triangle is sheared so that the
+  // ray runs along it. Rays through a shared edge or vertex then hit at
+  // least one of its triangles. The Bvh8 kernels evaluate the test with the
+  // same operations in the same order, so every kernel finds the same hits
+  struct Shear {
+    uint32_t kx = 0;
+    uint32_t ky = 1;
+    uint32_t kz = 2;
+    float sx = 0.f;
+    float sy = 0.f;
+    float sz = 1.f;
+  };
+  static Shear shear(const float *dir);
+  // slab exits are scaled by 1 + 2 gamma(3) (Ize 2013), so that rounding
+  // never culls a box the ray touches
+  static constexpr float EXIT_SCALE =
+      1.f + 4.f * std::numeric_limits<float>::epsilon();
+
+  // updates hit if triangle tri is hit closer than hit.t
+  bool intersectTri(uint32_t tri, const glm::vec3 &ori, const Shear &shear,
+                    float tMin, Hit &hit) const;
+
+private:
+  // triangles with a centroid in a bin below bin go to the left child
+  struct Split {
+    uint32_t axis = 0;
+    uint32_t bin = 0;
+    float cost = std::numeric_limits<float>::max();
+  };
+
+  // builds the subtree of node at depth over triIndices[first .. first +
+  // count], the left children of the top threadDepth levels get their own
+  // thread
+  void build(uint32_t node, uint32_t first, uint32_t count, uint32_t depth,
+             uint32_t threadDepth);
+  Split findSplit(uint32_t first, uint32_t count, const Aabb &centroidBounds);
+  // halves triIndices[first .. first + count] along the widest centroid
+  // axis, the child subtrees then need at most ceil(log2(count)) levels
+  uint32_t medianSplit(uint32_t first, uint32_t count,
+                       const Aabb &centroidBounds);
+  // reserves two adjacent nodes, safe to call from several threads
+  uint32_t allocPair();
+  void computeStats();
+
+  BuildOptions options;
+  std::vector<glm::vec3> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<Node, AlignedAllocator<Node>> nodes;
+  std::vector<uint32_t> triIndices;
+  // per triangle, only needed during the build
+  std::vector<Aabb> triBounds;
+  std::vector<glm::vec3> centroids;
+  std::atomic<uint32_t> nodesUsed{0};
+  Aabb rootBounds;
+  BuildStats stats;
+};
+} // namespace rn
@@ -0,0 +1,280 @@
+#include "bvh8.hpp"
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace rn {
+namespace {
+// triangles below node
+uint32_t subtreeTris(const Bvh &bvh, uint32_t node) {
+  const Bvh::Node &n = bvh.getNodes()[node];
+  if (n.leaf()) {
+    return n.count;
+  }
+  return subtreeTris(bvh, n.leftFirst) + subtreeTris(bvh, n.leftFirst + 1);
+}
+
+float halfArea(const Bvh::Node &n) {
+  return Aabb{n.min, n.max}.halfArea();
+}
+
+void emptyNode(Bvh8::Node &node) {
+  std::fill(std::begin(node.minX), std::end(node.minX),
+            std::numeric_limits<float>::max());
+  std::fill(std::begin(node.minY), std::end(node.minY),
+            std::numeric_limits<float>::max());
+  std::fill(std::begin(node.minZ), std::end(node.minZ),
+            std::numeric_limits<float>::max());
+  std::fill(std::begin(node.maxX), std::end(node.maxX),
+            -std::numeric_limits<float>::max());
+  std::fill(std::begin(node.maxY), std::end(node.maxY),
+            -std::numeric_limits<float>::max());
+  std::fill(std::begin(node.maxZ), std::end(node.maxZ),
+            -std::numeric_limits<float>::max());
+  std::fill(std::begin(node.child), std::end(node.child), Bvh8::EMPTY);
+}
+
+void gatherTris(const Bvh &bvh, uint32_t node, std::vector<uint32_t> &tris) {
+  const Bvh::Node &n = bvh.getNodes()[node];
+  if (n.leaf()) {
+    for (uint32_t i = n.leftFirst; i < n.leftFirst + n.count; ++i) {
+      tris.push_back(bvh.getTriIndices()[i]);
+    }
+    return;
+  }
+  gatherTris(bvh, n.leftFirst, tris);
+  gatherTris(bvh, n.leftFirst + 1, tris);
+}
+} // namespace
+
+Bvh8::Kernel Bvh8::bestKernel() {
+  if (supported(Kernel::eAvx512)) {
+    return Kernel::eAvx512;
+  }
+  if (supported(Kernel::eAvx2)) {
+    return Kernel::eAvx2;
+  }
+  return Kernel::eScalar;
+}
+
+bool Bvh8::supported(Kernel kernel) {
+  switch (kernel) {
+  case Kernel::eScalar:
+    return true;
+  case Kernel::eAvx2:
+#ifdef RN_BVH8_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+  case Kernel::eAvx512:
+#ifdef RN_BVH8_AVX512
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512vl");
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+std::string Bvh8::name(Kernel kernel) {
+  switch (kernel) {
+  case Kernel::eScalar:
+    return "scalar";
+  case Kernel::eAvx2:
+    return "avx2";
+  case Kernel::eAvx512:
+    return "avx512";
+  }
+  return "unknown";
+}
+
+Bvh8::Bvh8(const Bvh &bvh) {
+  // collapse only opens interior nodes and a block has WIDTH lanes
+  if (bvh.getStats().maxLeafSize > WIDTH) {
+    throw std::invalid_argument(
+        "bvh8: leaves with more than 8 triangles, build the Bvh with "
+        "BuildOptions::maxLeafSize <= Bvh8::WIDTH");
+  }
+  setKernel(bestKernel());
+  nodes.emplace_back();
+  emptyNode(nodes[0]);
+  if (bvh.nTris() == 0) {
+    return;
+  }
+  const Bvh::Node &root = bvh.getNodes()[0];
+  if (subtreeTris(bvh, 0) <= WIDTH) {
+    // the whole scene fits into one leaf below the root
+    nodes[0].minX[0] = root.min.x;
+    nodes[0].minY[0] = root.min.y;
+    nodes[0].minZ[0] = root.min.z;
+    nodes[0].maxX[0] = root.max.x;
+    nodes[0].maxY[0] = root.max.y;
+    nodes[0].maxZ[0] = root.max.z;
+    nodes[0].child[0] = LEAF | makeBlock(bvh, 0);
+    maxDepth = 1;
+    return;
+  }
+  maxDepth = collapse(bvh, 0, 0);
+  if (maxDepth > MAX_DEPTH) {
+    throw std::runtime_error("bvh8: tree deeper than the traversal stack");
+  }
+}
+
+Bvh::Hit Bvh8::intersect(const glm::vec3 &ori, const glm::vec3 &dir,
+                         float tMin, float tMax) const {
+  Bvh::Hit hit;
+  hit.t = tMax;
+  const float o[3] = {ori.x, ori.y, ori.z};
+  const float d[3] = {dir.x, dir.y, dir.z};
+  kernelFn(nodes.data(), blocks.data(), o, d, tMin, hit);
+  if (!hit.valid()) {
+    hit = Bvh::Hit{};
+  }
+  return hit;
+}
+
+uint64_t Bvh8::mismatches(const Bvh &bvh, uint32_t nRays,
+                          uint32_t seed) const {
+  if (bvh.nTris() == 0) {
+    return 0;
+  }
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  const Aabb &box = bvh.bounds();
+  glm::vec3 extent = box.max - box.min;
+  auto inBox = [&]() {
+    // a bit around the scene too, so rays start outside of it as well
+    return box.min - 0.25f * extent +
+           1.5f * extent * glm::vec3(unit(rng), unit(rng), unit(rng));
+  };
+  const auto &verts = bvh.getVertices();
+  const auto &idx = bvh.getIndices();
+  uint64_t count = 0;
+  for (uint32_t r = 0; r < nRays; ++r) {
+    glm::vec3 ori = inBox();
+    glm::vec3 target = inBox();
+    if (r % 2 == 0) {
+      // a point on an edge of a random triangle, every 8th one a vertex
+      uint32_t tri = std::min(static_cast<uint32_t>(unit(rng) * bvh.nTris()),
+                              bvh.nTris() - 1);
+      uint32_t corner = r % 3;
+      const glm::vec3 &a = verts[idx[3 * tri + corner]];
+      const glm::vec3 &b = verts[idx[3 * tri + (corner + 1) % 3]];
+      float f = r % 16 == 0 ? 0.f : unit(rng);
+      target = a + f * (b - a);
+    }
+    glm::vec3 dir = target - ori;
+    if (glm::dot(dir, dir) == 0.f) {
+      continue;
+    }
+    dir = glm::normalize(dir);
+    Bvh::Hit expected =
+        bvh.intersect(ori, dir, 0.f, std::numeric_limits<float>::max());
+    Bvh::Hit got = intersect(ori, dir, 0.f, std::numeric_limits<float>::max());
+    // the triangle may differ where two are hit at the very same distance
+    if (expected.valid() != got.valid() || expected.t != got.t) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+Bvh8::Kernel Bvh8::setKernel(Kernel kernel_) {
+  kernel = supported(kernel_) ? kernel_ : Kernel::eScalar;
+  switch (kernel) {
+#ifdef RN_BVH8_AVX2
+  case Kernel::eAvx2:
+    kernelFn = intersectBvh8Avx2;
+    break;
+#endif
+#ifdef RN_BVH8_AVX512
+  case Kernel::eAvx512:
+    kernelFn = intersectBvh8Avx512;
+    break;
+#endif
+  default:
+    kernelFn = intersectBvh8Scalar;
+    break;
+  }
+  return kernel;
+}
+
+uint32_t Bvh8::makeBlock(const Bvh &bvh, uint32_t bvhNode) {
+  std::vector<uint32_t> tris;
+  gatherTris(bvh, bvhNode, tris);
+  TriBlock block{};
+  std::fill(std::begin(block.tri), std::end(block.tri), EMPTY);
+  const auto &verts = bvh.getVertices();
+  const auto &idx = bvh.getIndices();
+  for (size_t lane = 0; lane < tris.size(); ++lane) {
+    uint32_t tri = tris[lane];
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      block.v0[axis][lane] = verts[idx[3 * tri + 0]][axis];
+      block.v1[axis][lane] = verts[idx[3 * tri + 1]][axis];
+      block.v2[axis][lane] = verts[idx[3 * tri + 2]][axis];
+    }
+    block.tri[lane] = tri;
+  }
+  blocks.push_back(block);
+  return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+uint32_t Bvh8::collapse(const Bvh &bvh, uint32_t bvhNode, uint32_t node) {
+  const auto &bvhNodes = bvh.getNodes();
+  // children of the wide node, opened greedily by surface area like the
+  // collapse of Wald et al. as long as slots are free
+  struct Child {
+    uint32_t bvhNode;
+    uint32_t nTris;
+  };
+  std::vector<Child> children;
+  const Bvh::Node &n = bvhNodes[bvhNode];
+  children.push_back({n.leftFirst, subtreeTris(bvh, n.leftFirst)});
+  children.push_back({n.leftFirst + 1, subtreeTris(bvh, n.leftFirst + 1)});
+  while (children.size() < WIDTH) {
+    // subtrees that fit into one block stay closed
+    auto open = children.end();
+    float best = -1.f;
+    for (auto it = children.begin(); it != children.end(); ++it) {
+      if (it->nTris > WIDTH && halfArea(bvhNodes[it->bvhNode]) > best) {
+        best = halfArea(bvhNodes[it->bvhNode]);
+        open = it;
+      }
+    }
+    if (open == children.end()) {
+      break;
+    }
+    uint32_t left = bvhNodes[open->bvhNode].leftFirst;
+    *open = {left, subtreeTris(bvh, left)};
+    children.push_back({left + 1, subtreeTris(bvh, left + 1)});
+  }
+
+  uint32_t depth = 0;
+  for (size_t lane = 0; lane < children.size(); ++lane) {
+    const Bvh::Node &c = bvhNodes[children[lane].bvhNode];
+    uint32_t child;
+    if (children[lane].nTris <= WIDTH) {
+      child = LEAF | makeBlock(bvh, children[lane].bvhNode);
+      depth = std::max(depth, 1u);
+    } else {
+      child = static_cast<uint32_t>(nodes.size());
+      nodes.emplace_back();
+      emptyNode(nodes.back());
+      depth = std::max(depth, collapse(bvh, children[lane].bvhNode, child));
+    }
+    // nodes may have been reallocated by the recursion
+    Node &wide = nodes[node];
+    wide.minX[lane] = c.min.x;
+    wide.minY[lane] = c.min.y;
+    wide.minZ[lane] = c.min.z;
+    wide.maxX[lane] = c.max.x;
+    wide.maxY[lane] = c.max.y;
+    wide.maxZ[lane] = c.max.z;
+    wide.child[lane] = child;
+  }
+  return depth + 1;
+}
+} // namespace rn
@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+
+namespace rn {
+// 8 wide BVH collapsed from a Bvh, traversed with one ray against the 8
+// children or 8 leaf triangles of a node at once. The kernel is picked from
+// what the CPU supports: AVX-512 (F + VL), AVX2 or a scalar loop
+class Bvh8 {
+public:
+  static constexpr uint32_t WIDTH = 8;
+  // child slot that holds nothing, its box is empty and never hit
+  static constexpr uint32_t EMPTY = 0xffffffffu;
+  // set on children that are leaves, the rest is a TriBlock index
+  static constexpr uint32_t LEAF = 0x80000000u;
+
+  // struct of arrays, every lane is a child, 256 bytes
+  struct alignas(64) Node {
+    float minX[WIDTH];
+    float minY[WIDTH];
+    float minZ[WIDTH];
+    float maxX[WIDTH];
+    float maxY[WIDTH];
+    float maxZ[WIDTH];
+    uint32_t child[WIDTH];
+  };
+  // the triangles of a leaf, v0[axis][lane] and so on. The vertices and not
+  // the edges are stored, a shared edge then gives the same edge function
+  // on both of its triangles, lanes without one are all zero and rejected
+  // by the determinant test
+  struct alignas(64) TriBlock {
+    float v0[3][WIDTH];
+    float v1[3][WIDTH];
+    float v2[3][WIDTH];
+    // global triangle index, EMPTY for unused lanes
+    uint32_t tri[WIDTH];
+  };
+
+  enum class Kernel { eScalar, eAvx2, eAvx512 };
+  // the widest kernel this binary has and the CPU runs
+  static Kernel bestKernel();
+  static bool supported(Kernel kernel);
+  static std::string name(Kernel kernel);
+
+  // bvh needs leaves of at most WIDTH triangles, see
+  // Bvh::BuildOptions::maxLeafSize, throws std::invalid_argument otherwise
+  explicit Bvh8(const Bvh &bvh);
+
+  // the same hit as Bvh::intersect, see Bvh::Shear
+  Bvh::Hit intersect(const glm::vec3 &ori, const glm::vec3 &dir, float tMin,
+                     float tMax) const;
+  // rays of the current kernel whose hit distance differs from
+  // Bvh::intersect on bvh, the tree this one was collapsed from. Half of the
+  // nRays aim at triangle edges and vertices, where rounding differences
+  // show up first
+  uint64_t mismatches(const Bvh &bvh, uint32_t nRays, uint32_t seed) const;
+  // falls back to eScalar if kernel is not supported, returns the one in use
+  Kernel setKernel(Kernel kernel);
+  Kernel getKernel() const { return kernel; };
+
+  const std::vector<Node, AlignedAllocator<Node>> &getNodes() const {
+    return nodes;
+  };
+  const std::vector<TriBlock, AlignedAllocator<TriBlock>> &getBlocks() const {
+    return blocks;
+  };
+  uint32_t getMaxDepth() const { return maxDepth; };
+
+  // deeper trees would overflow the fixed traversal stack of the kernels
+  static constexpr uint32_t MAX_DEPTH = 64;
+  static constexpr uint32_t STACK_SIZE = MAX_DEPTH * (WIDTH - 1) + 1;
+
+  // hit.t = tMax on entry, hit is only written for closer hits
+  using IntersectFn = void (*)(const Node *nodes, const TriBlock *blocks,
+                               const float *ori, const float *dir, float tMin,
+                               Bvh::Hit &hit);
+
+private:
+  // collapses the subtree of bvh node into node, returns its depth
+  uint32_t collapse(const Bvh &bvh, uint32_t bvhNode, uint32_t node);
+  // a leaf block with all triangles below bvh node
+  uint32_t makeBlock(const Bvh &bvh, uint32_t bvhNode);
+
+  std::vector<Node, AlignedAllocator<Node>> nodes;
+  std::vector<TriBlock, AlignedAllocator<TriBlock>> blocks;
+  uint32_t maxDepth = 0;
+  Kernel kernel = Kernel::eScalar;
+  IntersectFn kernelFn = nullptr;
+};
+
+// the kernels, each in its own translation unit compiled for its
+// instruction set. Only call them if Bvh8::supported says so
+void intersectBvh8Scalar(const Bvh8::Node *nodes, const Bvh8::TriBlock *blocks,
+                         const float *ori, const float *dir, float tMin,
+                         Bvh::Hit &hit);
+#ifdef RN_BVH8_AVX2
+void intersectBvh8Avx2(const Bvh8::Node *nodes, const Bvh8::TriBlock *blocks,
+                       const float *ori, const float *dir, float tMin,
+                       Bvh::Hit &hit);
+#endif
+#ifdef RN_BVH8_AVX512
+void intersectBvh8Avx512(const Bvh8::Node *nodes,
+                         const Bvh8::TriBlock *blocks, const float *ori,
+                         const float *dir, float tMin, Bvh::Hit &hit);
+#endif
+} // namespace rn
@@ -0,0 +1,148 @@
+#include "bvh8traverse.hpp"
+#include <immintrin.h>
+
+namespace rn {
+namespace {
+// the 8 children or triangles of a node in one __m256 each, compiled with
+// -mavx2
+struct Avx2 {
+  struct Ray {
+    Ray(const float *ori, const float *dir) : shear(Bvh::shear(dir)) {
+      for (int i = 0; i < 3; ++i) {
+        o[i] = _mm256_set1_ps(ori[i]);
+        inv[i] = _mm256_set1_ps(safeInverse(dir[i]));
+      }
+      sx = _mm256_set1_ps(shear.sx);
+      sy = _mm256_set1_ps(shear.sy);
+      sz = _mm256_set1_ps(shear.sz);
+    }
+    __m256 o[3];
+    __m256 inv[3];
+    Bvh::Shear shear;
+    __m256 sx;
+    __m256 sy;
+    __m256 sz;
+  };
+
+  // (bound - o) * inv of one axis
+  static __m256 slab(const float *bound, __m256 o, __m256 inv) {
+    return _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bound), o), inv);
+  }
+
+  static uint32_t testNode(const Bvh8::Node &node, const Ray &ray, float tMin,
+                           float tMax, uint32_t *child, float *dist) {
+    __m256 x0 = slab(node.minX, ray.o[0], ray.inv[0]);
+    __m256 x1 = slab(node.maxX, ray.o[0], ray.inv[0]);
+    __m256 y0 = slab(node.minY, ray.o[1], ray.inv[1]);
+    __m256 y1 = slab(node.maxY, ray.o[1], ray.inv[1]);
+    __m256 z0 = slab(node.minZ, ray.o[2], ray.inv[2]);
+    __m256 z1 = slab(node.maxZ, ray.o[2], ray.inv[2]);
+    __m256 enter = _mm256_max_ps(
+        _mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)),
+        _mm256_max_ps(_mm256_min_ps(z0, z1), _mm256_set1_ps(tMin)));
+    __m256 exit = _mm256_mul_ps(
+        _mm256_min_ps(
+            _mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)),
+            _mm256_min_ps(_mm256_max_ps(z0, z1), _mm256_set1_ps(tMax))),
+        _mm256_set1_ps(Bvh::EXIT_SCALE));
+    __m256i children =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(node.child));
+    __m256 empty = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+        children, _mm256_set1_epi32(static_cast<int>(Bvh8::EMPTY))));
+    __m256 hitMask =
+        _mm256_andnot_ps(empty, _mm256_cmp_ps(enter, exit, _CMP_LE_OQ));
+    uint32_t bits = static_cast<uint32_t>(_mm256_movemask_ps(hitMask));
+    if (bits == 0) {
+      return 0;
+    }
+    alignas(32) float enterLanes[Bvh8::WIDTH];
+    _mm256_store_ps(enterLanes, enter);
+    uint32_t n = 0;
+    while (bits != 0) {
+      uint32_t lane = static_cast<uint32_t>(__builtin_ctz(bits));
+      bits &= bits - 1;
+      child[n] = node.child[lane];
+      dist[n++] = enterLanes[lane];
+    }
+    return n;
+  }
+
+  // vertex minus origin along axis k
+  static __m256 rel(const float (*v)[Bvh8::WIDTH], const Ray &ray,
+                    uint32_t k) {
+    return _mm256_sub_ps(_mm256_load_ps(v[k]), ray.o[k]);
+  }
+
+  static void testBlock(const Bvh8::TriBlock &b, const Ray &ray, float tMin,
+                        Bvh::Hit &hit) {
+    const Bvh::Shear &s = ray.shear;
+    // watertight on all lanes, as Bvh::intersectTri
+    __m256 az = rel(b.v0, ray, s.kz);
+    __m256 bz = rel(b.v1, ray, s.kz);
+    __m256 cz = rel(b.v2, ray, s.kz);
+    __m256 ax = _mm256_sub_ps(rel(b.v0, ray, s.kx), _mm256_mul_ps(ray.sx, az));
+    __m256 ay = _mm256_sub_ps(rel(b.v0, ray, s.ky), _mm256_mul_ps(ray.sy, az));
+    __m256 bx = _mm256_sub_ps(rel(b.v1, ray, s.kx), _mm256_mul_ps(ray.sx, bz));
+    __m256 by = _mm256_sub_ps(rel(b.v1, ray, s.ky), _mm256_mul_ps(ray.sy, bz));
+    __m256 cx = _mm256_sub_ps(rel(b.v2, ray, s.kx), _mm256_mul_ps(ray.sx, cz));
+    __m256 cy = _mm256_sub_ps(rel(b.v2, ray, s.ky), _mm256_mul_ps(ray.sy, cz));
+    __m256 u = _mm256_sub_ps(_mm256_mul_ps(cx, by), _mm256_mul_ps(cy, bx));
+    __m256 v = _mm256_sub_ps(_mm256_mul_ps(ax, cy), _mm256_mul_ps(ay, cx));
+    __m256 w = _mm256_sub_ps(_mm256_mul_ps(bx, ay), _mm256_mul_ps(by, ax));
+    __m256 zero = _mm256_setzero_ps();
+    __m256 anyNeg = _mm256_or_ps(
+        _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ),
+                     _mm256_cmp_ps(v, zero, _CMP_LT_OQ)),
+        _mm256_cmp_ps(w, zero, _CMP_LT_OQ));
+    __m256 anyPos = _mm256_or_ps(
+        _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_GT_OQ),
+                     _mm256_cmp_ps(v, zero, _CMP_GT_OQ)),
+        _mm256_cmp_ps(w, zero, _CMP_GT_OQ));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(u, v), w);
+    __m256 mask = _mm256_andnot_ps(_mm256_and_ps(anyNeg, anyPos),
+                                   _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+    if (_mm256_movemask_ps(mask) == 0) {
+      return;
+    }
+    __m256 tScaled = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(u, _mm256_mul_ps(ray.sz, az)),
+                      _mm256_mul_ps(v, _mm256_mul_ps(ray.sz, bz))),
+        _mm256_mul_ps(w, _mm256_mul_ps(ray.sz, cz)));
+    __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+    __m256 t = _mm256_mul_ps(tScaled, invDet);
+    mask = _mm256_and_ps(
+        mask, _mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GT_OQ));
+    mask = _mm256_and_ps(
+        mask, _mm256_cmp_ps(t, _mm256_set1_ps(hit.t), _CMP_LT_OQ));
+    uint32_t bits = static_cast<uint32_t>(_mm256_movemask_ps(mask));
+    if (bits == 0) {
+      return;
+    }
+
+    // closest lane: horizontal minimum of the valid distances
+    __m256 tValid = _mm256_blendv_ps(_mm256_set1_ps(hit.t), t, mask);
+    __m256 m = _mm256_min_ps(tValid, _mm256_permute2f128_ps(tValid, tValid, 1));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    bits &= static_cast<uint32_t>(
+        _mm256_movemask_ps(_mm256_cmp_ps(tValid, m, _CMP_EQ_OQ)));
+    uint32_t lane = static_cast<uint32_t>(__builtin_ctz(bits));
+
+    alignas(32) float lanes[Bvh8::WIDTH];
+    _mm256_store_ps(lanes, t);
+    hit.t = lanes[lane];
+    _mm256_store_ps(lanes, _mm256_mul_ps(v, invDet));
+    hit.u = lanes[lane];
+    _mm256_store_ps(lanes, _mm256_mul_ps(w, invDet));
+    hit.v = lanes[lane];
+    hit.tri = b.tri[lane];
+  }
+};
+} // namespace
+
+void intersectBvh8Avx2(const Bvh8::Node *nodes, const Bvh8::TriBlock *blocks,
+                       const float *ori, const float *dir, float tMin,
+                       Bvh::Hit &hit) {
+  traverse<Avx2>(nodes, blocks, ori, dir, tMin, hit);
+}
+} // namespace rn
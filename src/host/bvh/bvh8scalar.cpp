@@ -0,0 +1,96 @@
+#include "bvh8traverse.hpp"
+
+namespace rn {
+namespace {
+// plain loops over the lanes, for CPUs without AVX2 and as the reference
+// of the vector kernels
+struct Scalar {
+  struct Ray {
+    Ray(const float *ori, const float *dir) : shear(Bvh::shear(dir)) {
+      for (int i = 0; i < 3; ++i) {
+        o[i] = ori[i];
+        inv[i] = safeInverse(dir[i]);
+      }
+    }
+    float o[3];
+    float inv[3];
+    Bvh::Shear shear;
+  };
+
+  static float minf(float a, float b) { return a < b ? a : b; }
+  static float maxf(float a, float b) { return a > b ? a : b; }
+
+  static uint32_t testNode(const Bvh8::Node &node, const Ray &ray, float tMin,
+                           float tMax, uint32_t *child, float *dist) {
+    uint32_t n = 0;
+    for (uint32_t lane = 0; lane < Bvh8::WIDTH; ++lane) {
+      if (node.child[lane] == Bvh8::EMPTY) {
+        continue;
+      }
+      float x0 = (node.minX[lane] - ray.o[0]) * ray.inv[0];
+      float x1 = (node.maxX[lane] - ray.o[0]) * ray.inv[0];
+      float y0 = (node.minY[lane] - ray.o[1]) * ray.inv[1];
+      float y1 = (node.maxY[lane] - ray.o[1]) * ray.inv[1];
+      float z0 = (node.minZ[lane] - ray.o[2]) * ray.inv[2];
+      float z1 = (node.maxZ[lane] - ray.o[2]) * ray.inv[2];
+      float enter = maxf(maxf(minf(x0, x1), minf(y0, y1)),
+                         maxf(minf(z0, z1), tMin));
+      float exit = minf(minf(maxf(x0, x1), maxf(y0, y1)),
+                        minf(maxf(z0, z1), tMax)) *
+                   Bvh::EXIT_SCALE;
+      if (enter <= exit) {
+        child[n] = node.child[lane];
+        dist[n++] = enter;
+      }
+    }
+    return n;
+  }
+
+  static void testBlock(const Bvh8::TriBlock &b, const Ray &ray, float tMin,
+                        Bvh::Hit &hit) {
+    const Bvh::Shear &s = ray.shear;
+    for (uint32_t lane = 0; lane < Bvh8::WIDTH; ++lane) {
+      if (b.tri[lane] == Bvh8::EMPTY) {
+        continue;
+      }
+      // watertight, as Bvh::intersectTri
+      float az = b.v0[s.kz][lane] - ray.o[s.kz];
+      float bz = b.v1[s.kz][lane] - ray.o[s.kz];
+      float cz = b.v2[s.kz][lane] - ray.o[s.kz];
+      float ax = (b.v0[s.kx][lane] - ray.o[s.kx]) - s.sx * az;
+      float ay = (b.v0[s.ky][lane] - ray.o[s.ky]) - s.sy * az;
+      float bx = (b.v1[s.kx][lane] - ray.o[s.kx]) - s.sx * bz;
+      float by = (b.v1[s.ky][lane] - ray.o[s.ky]) - s.sy * bz;
+      float cx = (b.v2[s.kx][lane] - ray.o[s.kx]) - s.sx * cz;
+      float cy = (b.v2[s.ky][lane] - ray.o[s.ky]) - s.sy * cz;
+      float u = cx * by - cy * bx;
+      float v = ax * cy - ay * cx;
+      float w = bx * ay - by * ax;
+      if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f)) {
+        continue;
+      }
+      float det = (u + v) + w;
+      if (det == 0.f) {
+        continue;
+      }
+      float tScaled = (u * (s.sz * az) + v * (s.sz * bz)) + w * (s.sz * cz);
+      float invDet = 1.f / det;
+      float t = tScaled * invDet;
+      if (!(t > tMin && t < hit.t)) {
+        continue;
+      }
+      hit.t = t;
+      hit.u = v * invDet;
+      hit.v = w * invDet;
+      hit.tri = b.tri[lane];
+    }
+  }
+};
+} // namespace
+
+void intersectBvh8Scalar(const Bvh8::Node *nodes, const Bvh8::TriBlock *blocks,
+                         const float *ori, const float *dir, float tMin,
+                         Bvh::Hit &hit) {
+  traverse<Scalar>(nodes, blocks, ori, dir, tMin, hit);
+}
+} // namespace rn
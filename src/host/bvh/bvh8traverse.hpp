@@ -0,0 +1,73 @@
+#pragma once
+// traversal shared by the Bvh8 kernels, only included by bvh8scalar.cpp,
+// bvh8avx2.cpp and bvh8avx512.cpp. Those are compiled for different
+// instruction sets, so everything here has internal linkage: an inline
+// function the linker merges across them could run AVX-512 code on a CPU
+// without it.
+#include "bvh8.hpp"
+
+namespace rn {
+namespace {
+// directions with a zero component still give finite slab distances
+inline float safeInverse(float d) {
+  const float eps = 1e-20f;
+  if (d > -eps && d < eps) {
+    d = d < 0.f ? -eps : eps;
+  }
+  return 1.f / d;
+}
+
+// Isa provides
+//   struct Ray { Ray(const float *ori, const float *dir); };
+//   static uint32_t testNode(const Bvh8::Node &, const Ray &, float tMin,
+//                            float tMax, uint32_t *child, float *dist);
+//     children the ray enters before tMax * Bvh::EXIT_SCALE, returns
+//     their number
+//   static void testBlock(const Bvh8::TriBlock &, const Ray &, float tMin,
+//                         Bvh::Hit &hit);
+//     closest triangle of the block with tMin < t < hit.t, computed like
+//     Bvh::intersectTri without fused multiply adds
+template <typename Isa>
+void traverse(const Bvh8::Node *nodes, const Bvh8::TriBlock *blocks,
+              const float *ori, const float *dir, float tMin, Bvh::Hit &hit) {
+  typename Isa::Ray ray(ori, dir);
+  uint32_t stackChild[Bvh8::STACK_SIZE];
+  float stackDist[Bvh8::STACK_SIZE];
+  uint32_t size = 0;
+  stackChild[size] = 0;
+  stackDist[size++] = tMin;
+
+  alignas(32) uint32_t child[Bvh8::WIDTH];
+  alignas(32) float dist[Bvh8::WIDTH];
+  while (size != 0) {
+    --size;
+    // entered after the closest hit found since it was pushed
+    if (stackDist[size] > hit.t * Bvh::EXIT_SCALE) {
+      continue;
+    }
+    uint32_t current = stackChild[size];
+    if ((current & Bvh8::LEAF) != 0) {
+      Isa::testBlock(blocks[current & ~Bvh8::LEAF], ray, tMin, hit);
+      continue;
+    }
+    uint32_t n = Isa::testNode(nodes[current], ray, tMin, hit.t, child, dist);
+    // insertion sort, farthest first so the nearest child is popped next
+    for (uint32_t i = 1; i < n; ++i) {
+      uint32_t c = child[i];
+      float d = dist[i];
+      uint32_t j = i;
+      for (; j > 0 && dist[j - 1] < d; --j) {
+        child[j] = child[j - 1];
+        dist[j] = dist[j - 1];
+      }
+      child[j] = c;
+      dist[j] = d;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+      stackChild[size] = child[i];
+      stackDist[size++] = dist[i];
+    }
+  }
+}
+} // namespace
+} // namespace rn
@@ -0,0 +1,236 @@
+#include "cputracer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include "raytracer/philox.hpp"
+#include "sampling.hpp"
+
+namespace rn {
+CpuTracer::CpuTracer(const GeometryHandler &geom, const Options &options_)
+    : options(options_),
+      nTris(static_cast<uint32_t>(geom.indices.size() / 3)),
+      frames(geom.frames), aliasTable(geom.aliasTable) {
+  options.raysPerTask = std::max(options.raysPerTask, 1u);
+  Bvh::BuildOptions buildOptions;
+  buildOptions.nThreads = options.nThreads;
+  // one leaf fills at most one triangle block of the wide tree
+  buildOptions.maxLeafSize = Bvh8::WIDTH;
+  Bvh binary(geom.vertices, geom.indices, buildOptions);
+  bvhStats = binary.getStats();
+  bvh = std::make_unique<Bvh8>(binary);
+  setThreads(options.nThreads);
+}
+
+void CpuTracer::setThreads(uint32_t nThreads) {
+  pool = std::make_unique<WorkStealingPool>(nThreads);
+  workerBins.assign(pool->size(), WorkerBins{});
+  for (auto &worker : workerBins) {
+    worker.row.assign(nTris + 1, 0);
+  }
+}
+
+uint32_t CpuTracer::streamChunk(uint64_t nRays, uint32_t nEmitters) {
+  nEmitters = std::max(nEmitters, 1u);
+  uint64_t chunkHits = std::max<uint64_t>(CHUNK_HITS, nEmitters);
+  return static_cast<uint32_t>(
+      std::max<uint64_t>(std::min<uint64_t>(chunkHits / nEmitters, nRays), 1));
+}
+
+CpuTracer::Emission CpuTracer::emitRay(uint32_t tri, uint64_t ray,
+                                       uint32_t chunk, uint32_t seed) const {
+  // the device traces chunk rays per launch, ray id.x of batch b is ray
+  // b * chunk + id.x of the stream
+  uint32_t id = static_cast<uint32_t>(ray % chunk);
+  uint32_t batch = static_cast<uint32_t>(ray / chunk);
+  uint32_t sampleIdx = static_cast<uint32_t>(ray);
+
+  Emission e;
+  e.tri = tri;
+  if (tri == MISS_IDX) {
+    auto pick = raySample(seed, MISS_IDX, batch, id);
+    uint32_t slot = std::min(static_cast<uint32_t>(pick[0] * nTris), nTris - 1);
+    const GeometryHandler::AliasEntry &entry = aliasTable[slot];
+    e.tri = pick[1] < entry.prob ? slot : entry.alias;
+  }
+  const GeometryHandler::TriFrame &frame = frames[e.tri];
+
+  std::array<float, 4> u;
+  if (options.sobol) {
+    uint32_t scramble = sampling::tea(e.tri, seed ^ 0x5eed);
+    for (uint32_t dim = 0; dim < 4; ++dim) {
+      u[dim] = sampling::sobolOwen(sampleIdx, dim, scramble);
+    }
+  } else {
+    u = raySample(seed, e.tri, batch, id);
+  }
+  float sr1 = std::sqrt(u[0]);
+  float r2 = u[1];
+  glm::vec3 ori = glm::vec3(frame.origin) +
+                  glm::vec3(frame.e1) * (sr1 * (1 - r2)) +
+                  glm::vec3(frame.e2) * (sr1 * r2);
+
+  glm::vec3 local = sampling::cosineHemisphere(u[2], u[3]);
+  e.dir = local.x * glm::vec3(frame.tangent) +
+          local.y * glm::vec3(frame.bitangent) +
+          local.z * glm::vec3(frame.normal);
+  e.ori = sampling::offsetRay(ori, glm::vec3(frame.normal));
+  return e;
+}
+
+void CpuTracer::traceRays(uint32_t emitter, uint64_t nRays, uint32_t seed) {
+  launch(1, nRays, false, emitter, seed);
+}
+
+void CpuTracer::traceAll(uint64_t nRays, uint32_t seed) {
+  launch(nTris, nRays, false, MISS_IDX, seed);
+}
+
+void CpuTracer::traceGlobal(uint64_t nRays, uint32_t seed) {
+  launch(nTris, nRays, true, MISS_IDX, seed);
+}
+
+void CpuTracer::launch(uint32_t nRows, uint64_t raysPerRow, bool global,
+                       uint32_t emitter, uint32_t seed) {
+  auto start = std::chrono::steady_clock::now();
+  rows = nRows;
+  size_t rowSize = static_cast<size_t>(nTris) + 1;
+  bins.assign(rows * rowSize, Bin{0, 0});
+  if (nTris == 0 || raysPerRow == 0) {
+    lastLaunch = LaunchStats{0, 0., pool->size(), 0};
+    return;
+  }
+
+  // global launches are one row of rays on the device, the others one row
+  // per emitter
+  bool single = emitter != MISS_IDX;
+  uint32_t launchRows = global || single ? 1 : nRows;
+  uint32_t chunk = streamChunk(raysPerRow, launchRows);
+  uint64_t tasksPerRow =
+      raysPerRow / options.raysPerTask + (raysPerRow % options.raysPerTask != 0);
+  if (tasksPerRow > std::numeric_limits<uint64_t>::max() / launchRows) {
+    throw std::overflow_error("cpu launch with more than 2^64 tasks");
+  }
+  uint64_t nTasks = tasksPerRow * launchRows;
+
+  pool->run(nTasks, [&](uint64_t task, uint32_t worker) {
+    WorkerBins &wb = workerBins[worker];
+    uint32_t launchRow = static_cast<uint32_t>(task / tasksPerRow);
+    uint64_t first = (task % tasksPerRow) * options.raysPerTask;
+    uint64_t last =
+        first + std::min<uint64_t>(options.raysPerTask, raysPerRow - first);
+    uint32_t tri = global ? MISS_IDX : single ? emitter : launchRow;
+    // the row of the bins, single emitter launches fill the first
+    uint32_t binRow = single ? 0 : launchRow;
+
+    for (uint64_t ray = first; ray < last; ++ray) {
+      Emission e = emitRay(tri, ray, chunk, seed);
+      Bvh::Hit hit = bvh->intersect(e.ori, e.dir, 0.f, T_MAX);
+      uint32_t receiver = hit.valid() ? hit.tri : nTris;
+      if (global) {
+        wb.sparse[(static_cast<uint64_t>(e.tri) << 32) | receiver]++;
+      } else if (wb.row[receiver]++ == 0) {
+        wb.touched.push_back(receiver);
+      }
+    }
+
+    if (global) {
+      wb.entries.insert(wb.entries.end(), wb.sparse.begin(), wb.sparse.end());
+      wb.sparse.clear();
+      return;
+    }
+    for (uint32_t receiver : wb.touched) {
+      wb.entries.emplace_back((static_cast<uint64_t>(binRow) << 32) | receiver,
+                              wb.row[receiver]);
+      wb.row[receiver] = 0;
+    }
+    wb.touched.clear();
+  });
+
+  // every ray carries RAY_ENERGY = 1, as in emission.glsl
+  uint64_t rayEnergy = static_cast<uint64_t>(BIN_SCALE);
+  for (auto &wb : workerBins) {
+    for (const auto &[key, count] : wb.entries) {
+      Bin &bin = bins[(key >> 32) * rowSize + (key & 0xffffffffu)];
+      bin.energy += count * rayEnergy;
+      bin.count += count;
+    }
+    wb.entries.clear();
+  }
+
+  lastLaunch.rays = raysPerRow * launchRows;
+  lastLaunch.threads = pool->size();
+  lastLaunch.steals = pool->getSteals();
+  lastLaunch.ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+}
+
+std::vector<float> CpuTracer::getEnergy(uint32_t row) const {
+  std::vector<float> energy(nTris, 0.f);
+  if (row >= rows) {
+    return energy;
+  }
+  const Bin *rowBins = bins.data() + static_cast<size_t>(row) * (nTris + 1);
+  uint64_t total = 0;
+  for (uint32_t i = 0; i <= nTris; ++i) {
+    total += rowBins[i].energy;
+  }
+  if (total == 0) {
+    return energy;
+  }
+  float totalEnergy = static_cast<float>(total);
+  for (uint32_t i = 0; i < nTris; ++i) {
+    energy[i] = static_cast<float>(rowBins[i].energy) / totalEnergy;
+  }
+  return energy;
+}
+
+std::vector<float> CpuTracer::getViewFactors() const {
+  std::vector<float> vf;
+  vf.reserve(static_cast<size_t>(rows) * nTris);
+  for (uint32_t row = 0; row < rows; ++row) {
+    auto energy = getEnergy(row);
+    vf.insert(vf.end(), energy.begin(), energy.end());
+  }
+  return vf;
+}
+
+std::vector<CpuTracer::ScalingPoint>
+CpuTracer::measureScaling(uint64_t nRays, uint32_t seed, uint32_t maxThreads) {
+  if (maxThreads == 0) {
+    maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  uint32_t threads = getThreads();
+  std::vector<ScalingPoint> points;
+  for (uint32_t n = 1;; n = std::min(2 * n, maxThreads)) {
+    setThreads(n);
+    traceAll(nRays, seed);
+    double rate = lastLaunch.raysPerSecond();
+    double base = points.empty() ? rate : points.front().raysPerSecond;
+    double speedup = base > 0. ? rate / base : 0.;
+    points.push_back({n, rate, speedup, speedup / n});
+    if (n == maxThreads) {
+      break;
+    }
+  }
+  setThreads(threads);
+  return points;
+}
+
+void CpuTracer::printScaling(std::ostream &out,
+                             const std::vector<ScalingPoint> &points) {
+  out << std::setw(8) << "threads" << std::setw(12) << "Mrays/s"
+      << std::setw(10) << "speedup" << std::setw(12) << "efficiency"
+      << "\n";
+  for (const auto &p : points) {
+    out << std::setw(8) << p.threads << std::setw(12) << std::fixed
+        << std::setprecision(2) << p.raysPerSecond * 1e-6 << std::setw(10)
+        << p.speedup << std::setw(11) << std::setprecision(0)
+        << p.efficiency * 100. << "%\n";
+  }
+}
+} // namespace rn
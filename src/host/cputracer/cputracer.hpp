@@ -0,0 +1,135 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "bvh/bvh.hpp"
+#include "bvh/bvh8.hpp"
+#include "geometryloader/geometry.hpp"
+#include "workstealing.hpp"
+
+namespace rn {
+// the launches of Raytracer on the CPU, for machines without a ray tracing
+// device. Rays are emitted like src/shaders/emission.glsl does and traced
+// against a Bvh8. Every launch is split into (emitter, ray range) tasks on a
+// work stealing pool, each worker counts hits in its own bins, which are
+// merged once all tasks are done, so no bin is ever touched concurrently
+class CpuTracer {
+public:
+  struct Options {
+    // 0 = hardware concurrency
+    uint32_t nThreads = 0;
+    // rays of one emitter traced by one task
+    uint32_t raysPerTask = 1 << 14;
+    // owen scrambled sobol points instead of philox, as State::sobol
+    bool sobol = false;
+  };
+
+  CpuTracer(const GeometryHandler &geom, const Options &options);
+  explicit CpuTracer(const GeometryHandler &geom)
+      : CpuTracer(geom, Options{}) {}
+
+  // same layout as Raytracer::Bin, energy is fixed point scaled by
+  // BIN_SCALE
+  struct Bin {
+    uint64_t energy;
+    uint64_t count;
+  };
+  static constexpr double BIN_SCALE = 1048576.0;
+
+  // Raytracer::traceRays, nRays rays from emitter into a single row
+  void traceRays(uint32_t emitter, uint64_t nRays, uint32_t seed);
+  // binned Raytracer::traceAll, nRays rays from every triangle
+  void traceAll(uint64_t nRays, uint32_t seed);
+  // global Raytracer::traceAll, nRays rays in total, emitters are drawn
+  // from GeometryHandler::aliasTable
+  void traceGlobal(uint64_t nRays, uint32_t seed);
+
+  // rows x (nTris + 1) bins of the last launch, the last column holds the
+  // rays that escaped
+  const std::vector<Bin> &getBins() const { return bins; };
+  uint32_t getRows() const { return rows; };
+  // what normalizeBins.comp writes to the energy buffer: row of the
+  // emitter, divided by the energy of the row including the misses
+  std::vector<float> getEnergy(uint32_t row) const;
+  // row major rows x nTris view factors of the last launch
+  std::vector<float> getViewFactors() const;
+
+  struct LaunchStats {
+    uint64_t rays = 0;
+    double ms = 0.;
+    uint32_t threads = 0;
+    uint64_t steals = 0;
+    double raysPerSecond() const { return ms > 0. ? rays / ms * 1e3 : 0.; };
+  };
+  const LaunchStats &getLastLaunch() const { return lastLaunch; };
+
+  // traceAll with 1, 2, 4 .. maxThreads threads (0 = hardware concurrency)
+  struct ScalingPoint {
+    uint32_t threads;
+    double raysPerSecond;
+    // relative to one thread
+    double speedup;
+    double efficiency;
+  };
+  std::vector<ScalingPoint> measureScaling(uint64_t nRays, uint32_t seed,
+                                           uint32_t maxThreads = 0);
+  static void printScaling(std::ostream &out,
+                           const std::vector<ScalingPoint> &points);
+
+  void setThreads(uint32_t nThreads);
+  void setSobol(bool sobol) { options.sobol = sobol; };
+  uint32_t getThreads() const { return pool->size(); };
+  const Bvh::BuildStats &getBvhStats() const { return bvhStats; };
+  Bvh8 &getBvh() { return *bvh; };
+  uint32_t getTriCount() const { return nTris; };
+
+  // rays of one Raytracer stream chunk, the device draws the random numbers
+  // of a ray from (ray % chunk, ray / chunk), so this is needed to
+  // reproduce its rays. Mirrors Raytracer::startStream
+  static uint32_t streamChunk(uint64_t nRays, uint32_t nEmitters);
+  static constexpr uint64_t CHUNK_HITS = 1 << 22;
+
+private:
+  struct Emission {
+    uint32_t tri;
+    glm::vec3 ori;
+    glm::vec3 dir;
+  };
+  // emitRay of src/shaders/emission.glsl, tri = MISS_IDX draws the emitter
+  // from the alias table
+  Emission emitRay(uint32_t tri, uint64_t ray, uint32_t chunk,
+                   uint32_t seed) const;
+  void launch(uint32_t nRows, uint64_t raysPerRow, bool global,
+              uint32_t emitter, uint32_t seed);
+
+  static constexpr uint32_t MISS_IDX = 0xffffffffu;
+  static constexpr float T_MAX = 1000.f;
+
+  // the private bins of a worker, merged after the launch
+  struct WorkerBins {
+    // counts of the row a task traces, only the touched entries are reset
+    std::vector<uint32_t> row;
+    std::vector<uint32_t> touched;
+    // global tasks trace many emitters, their counts are kept sparse
+    std::unordered_map<uint64_t, uint64_t> sparse;
+    // (row << 32 | receiver, count) of all finished tasks
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+  };
+
+  Options options;
+  uint32_t nTris = 0;
+  std::vector<GeometryHandler::TriFrame> frames;
+  std::vector<GeometryHandler::AliasEntry> aliasTable;
+  std::unique_ptr<Bvh8> bvh;
+  Bvh::BuildStats bvhStats;
+  std::unique_ptr<WorkStealingPool> pool;
+  std::vector<WorkerBins> workerBins;
+
+  uint32_t rows = 0;
+  std::vector<Bin> bins;
+  LaunchStats lastLaunch;
+};
+} // namespace rn
@@ -0,0 +1,151 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "glm/glm.hpp"
+
+namespace rn {
+// host side of the emission in src/shaders/emission.glsl, random.glsl and
+// commonrt.glsl. Kept bit for bit where the shaders are exact, so a CPU
+// launch draws the same rays as the device up to the rounding of sqrt,
+// sin and cos
+namespace sampling {
+inline uint32_t tea(uint32_t v0, uint32_t v1) {
+  uint32_t s0 = 0;
+  for (uint32_t n = 0; n < 16; n++) {
+    s0 += 0x9e3779b9u;
+    v0 += ((v1 << 4) + 0xa341316cu) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4u);
+    v1 += ((v0 << 4) + 0xad90777du) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761eu);
+  }
+  return v0;
+}
+
+// Joe & Kuo direction numbers of the first four dimensions
+constexpr uint32_t SOBOL_DIMS = 4;
+constexpr uint32_t SOBOL_DIRECTIONS[SOBOL_DIMS * 32] = {
+    // dimension 0
+    0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u,
+    0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+    0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u,
+    0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+    0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u,
+    0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+    0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u,
+    0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u,
+    // dimension 1
+    0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u,
+    0x88000000u, 0xcc000000u, 0xaa000000u, 0xff000000u,
+    0x80800000u, 0xc0c00000u, 0xa0a00000u, 0xf0f00000u,
+    0x88880000u, 0xcccc0000u, 0xaaaa0000u, 0xffff0000u,
+    0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u,
+    0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u,
+    0x80808080u, 0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u,
+    0x88888888u, 0xccccccccu, 0xaaaaaaaau, 0xffffffffu,
+    // dimension 2
+    0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u,
+    0xe8000000u, 0x5c000000u, 0x8e000000u, 0xc5000000u,
+    0x68800000u, 0x9cc00000u, 0xee600000u, 0x55900000u,
+    0x80680000u, 0xc09c0000u, 0x60ee0000u, 0x90550000u,
+    0xe8808000u, 0x5cc0c000u, 0x8e606000u, 0xc5909000u,
+    0x6868e800u, 0x9c9c5c00u, 0xeeee8e00u, 0x5555c500u,
+    0x8000e880u, 0xc0005cc0u, 0x60008e60u, 0x9000c590u,
+    0xe8006868u, 0x5c009c9cu, 0x8e00eeeeu, 0xc5005555u,
+    // dimension 3
+    0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u,
+    0xf8000000u, 0x74000000u, 0xa2000000u, 0x93000000u,
+    0xd8800000u, 0x25400000u, 0x59e00000u, 0xe6d00000u,
+    0x78080000u, 0xb40c0000u, 0x82020000u, 0xc3050000u,
+    0x208f8000u, 0x51474000u, 0xfbea2000u, 0x75d93000u,
+    0xa0858800u, 0x914e5400u, 0xdbe79e00u, 0x25db6d00u,
+    0x58800080u, 0xe54000c0u, 0x79e00020u, 0xb6d00050u,
+    0x800800f8u, 0xc00c0074u, 0x200200a2u, 0x50050093u
+};
+
+inline uint32_t sobol(uint32_t index, uint32_t dim) {
+  uint32_t x = 0;
+  for (uint32_t bit = 0; index != 0; bit++, index >>= 1) {
+    if ((index & 1) != 0) {
+      x ^= SOBOL_DIRECTIONS[dim * 32 + bit];
+    }
+  }
+  return x;
+}
+
+inline uint32_t bitfieldReverse(uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+inline uint32_t laineKarras(uint32_t x, uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+  return bitfieldReverse(laineKarras(bitfieldReverse(x), seed));
+}
+
+inline uint32_t hashCombine(uint32_t seed, uint32_t v) {
+  return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+inline float sobolOwen(uint32_t index, uint32_t dim, uint32_t seed) {
+  uint32_t x = sobol(nestedUniformScramble(index, seed), dim);
+  x = nestedUniformScramble(x, hashCombine(seed, dim));
+  return static_cast<float>(x >> 8) / static_cast<float>(0x01000000);
+}
+
+// Malley's method, pdf cos(theta) / pi around +z
+inline glm::vec3 cosineHemisphere(float u0, float u1) {
+  float ox = 2.f * u0 - 1.f;
+  float oy = 2.f * u1 - 1.f;
+  if (ox == 0.f && oy == 0.f) {
+    return glm::vec3(0.f, 0.f, 1.f);
+  }
+  const float PI_4 = 0.78539816339f;
+  float r, phi;
+  if (std::abs(ox) > std::abs(oy)) {
+    r = ox;
+    phi = PI_4 * (oy / ox);
+  } else {
+    r = oy;
+    phi = 2.f * PI_4 - PI_4 * (ox / oy);
+  }
+  float dx = r * std::cos(phi);
+  float dy = r * std::sin(phi);
+  return glm::vec3(dx, dy, std::sqrt(std::max(0.f, 1.f - dx * dx - dy * dy)));
+}
+
+// offsetRay of commonrt.glsl, moves the origin off the surface by a few
+// ulps along the normal
+inline float offsetComponent(float p, float n) {
+  constexpr float ORIGIN = 1.f / 32.f;
+  constexpr float FLOAT_SCALE = 1.f / 65536.f;
+  constexpr float INT_SCALE = 256.f;
+  if (std::abs(p) < ORIGIN) {
+    return p + FLOAT_SCALE * n;
+  }
+  int32_t offset = static_cast<int32_t>(INT_SCALE * n);
+  int32_t bits;
+  std::memcpy(&bits, &p, sizeof(bits));
+  bits += p < 0.f ? -offset : offset;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+inline glm::vec3 offsetRay(const glm::vec3 &p, const glm::vec3 &n) {
+  return glm::vec3(offsetComponent(p.x, n.x), offsetComponent(p.y, n.y),
+                   offsetComponent(p.z, n.z));
+}
+} // namespace sampling
+} // namespace rn
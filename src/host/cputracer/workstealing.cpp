@@ -0,0 +1,115 @@
+#include "workstealing.hpp"
+#include <algorithm>
+
+namespace rn {
+WorkStealingPool::WorkStealingPool(uint32_t nThreads) {
+  if (nThreads == 0) {
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (uint32_t i = 0; i < nThreads; ++i) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (uint32_t i = 0; i < nThreads; ++i) {
+    workers.emplace_back(&WorkStealingPool::work, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void WorkStealingPool::run(
+    uint64_t nTasks,
+    const std::function<void(uint64_t task, uint32_t worker)> &fn) {
+  if (nTasks == 0) {
+    return;
+  }
+  // neighbouring tasks usually share an emitter, so every worker starts on
+  // a contiguous block
+  uint32_t n = size();
+  for (uint32_t w = 0; w < n; ++w) {
+    std::lock_guard<std::mutex> lock(queues[w]->mutex);
+    queues[w]->first = nTasks / n * w + std::min<uint64_t>(w, nTasks % n);
+    queues[w]->last =
+        nTasks / n * (w + 1) + std::min<uint64_t>(w + 1, nTasks % n);
+  }
+  steals = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  job = &fn;
+  busy = n;
+  ++generation;
+  wake.notify_all();
+  done.wait(lock, [this]() { return busy == 0; });
+  job = nullptr;
+}
+
+void WorkStealingPool::work(uint32_t worker) {
+  uint64_t seen = 0;
+  while (true) {
+    const std::function<void(uint64_t, uint32_t)> *fn;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&]() { return stop || generation != seen; });
+      if (stop) {
+        return;
+      }
+      seen = generation;
+      fn = job;
+    }
+    // no task creates new ones, so once all queues are empty this run is
+    // over for this worker
+    uint64_t task;
+    while (pop(worker, task) || steal(worker, task)) {
+      (*fn)(task, worker);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--busy == 0) {
+      done.notify_one();
+    }
+  }
+}
+
+bool WorkStealingPool::pop(uint32_t worker, uint64_t &task) {
+  Queue &queue = *queues[worker];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.first == queue.last) {
+    return false;
+  }
+  task = queue.first++;
+  return true;
+}
+
+bool WorkStealingPool::steal(uint32_t worker, uint64_t &task) {
+  uint32_t n = size();
+  for (uint32_t i = 1; i < n; ++i) {
+    uint64_t first, last;
+    {
+      Queue &victim = *queues[(worker + i) % n];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.first == victim.last) {
+        continue;
+      }
+      // the far half of the victim's block, away from where it works
+      last = victim.last;
+      first = last - (last - victim.first + 1) / 2;
+      victim.last = first;
+    }
+    // the own range is empty, so nobody steals from it meanwhile
+    Queue &own = *queues[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    task = first;
+    own.first = first + 1;
+    own.last = last;
+    ++steals;
+    return true;
+  }
+  return false;
+}
+} // namespace rn
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rn {
+// fixed set of worker threads with one range of tasks each. run() deals the
+// tasks out in contiguous blocks, a worker takes its own from the front and
+// steals the back half of another range once it runs dry, so uneven tasks
+// (emitters that see more of the scene) balance out without a shared queue.
+// Only the bounds of the ranges are stored, never the task ids
+class WorkStealingPool {
+public:
+  // 0 = hardware concurrency
+  explicit WorkStealingPool(uint32_t nThreads = 0);
+  ~WorkStealingPool();
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  uint32_t size() const { return static_cast<uint32_t>(workers.size()); };
+  // calls fn(task, worker) for every task in [0, nTasks) and blocks until
+  // all of them returned. worker < size() identifies the calling thread
+  void run(uint64_t nTasks,
+           const std::function<void(uint64_t task, uint32_t worker)> &fn);
+  // ranges taken from another worker during the last run
+  uint64_t getSteals() const { return steals; };
+
+private:
+  // the tasks [first, last) a worker has left
+  struct Queue {
+    std::mutex mutex;
+    uint64_t first = 0;
+    uint64_t last = 0;
+  };
+  void work(uint32_t worker);
+  bool pop(uint32_t worker, uint64_t &task);
+  bool steal(uint32_t worker, uint64_t &task);
+
+  std::vector<std::thread> workers;
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(uint64_t, uint32_t)> *job = nullptr;
+  uint64_t generation = 0;
+  uint32_t busy = 0;
+  bool stop = false;
+  std::atomic<uint64_t> steals{0};
+};
+} // namespace rn
@@ -1,7 +1,17 @@
 #include "geometry.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <glm/fwd.hpp>
+#include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include "vma.hpp"
 
@@ -33,19 +43,391 @@ template <> struct hash<glm::vec3> {
 
 namespace rn {
 
-GeometryHandler::GeometryHandler(std::shared_ptr<VMA> vma_) : vma(vma_) {
-  loadObj("geom/icoandcube.obj");
-  vertex = vma->uploadVertices(vertices, vertexAlloc);
-  index = vma->uploadIndices(indices, indexAlloc);
+GeometryHandler::GeometryHandler(std::shared_ptr<VMA> vma_,
+                                 const std::string &objPath)
+    : vma(vma_) {
+  loadObj(objPath);
+  buildFrames(0, static_cast<uint32_t>(indices.size() / 3));
+  buildAliasTable(false);
+  meshOffsets.assign(1, 0);
+  for (const auto &mesh : triangleToMeshIdx) {
+    meshOffsets.push_back(mesh.data.y);
+  }
+  findInstances();
   triangleNames->resize(indices.size()/3);
   for (size_t i = 0; i < triangleNames->size(); ++i) {
     triangleNames->at(i) = "Tri " + std::to_string(i);
   }
+  if (!vma) {
+    return;
+  }
+  vertex = vma->uploadVertices(vertices, vertexAlloc);
+  index = vma->uploadIndices(indices, indexAlloc);
+  frame = vma->uploadStorage(frames.data(), frames.size() * sizeof(TriFrame),
+                             frameAlloc);
+  emissivityBuffer = vma->uploadStorage(
+      emissivity.data(), emissivity.size() * sizeof(float), emissivityAlloc);
+  meshOffsetBuffer = vma->uploadStorage(meshOffsets.data(),
+                                        meshOffsets.size() * sizeof(uint32_t),
+                                        meshOffsetAlloc);
+  uniqueVertex = vma->uploadVertices(uniqueVertices, uniqueVertexAlloc);
+  uniqueIndex = vma->uploadIndices(uniqueIndices, uniqueIndexAlloc);
 }
 
 GeometryHandler::~GeometryHandler() {
+    if (!vma) {
+      return;
+    }
     vma->destroyBuffer(vertexAlloc, vertex);
     vma->destroyBuffer(indexAlloc, index);
+    vma->destroyBuffer(frameAlloc, frame);
+    vma->destroyBuffer(aliasAlloc, alias);
+    vma->destroyBuffer(emissivityAlloc, emissivityBuffer);
+    vma->destroyBuffer(meshOffsetAlloc, meshOffsetBuffer);
+    vma->destroyBuffer(uniqueVertexAlloc, uniqueVertex);
+    vma->destroyBuffer(uniqueIndexAlloc, uniqueIndex);
+    if (staging) {
+      vma->destroyBuffer(stagingAlloc, staging);
+    }
+}
+
+void GeometryHandler::buildAliasTable(bool useTemperature) {
+  fillAliasTable(useTemperature);
+  if (!vma) {
+    return;
+  }
+  if (alias) {
+    // same size as long as the geometry is
+    vma->uploadBuffer(alias, aliasTable.data(),
+                      aliasTable.size() * sizeof(AliasEntry));
+    return;
+  }
+  alias = vma->uploadStorage(aliasTable.data(),
+                             aliasTable.size() * sizeof(AliasEntry), aliasAlloc);
+}
+
+void GeometryHandler::fillAliasTable(bool useTemperature) {
+  size_t n = frames.size();
+  // without any temperature in the mtl file every weight would be 0
+  bool weighted = useTemperature &&
+                  std::any_of(temperature.begin(), temperature.end(),
+                              [](float t) { return t > 0.f; });
+  if (useTemperature && !weighted) {
+    std::cerr << "geometry: no \"temperature\" in the materials, T^4 "
+                 "weighting is ignored"
+              << std::endl;
+  }
+  std::vector<double> weights(n);
+  double sum = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    double w = frames[i].normal.w * emissivity[i];
+    if (weighted) {
+      double t2 = static_cast<double>(temperature[i]) * temperature[i];
+      w *= t2 * t2;
+    }
+    weights[i] = w;
+    sum += w;
+  }
+
+  // Vose's method, every slot starts out as its own alias
+  aliasTable.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    aliasTable[i] = {1.f, static_cast<uint32_t>(i)};
+  }
+  if (sum > 0.0) {
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+      weights[i] *= n / sum;
+      (weights[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+    while (!small.empty() && !large.empty()) {
+      uint32_t s = small.back();
+      small.pop_back();
+      uint32_t l = large.back();
+      aliasTable[s] = {static_cast<float>(weights[s]), l};
+      weights[l] -= 1.0 - weights[s];
+      if (weights[l] < 1.0) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+    // leftovers are 1 up to rounding and keep themselves
+  }
+
+  aliasTemperature = useTemperature;
+}
+
+void GeometryHandler::buildFrames(uint32_t firstTri, uint32_t nTris) {
+  frames.resize(indices.size() / 3);
+  for (size_t i = firstTri; i < firstTri + nTris; ++i) {
+    glm::vec3 a = vertices[indices[3 * i + 0]];
+    glm::vec3 b = vertices[indices[3 * i + 1]];
+    glm::vec3 c = vertices[indices[3 * i + 2]];
+    glm::vec3 e1 = b - a;
+    glm::vec3 e2 = c - a;
+    glm::vec3 n = glm::cross(e1, e2);
+    float area = 0.5f * glm::length(n);
+    // degenerate triangles keep a zero frame and never emit anything useful
+    n = area > 0.f ? glm::normalize(n) : glm::vec3(0.f);
+    glm::vec3 t = area > 0.f ? glm::normalize(e1) : glm::vec3(0.f);
+
+    TriFrame &f = frames[i];
+    f.origin = glm::vec4(a, 1.f);
+    f.e1 = glm::vec4(e1, 0.f);
+    f.e2 = glm::vec4(e2, 0.f);
+    f.normal = glm::vec4(n, area);
+    f.tangent = glm::vec4(t, 0.f);
+    f.bitangent = glm::vec4(glm::cross(n, t), 0.f);
+  }
+}
+
+void GeometryHandler::findInstances() {
+  uniqueMeshes.clear();
+  uniqueVertices.clear();
+  uniqueIndices.clear();
+  meshInstances.clear();
+
+  // meshes are only compared to unique meshes with the same local indices
+  std::unordered_map<size_t, std::vector<uint32_t>> candidates;
+  for (uint32_t m = 0; m + 1 < meshOffsets.size(); ++m) {
+    uint32_t firstTri = meshOffsets[m];
+    uint32_t nTris = meshOffsets[m + 1] - firstTri;
+
+    // local vertices in the order they are first used
+    std::unordered_map<uint32_t, uint32_t> local;
+    std::vector<glm::dvec3> verts;
+    std::vector<uint32_t> idx;
+    idx.reserve(3 * nTris);
+    for (uint32_t i = 3 * firstTri; i < 3 * (firstTri + nTris); ++i) {
+      auto it = local.find(indices[i]);
+      if (it == local.end()) {
+        it = local.emplace(indices[i], static_cast<uint32_t>(verts.size()))
+                 .first;
+        verts.push_back(glm::dvec3(vertices[indices[i]]));
+      }
+      idx.push_back(it->second);
+    }
+    size_t key = 0;
+    hashCombine(key, verts.size());
+    for (uint32_t i : idx) {
+      hashCombine(key, i);
+    }
+
+    // the first triangle with an area spans the frame the transform is
+    // solved for, rigid copies map it exactly
+    auto frameOf = [&](const std::vector<glm::dvec3> &v) {
+      for (uint32_t t = 0; t < nTris; ++t) {
+        glm::dvec3 a = v[idx[3 * t]];
+        glm::dvec3 e1 = v[idx[3 * t + 1]] - a;
+        glm::dvec3 e2 = v[idx[3 * t + 2]] - a;
+        glm::dvec3 n = glm::cross(e1, e2);
+        if (glm::length(n) > 0.0) {
+          return std::make_pair(a, glm::dmat3(e1, e2, glm::normalize(n)));
+        }
+      }
+      return std::make_pair(glm::dvec3(0.0), glm::dmat3(0.0));
+    };
+    auto target = frameOf(verts);
+
+    MeshInstance instance{0, firstTri, {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0}};
+    bool found = false;
+    for (uint32_t u : candidates[key]) {
+      const UniqueMesh &mesh = uniqueMeshes[u];
+      if (mesh.nVertices != verts.size() || mesh.nTris != nTris ||
+          !std::equal(idx.begin(), idx.end(),
+                      uniqueIndices.begin() + mesh.firstIndex)) {
+        continue;
+      }
+      std::vector<glm::dvec3> src(uniqueVertices.begin() + mesh.firstVertex,
+                                  uniqueVertices.begin() + mesh.firstVertex +
+                                      mesh.nVertices);
+      auto source = frameOf(src);
+      if (glm::determinant(source.second) == 0.0 ||
+          glm::determinant(target.second) == 0.0) {
+        continue;
+      }
+      glm::dmat3 l = target.second * glm::inverse(source.second);
+      glm::dvec3 t = target.first - l * source.first;
+      // every vertex has to land on its copy, relative to the mesh size
+      glm::dvec3 lo = verts.front(), hi = verts.front();
+      for (const auto &v : verts) {
+        lo = glm::min(lo, v);
+        hi = glm::max(hi, v);
+      }
+      double tolerance = 1e-5 * std::max(glm::length(hi - lo), 1e-6);
+      bool match = true;
+      for (uint32_t v = 0; v < verts.size() && match; ++v) {
+        match = glm::length(l * src[v] + t - verts[v]) <= tolerance;
+      }
+      if (!match) {
+        continue;
+      }
+      // glm is column major, the instance transform row major
+      for (uint32_t r = 0; r < 3; ++r) {
+        for (uint32_t c = 0; c < 3; ++c) {
+          instance.transform[4 * r + c] = static_cast<float>(l[c][r]);
+        }
+        instance.transform[4 * r + 3] = static_cast<float>(t[r]);
+      }
+      instance.uniqueMesh = u;
+      found = true;
+      break;
+    }
+
+    if (!found) {
+      instance.uniqueMesh = static_cast<uint32_t>(uniqueMeshes.size());
+      candidates[key].push_back(instance.uniqueMesh);
+      uniqueMeshes.push_back({static_cast<uint32_t>(uniqueVertices.size()),
+                              static_cast<uint32_t>(verts.size()),
+                              static_cast<uint32_t>(uniqueIndices.size()),
+                              nTris});
+      for (const auto &v : verts) {
+        uniqueVertices.push_back(glm::vec3(v));
+      }
+      uniqueIndices.insert(uniqueIndices.end(), idx.begin(), idx.end());
+    }
+    meshInstances.push_back(instance);
+  }
+  restTransforms.clear();
+  for (const auto &instance : meshInstances) {
+    restTransforms.push_back(instance.transform);
+  }
+}
+
+// applies the row major 3 x 4 transform t to v
+static glm::vec3 transformPoint(const std::array<float, 12> &t, glm::vec3 v) {
+  return {t[0] * v.x + t[1] * v.y + t[2] * v.z + t[3],
+          t[4] * v.x + t[5] * v.y + t[6] * v.z + t[7],
+          t[8] * v.x + t[9] * v.y + t[10] * v.z + t[11]};
+}
+
+void GeometryHandler::setMeshTransform(uint32_t mesh,
+                                       const std::array<float, 12> &transform) {
+  // transform after the rest transform
+  const auto &rest = restTransforms[mesh];
+  auto &t = meshInstances[mesh].transform;
+  for (uint32_t r = 0; r < 3; ++r) {
+    for (uint32_t c = 0; c < 4; ++c) {
+      t[4 * r + c] = transform[4 * r + 0] * rest[c] +
+                     transform[4 * r + 1] * rest[4 + c] +
+                     transform[4 * r + 2] * rest[8 + c];
+    }
+    t[4 * r + 3] += transform[4 * r + 3];
+  }
+  placeMesh(mesh);
+}
+
+void GeometryHandler::setMeshVertices(uint32_t mesh,
+                                      const std::vector<glm::vec3> &verts) {
+  uint32_t u = meshInstances[mesh].uniqueMesh;
+  for (uint32_t m = 0; m < meshInstances.size(); ++m) {
+    if (m != mesh && meshInstances[m].uniqueMesh == u) {
+      throw std::runtime_error("mesh " + meshNames[mesh] +
+                               " has copies, move it with setMeshTransform");
+    }
+  }
+  const UniqueMesh &unique = uniqueMeshes[u];
+  if (verts.size() != unique.nVertices) {
+    throw std::runtime_error("mesh " + meshNames[mesh] + " has " +
+                             std::to_string(unique.nVertices) + " vertices");
+  }
+  // a mesh without copies defines its unique mesh, its rest transform is
+  // the identity
+  std::copy(verts.begin(), verts.end(),
+            uniqueVertices.begin() + unique.firstVertex);
+  if (std::find(deformed.begin(), deformed.end(), u) == deformed.end()) {
+    deformed.push_back(u);
+  }
+  placeMesh(mesh);
+}
+
+glm::vec3 GeometryHandler::restCenter(uint32_t mesh) const {
+  const UniqueMesh &unique = uniqueMeshes[meshInstances[mesh].uniqueMesh];
+  glm::vec3 lo(std::numeric_limits<float>::max());
+  glm::vec3 hi(std::numeric_limits<float>::lowest());
+  for (uint32_t v = 0; v < unique.nVertices; ++v) {
+    glm::vec3 p = transformPoint(restTransforms[mesh],
+                                 uniqueVertices[unique.firstVertex + v]);
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  return 0.5f * (lo + hi);
+}
+
+void GeometryHandler::placeMesh(uint32_t mesh) {
+  const MeshInstance &instance = meshInstances[mesh];
+  const UniqueMesh &unique = uniqueMeshes[instance.uniqueMesh];
+  for (uint32_t v = 0; v < unique.nVertices; ++v) {
+    vertices[meshVertexOffsets[mesh] + v] = transformPoint(
+        instance.transform, uniqueVertices[unique.firstVertex + v]);
+  }
+  // only scaled or deformed meshes change the share of the emitted power
+  if (restAreas.size() < unique.nTris) {
+    restAreas.resize(unique.nTris);
+  }
+  for (uint32_t t = 0; t < unique.nTris && !resized; ++t) {
+    restAreas[t] = frames[instance.firstTri + t].normal.w;
+  }
+  buildFrames(instance.firstTri, unique.nTris);
+  for (uint32_t t = 0; t < unique.nTris && !resized; ++t) {
+    resized = std::abs(frames[instance.firstTri + t].normal.w - restAreas[t]) >
+              1e-5f * restAreas[t];
+  }
+  moved = true;
+}
+
+std::vector<uint32_t> GeometryHandler::updateBuffers() {
+  if (moved && resized) {
+    fillAliasTable(aliasTemperature);
+  }
+  if (vma && (moved || !deformed.empty())) {
+    uploadChanges();
+  }
+  moved = false;
+  resized = false;
+  std::vector<uint32_t> changed;
+  changed.swap(deformed);
+  return changed;
+}
+
+void GeometryHandler::uploadChanges() {
+  // one staging buffer for every refit, laid out as the vertices, frames,
+  // unique vertices and the alias table
+  vk::DeviceSize vertexBytes = vertices.size() * sizeof(glm::vec4);
+  vk::DeviceSize frameBytes = frames.size() * sizeof(TriFrame);
+  vk::DeviceSize uniqueBytes = uniqueVertices.size() * sizeof(glm::vec4);
+  vk::DeviceSize aliasBytes = aliasTable.size() * sizeof(AliasEntry);
+  if (!staging) {
+    staging = vma->stagingBuffer(
+        vertexBytes + frameBytes + uniqueBytes + aliasBytes, stagingAlloc,
+        stagingInfo);
+  }
+  char *pStaging = static_cast<char *>(stagingInfo.pMappedData);
+  std::vector<std::pair<vk::Buffer, vk::BufferCopy>> copies;
+  if (moved) {
+    glm::vec4 *pVerts = reinterpret_cast<glm::vec4 *>(pStaging);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      pVerts[i] = glm::vec4(vertices[i], 1.f);
+    }
+    memcpy(pStaging + vertexBytes, frames.data(), frameBytes);
+    copies.push_back({vertex, vk::BufferCopy{0, 0, vertexBytes}});
+    copies.push_back({frame, vk::BufferCopy{vertexBytes, 0, frameBytes}});
+  }
+  if (!deformed.empty()) {
+    vk::DeviceSize offset = vertexBytes + frameBytes;
+    glm::vec4 *pVerts = reinterpret_cast<glm::vec4 *>(pStaging + offset);
+    for (size_t i = 0; i < uniqueVertices.size(); ++i) {
+      pVerts[i] = glm::vec4(uniqueVertices[i], 1.f);
+    }
+    copies.push_back({uniqueVertex, vk::BufferCopy{offset, 0, uniqueBytes}});
+  }
+  if (moved && resized) {
+    vk::DeviceSize offset = vertexBytes + frameBytes + uniqueBytes;
+    memcpy(pStaging + offset, aliasTable.data(), aliasBytes);
+    copies.push_back({alias, vk::BufferCopy{offset, 0, aliasBytes}});
+  }
+  vmaFlushAllocation(vma->vma(), stagingAlloc, 0, VK_WHOLE_SIZE);
+  vma->copyRegions(staging, copies);
 }
 
 std::vector<vk::VertexInputAttributeDescription> GeometryHandler::getAttributeDescription() {
@@ -72,11 +454,48 @@ void GeometryHandler::loadObj(const std::string &filePath) {
 
   vertices.clear();
   indices.clear();
+  triangleToMeshIdx.clear();
+  meshNames.clear();
+  meshVertexOffsets.assign(1, 0);
 
-  std::unordered_map<glm::vec3, uint32_t> uniqueVertices{};
+  // vertices are only merged within a shape
+  std::unordered_map<glm::vec3, uint32_t> shapeVertices{};
   unsigned int nTrianglesWithCurrentMesh = 0;
 
+  emissivity.clear();
+  temperature.clear();
+  // malformed values are reported once per material and parameter
+  std::map<std::pair<int, std::string>, float> parsed;
+  auto materialParam = [&](int id, const char *name, float fallback) {
+    if (id < 0 || static_cast<size_t>(id) >= materials.size()) {
+      return fallback;
+    }
+    auto it = materials[id].unknown_parameter.find(name);
+    if (it == materials[id].unknown_parameter.end()) {
+      return fallback;
+    }
+    auto [cached, inserted] = parsed.try_emplace({id, name}, fallback);
+    if (inserted) {
+      const char *begin = it->second.c_str();
+      char *end = nullptr;
+      float value = std::strtof(begin, &end);
+      if (end == begin || !std::isfinite(value)) {
+        std::cerr << "geometry: material " << materials[id].name << ": "
+                  << name << " \"" << it->second << "\" is not a number, "
+                  << fallback << " is used" << std::endl;
+      } else {
+        cached->second = value;
+      }
+    }
+    return cached->second;
+  };
+
   for (const auto &shape : shapes) {
+    shapeVertices.clear();
+    for (int id : shape.mesh.material_ids) {
+      emissivity.push_back(materialParam(id, "emissivity", 1.f));
+      temperature.push_back(materialParam(id, "temperature", 0.f));
+    }
     for (const auto &index : shape.mesh.indices) {
       glm::vec3 vertex{};
 
@@ -86,13 +505,16 @@ void GeometryHandler::loadObj(const std::string &filePath) {
         vertex.z = attrib.vertices[3 * index.vertex_index + 2];
         };
 
-      if (uniqueVertices.count(vertex) == 0) {
-        uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+      if (shapeVertices.count(vertex) == 0) {
+        shapeVertices[vertex] = static_cast<uint32_t>(vertices.size());
         vertices.push_back(vertex);
       }
-      indices.push_back(uniqueVertices[vertex]);
+      indices.push_back(shapeVertices[vertex]);
     }
 
+    meshNames.push_back(shape.name);
+    meshVertexOffsets.push_back(static_cast<uint32_t>(vertices.size()));
+
     // store number of triangles per mesh
     MeshIdx idx;
     idx.data.x = shape.mesh.num_face_vertices.size();
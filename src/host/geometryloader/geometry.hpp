@@ -1,6 +1,7 @@
 #pragma once
 
 
+#include <array>
 #include <memory>
 #include <string>
 #include <vector>
@@ -16,7 +17,9 @@ class VMA;
 
 class GeometryHandler {
 public:
-  GeometryHandler(std::shared_ptr<VMA> vma_);
+  // without vma the geometry stays on the host, for the cpu tracer
+  GeometryHandler(std::shared_ptr<VMA> vma_,
+                  const std::string &objPath = "geom/icoandcube.obj");
   ~GeometryHandler();
   vk::CommandBuffer bindVertexBuffer(vk::CommandBuffer commandBuffer);
   static std::vector<vk::VertexInputBindingDescription> getInputDescription();
@@ -24,6 +27,12 @@ public:
   getAttributeDescription();
   vk::Buffer getVert() { return vertex; };
   vk::Buffer getIdx() { return index; };
+  vk::Buffer getFrames() { return frame; };
+  vk::Buffer getAlias() { return alias; };
+  vk::Buffer getEmissivity() { return emissivityBuffer; };
+  vk::Buffer getMeshOffsets() { return meshOffsetBuffer; };
+  vk::Buffer getUniqueVert() { return uniqueVertex; };
+  vk::Buffer getUniqueIdx() { return uniqueIndex; };
   void loadObj(const std::string &fName);
 
   std::vector<glm::vec3> vertices{};
@@ -43,6 +52,78 @@ struct VertexPC
   };
 
   std::vector<MeshIdx> triangleToMeshIdx{};
+  // first triangle of every mesh followed by nTris, from triangleToMeshIdx
+  std::vector<uint32_t> meshOffsets{};
+  // first vertex of every mesh followed by nVertices. meshes do not share
+  // vertices, so every one of them can be moved on its own
+  std::vector<uint32_t> meshVertexOffsets{};
+  std::vector<std::string> meshNames{};
+
+  // meshes that are copies of each other up to an affine transform share
+  // one unique mesh, its geometry is that of the first copy in the file.
+  // indices are local to the mesh, firstVertex is added on top
+  struct UniqueMesh {
+    uint32_t firstVertex;
+    uint32_t nVertices;
+    uint32_t firstIndex;
+    uint32_t nTris;
+  };
+  std::vector<UniqueMesh> uniqueMeshes{};
+  std::vector<glm::vec3> uniqueVertices{};
+  std::vector<uint32_t> uniqueIndices{};
+  // every mesh of the file places a unique mesh, its triangles are the
+  // global triangles firstTri to firstTri + nTris
+  struct MeshInstance {
+    uint32_t uniqueMesh;
+    uint32_t firstTri;
+    // unique mesh to world, row major 3 x 4 like VkTransformMatrixKHR
+    std::array<float, 12> transform;
+  };
+  std::vector<MeshInstance> meshInstances{};
+
+  // moves mesh by transform, row major 3 x 4, relative to its pose in the
+  // file. the changes go to the device with updateBuffers
+  void setMeshTransform(uint32_t mesh, const std::array<float, 12> &transform);
+  // new positions of the vertices of mesh in its pose in the file, local
+  // vertex i is vertex meshVertexOffsets[mesh] + i. throws if other meshes
+  // are copies of it, they would be deformed as well
+  void setMeshVertices(uint32_t mesh, const std::vector<glm::vec3> &verts);
+  // centre of the bounding box of mesh in its pose in the file
+  glm::vec3 restCenter(uint32_t mesh) const;
+  // uploads the vertices, frames and alias table of the meshes that moved
+  // since the last call in place, returns the unique meshes that were
+  // deformed. the alias table is only rebuilt if a triangle area changed,
+  // the uploads share one staging buffer that is kept between calls
+  std::vector<uint32_t> updateBuffers();
+
+  // everything the ray generation needs to emit from a triangle, mirrored
+  // by triFrame in src/shaders/consts.glsl
+  struct TriFrame {
+    glm::vec4 origin;    // first vertex
+    glm::vec4 e1;        // second - first vertex
+    glm::vec4 e2;        // third - first vertex
+    glm::vec4 normal;    // .w = area
+    glm::vec4 tangent;   // normalized e1
+    glm::vec4 bitangent; // normal x tangent
+  };
+  std::vector<TriFrame> frames{};
+
+  // per triangle, read from the "emissivity" and "temperature" parameters
+  // of the mtl file, 1 and 0 if there are none or they are no numbers
+  std::vector<float> emissivity{};
+  std::vector<float> temperature{};
+
+  // Walker alias table over the emitted power of the triangles, mirrored
+  // by aliasEntry in src/shaders/consts.glsl
+  struct AliasEntry {
+    float prob;
+    uint32_t alias;
+  };
+  std::vector<AliasEntry> aliasTable{};
+  // weights are area * emissivity, times T^4 with useTemperature. Without
+  // any temperature in the materials T^4 is ignored with a warning
+  void buildAliasTable(bool useTemperature);
+  bool aliasUsesTemperature() const { return aliasTemperature; };
 
 static constexpr VertexPC coloredCubeData[] = {
     // red face
@@ -92,7 +173,37 @@ static constexpr VertexPC coloredCubeData[] = {
 private:
   vk::Buffer vertex;
   vk::Buffer index;
+  vk::Buffer frame;
+  vk::Buffer alias;
+  vk::Buffer emissivityBuffer;
+  vk::Buffer meshOffsetBuffer;
   VmaAllocation vertexAlloc;
   VmaAllocation indexAlloc;
+  VmaAllocation frameAlloc;
+  VmaAllocation aliasAlloc;
+  VmaAllocation emissivityAlloc;
+  VmaAllocation meshOffsetAlloc;
+  vk::Buffer uniqueVertex;
+  vk::Buffer uniqueIndex;
+  VmaAllocation uniqueVertexAlloc;
+  VmaAllocation uniqueIndexAlloc;
+  bool aliasTemperature = false;
+  // transforms of meshInstances as found in the file
+  std::vector<std::array<float, 12>> restTransforms{};
+  bool moved = false;
+  // a moved mesh changed its triangle areas
+  bool resized = false;
+  std::vector<uint32_t> deformed{};
+  // areas of the mesh being placed, kept between calls
+  std::vector<float> restAreas{};
+  vk::Buffer staging;
+  VmaAllocation stagingAlloc;
+  VmaAllocationInfo stagingInfo;
+  void fillAliasTable(bool useTemperature);
+  void uploadChanges();
+  void buildFrames(uint32_t firstTri, uint32_t nTris);
+  void findInstances();
+  // recomputes the vertices and frames of mesh from its unique mesh
+  void placeMesh(uint32_t mesh);
 };
 }
\ No newline at end of file
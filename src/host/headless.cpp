@@ -0,0 +1,197 @@
+#include "headless.hpp"
+#include "backend/cpubackend.hpp"
+#include "bvh/bvh8.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace rn {
+
+bool Headless::requested(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--headless") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Headless::Options Headless::parse(int argc, char *argv[]) {
+  Options options;
+  auto value = [&](int &i) -> std::string {
+    if (i + 1 >= argc) {
+      throw UsageError(std::string(argv[i]) + " needs a value");
+    }
+    return argv[++i];
+  };
+  // whole decimal numbers up to max, std::stoull alone takes "-1" and "5x"
+  auto number = [&](int &i, uint64_t max) -> uint64_t {
+    std::string arg = argv[i];
+    std::string text = value(i);
+    size_t end = 0;
+    uint64_t n = 0;
+    try {
+      n = std::stoull(text, &end);
+    } catch (const std::logic_error &) {
+      end = 0;
+    }
+    if (end == 0 || end != text.size() || text[0] == '-' || n > max) {
+      throw UsageError(arg + " needs a number up to " + std::to_string(max) +
+                       ", got " + text);
+    }
+    return n;
+  };
+  constexpr uint64_t MAX_U32 = std::numeric_limits<uint32_t>::max();
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--headless") {
+      options.model = value(i);
+    } else if (arg == "--rays") {
+      options.nRays = number(i, std::numeric_limits<uint64_t>::max());
+    } else if (arg == "--out") {
+      options.out = value(i);
+    } else if (arg == "--seed") {
+      options.seed = static_cast<uint32_t>(number(i, MAX_U32));
+    } else if (arg == "--global") {
+      options.global = true;
+    } else if (arg == "--sobol") {
+      options.sobol = true;
+    } else if (arg == "--backend") {
+      try {
+        options.backend.kind = TraceBackend::parseKind(value(i));
+      } catch (const std::invalid_argument &err) {
+        throw UsageError(err.what());
+      }
+    } else if (arg == "--threads") {
+      options.backend.nThreads = static_cast<uint32_t>(number(i, MAX_U32));
+    } else if (arg == "--correct") {
+      options.correct = true;
+    } else if (arg == "--closed") {
+      options.correct = true;
+      options.closed = true;
+    } else if (arg == "--mesh") {
+      options.mesh = true;
+    } else if (arg == "--scaling") {
+      options.scaling = true;
+    } else if (arg == "--check-bvh") {
+      options.checkBvh = true;
+    } else {
+      throw UsageError("unknown argument " + arg);
+    }
+  }
+  if (options.model.empty() || options.nRays == 0) {
+    throw UsageError("--headless needs a model and --rays > 0");
+  }
+  if (options.scaling) {
+    if (options.backend.kind != TraceBackend::Kind::eAuto &&
+        options.backend.kind != TraceBackend::Kind::eCpu) {
+      throw UsageError("--scaling measures the cpu backend only");
+    }
+    options.backend.kind = TraceBackend::Kind::eCpu;
+  }
+  return options;
+}
+
+void Headless::usage(std::ostream &out) {
+  out << "usage: app --headless model.obj [options]\n"
+         "  --rays N      rays per triangle, in total with --global (10000)\n"
+         "  --out file    output, uint32 rows, uint32 cols and a row major\n"
+         "                float32 matrix (vf.bin)\n"
+         "  --seed S      key of the random streams (0)\n"
+         "  --global      spread the rays over all triangles by power\n"
+         "  --sobol       owen scrambled sobol points\n"
+         "  --backend B   auto, rt (ray tracing pipeline), rq (ray query) or\n"
+         "                cpu, auto takes the fastest one available (auto)\n"
+         "  --threads N   cpu threads, 0 = all (0)\n"
+         "  --correct     reciprocity correction, --closed for enclosures\n"
+         "  --mesh        mesh x mesh instead of triangle view factors\n"
+         "  --scaling     cpu rays/s with 1, 2, 4 .. --threads threads,\n"
+         "                printed instead of writing view factors\n"
+         "  --check-bvh   --rays rays through every cpu kernel and the\n"
+         "                binary bvh, prints how many hit elsewhere\n";
+}
+
+void Headless::run() {
+  if (options.checkBvh) {
+    checkBvh();
+    return;
+  }
+  if (options.scaling) {
+    // parse forces the cpu backend
+    CpuTracer &tracer = static_cast<CpuBackend &>(*backend).getTracer();
+    tracer.setSobol(options.sobol);
+    std::cout << backend->getTriCount() << " triangles, " << options.nRays
+              << " rays per triangle\n";
+    CpuTracer::printScaling(
+        std::cout, tracer.measureScaling(options.nRays, options.seed,
+                                         options.backend.nThreads));
+    return;
+  }
+  TraceBackend::Launch launch;
+  launch.nRays = options.nRays;
+  launch.seed = options.seed;
+  launch.global = options.global;
+  launch.sobol = options.sobol;
+  launch.correct = options.correct;
+  launch.closed = options.closed;
+
+  uint32_t nTris = backend->getTriCount();
+  auto start = std::chrono::steady_clock::now();
+  backend->traceAll(launch);
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+  if (options.mesh) {
+    write(backend->getMeshViewFactors(), backend->getMeshCount());
+  } else {
+    write(backend->getViewFactors(), nTris);
+  }
+  uint64_t rays = options.global ? options.nRays : options.nRays * nTris;
+  std::cout << nTris << " triangles, " << rays << " rays (" << backend->name()
+            << ") in " << ms << " ms, written to " << options.out << "\n";
+}
+
+void Headless::checkBvh() {
+  GeometryHandler &geom = backend->getGeometry();
+  Bvh::BuildOptions buildOptions;
+  buildOptions.nThreads = options.backend.nThreads;
+  buildOptions.maxLeafSize = Bvh8::WIDTH;
+  Bvh binary(geom.vertices, geom.indices, buildOptions);
+  Bvh8 wide(binary);
+  uint32_t nRays = static_cast<uint32_t>(std::min<uint64_t>(
+      options.nRays, std::numeric_limits<uint32_t>::max()));
+  for (Bvh8::Kernel kernel : {Bvh8::Kernel::eScalar, Bvh8::Kernel::eAvx2,
+                              Bvh8::Kernel::eAvx512}) {
+    if (!Bvh8::supported(kernel)) {
+      std::cout << Bvh8::name(kernel) << ": not supported\n";
+      continue;
+    }
+    wide.setKernel(kernel);
+    std::cout << Bvh8::name(kernel) << ": "
+              << wide.mismatches(binary, nRays, options.seed) << " of "
+              << nRays << " rays differ from the binary bvh\n";
+  }
+}
+
+void Headless::write(const std::vector<float> &vf, uint32_t n) {
+  if (vf.size() != static_cast<size_t>(n) * n) {
+    throw std::runtime_error("no view factors to write");
+  }
+  std::ofstream file{options.out, std::ios::binary | std::ios::trunc};
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + options.out);
+  }
+  file.write(reinterpret_cast<const char *>(&n), sizeof(n));
+  file.write(reinterpret_cast<const char *>(&n), sizeof(n));
+  file.write(reinterpret_cast<const char *>(vf.data()),
+             vf.size() * sizeof(float));
+  if (!file) {
+    throw std::runtime_error("failed to write " + options.out);
+  }
+}
+} // namespace rn
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "backend/tracebackend.hpp"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rn {
+// batch runs without Renderer, window or GLFW: the geometry of one obj file
+// and a single traceAll on a TraceBackend, whose view factors are written to
+// a file. Meant for servers without a display, or without a device at all
+class Headless {
+public:
+  struct Options {
+    std::string model;
+    std::string out = "vf.bin";
+    // per triangle, or in total with global
+    uint64_t nRays = 10000;
+    uint32_t seed = 0;
+    bool global = false;
+    bool sobol = false;
+    TraceBackend::Options backend;
+    bool correct = false;
+    bool closed = false;
+    // area weighted mesh x mesh view factors instead of the triangles
+    bool mesh = false;
+    // CpuTracer::measureScaling with 1, 2, 4 .. threads instead of a run,
+    // printed as a table, nothing is written
+    bool scaling = false;
+    // Bvh8::mismatches of every kernel against the binary tree, --rays of
+    // them, printed instead of a run
+    bool checkBvh = false;
+  };
+
+  // a command line parse can not make sense of, main prints the usage for
+  // these and nothing else
+  class UsageError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+  // true if the command line asks for a batch run
+  static bool requested(int argc, char *argv[]);
+  // app --headless model.obj [--rays N] [--out file] ..., throws UsageError
+  // on unknown, incomplete or malformed arguments
+  static Options parse(int argc, char *argv[]);
+  static void usage(std::ostream &out);
+
+  explicit Headless(const Options &options_)
+      : options(options_),
+        backend(TraceBackend::create(options.model, options.backend)) {};
+  void run();
+
+private:
+  // rows x cols float32 matrix, row major, after two uint32 rows and cols
+  void write(const std::vector<float> &vf, uint32_t n);
+  void checkBvh();
+
+  Options options;
+  std::unique_ptr<TraceBackend> backend;
+};
+} // namespace rn
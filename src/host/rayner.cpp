@@ -1,10 +1,13 @@
 #include "rayner.hpp"
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <glm/gtc/matrix_transform.hpp>
 
 namespace rn {
 
 void Rayner::run() {
-  
+  renderer.getGui()->state->blasBytes = raytracer.getBlasSize();
 
   auto currentTime = std::chrono::high_resolution_clock::now();
   while (renderer.run()) {
@@ -14,14 +17,68 @@ void Rayner::run() {
                                                                    currentTime)
             .count();
     currentTime = newTime;
-    if (renderer.getGui()->state->pLaunch) {
-      raytracer.traceOri(renderer.getGui()->state);
-      renderer.getGui()->state->pLaunch = false;
-    };
-    if (renderer.getGui()->state->rLaunch) {
-      raytracer.traceRays(renderer.getGui()->state);
-      renderer.getGui()->state->rLaunch = false;
-    };
+    auto state = renderer.getGui()->state;
+    // the checkbox is only a choice if the device has both
+    state->rayQueryAvailable =
+        raytracer.hasRayQuery() && raytracer.hasRayTracingPipeline();
+    state->rayQuery |= !raytracer.hasRayTracingPipeline();
+    // launches run on the compute queue, new ones are held back until the
+    // one in flight has finished so the renderer keeps drawing meanwhile
+    bool idle = raytracer.poll();
+    if (idle && state->asRebuild) {
+      raytracer.rebuildAccelerationStructures(
+          geom, state->fastBuild ? Raytracer::BuildMode::eFastBuild
+                                 : Raytracer::BuildMode::eFastTrace);
+      state->blasBytes = raytracer.getBlasSize();
+      state->asRebuild = false;
+    } else if (idle && state->refit && geom.meshInstances.empty()) {
+      // nothing to articulate
+      state->refit = false;
+    } else if (idle && state->refit) {
+      uint32_t mesh = std::min<uint32_t>(
+          state->articulatedMesh, geom.meshInstances.size() - 1);
+      glm::vec3 center = geom.restCenter(mesh);
+      glm::vec3 axis(0.f);
+      axis[state->meshAxis] = 1.f;
+      glm::mat4 rotation =
+          glm::translate(glm::mat4(1.f), center) *
+          glm::rotate(glm::mat4(1.f), glm::radians(state->meshAngle), axis) *
+          glm::translate(glm::mat4(1.f), -center);
+      std::array<float, 12> transform;
+      for (uint32_t r = 0; r < 3; ++r) {
+        for (uint32_t c = 0; c < 4; ++c) {
+          transform[4 * r + c] = rotation[c][r];
+        }
+      }
+      geom.setMeshTransform(mesh, transform);
+      // the renderer draws from the vertex buffer that is updated
+      vlkn->getGqueue().waitIdle();
+      raytracer.refitAccelerationStructures(geom);
+      state->refit = false;
+    } else if (idle && state->pLaunch) {
+      raytracer.traceOri(state);
+      state->pLaunch = false;
+    } else if (idle && state->rLaunch) {
+      raytracer.traceRays(state);
+      state->rLaunch = false;
+    } else if (idle && state->bLaunch) {
+      if (state->global &&
+          state->weightTemperature != geom.aliasUsesTemperature()) {
+        geom.buildAliasTable(state->weightTemperature);
+        raytracer.setAliasTable(geom);
+      }
+      state->meshNames = geom.meshNames;
+      raytracer.traceAll(state);
+      state->bLaunch = false;
+    } else if (idle && state->progStart) {
+      state->meshNames = geom.meshNames;
+      raytracer.startProgressive(state);
+      state->progStart = false;
+    } else if (idle && state->progRunning) {
+      // one progressive batch in flight at a time
+      raytracer.stepProgressive(state);
+    }
+    state->tracing = raytracer.busy();
   
     renderer.updateCamera(frameTime);
     vlkn->getGqueue().waitIdle();
@@ -0,0 +1,128 @@
+#include "ascache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+namespace rn {
+namespace {
+// written in front of the blobs, a file is only used if all of it matches
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint8_t deviceUUID[VK_UUID_SIZE];
+  uint32_t driverVersion;
+  uint32_t nBlobs;
+};
+constexpr char MAGIC[4] = {'R', 'N', 'A', 'S'};
+constexpr uint32_t VERSION = 1;
+
+// FNV-1a
+void hashBytes(uint64_t &hash, const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+}
+} // namespace
+
+AsCache::AsCache(vk::PhysicalDevice physDevice, std::string dir_)
+    : dir(std::move(dir_)) {
+  vk::PhysicalDeviceIDProperties idProps{};
+  vk::PhysicalDeviceProperties2 props2{};
+  props2.pNext = &idProps;
+  physDevice.getProperties2(&props2);
+  std::copy(idProps.deviceUUID.begin(), idProps.deviceUUID.end(),
+            deviceUUID.begin());
+  driverVersion = props2.properties.driverVersion;
+}
+
+uint64_t AsCache::hashGeometry(const GeometryHandler &geom,
+                               vk::BuildAccelerationStructureFlagsKHR flags) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hashBytes(hash, geom.uniqueVertices.data(),
+            geom.uniqueVertices.size() * sizeof(glm::vec3));
+  hashBytes(hash, geom.uniqueIndices.data(),
+            geom.uniqueIndices.size() * sizeof(uint32_t));
+  hashBytes(hash, geom.uniqueMeshes.data(),
+            geom.uniqueMeshes.size() * sizeof(GeometryHandler::UniqueMesh));
+  auto rawFlags = static_cast<VkBuildAccelerationStructureFlagsKHR>(flags);
+  hashBytes(hash, &rawFlags, sizeof(rawFlags));
+  return hash;
+}
+
+std::string AsCache::path(uint64_t key) const {
+  std::ostringstream name;
+  name << dir << "/blas_" << std::hex << key << ".bin";
+  return name.str();
+}
+
+std::vector<std::vector<uint8_t>> AsCache::load(uint64_t key) const {
+  std::ifstream file{path(key), std::ios::binary};
+  if (!file.is_open()) {
+    return {};
+  }
+  CacheHeader header{};
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION || header.key != key ||
+      std::memcmp(header.deviceUUID, deviceUUID.data(), VK_UUID_SIZE) != 0 ||
+      header.driverVersion != driverVersion) {
+    return {};
+  }
+
+  std::vector<std::vector<uint8_t>> blobs(header.nBlobs);
+  for (auto &blob : blobs) {
+    uint64_t size = 0;
+    file.read(reinterpret_cast<char *>(&size), sizeof(size));
+    if (!file || size < BLOB_HEADER_SIZE) {
+      return {};
+    }
+    blob.resize(size);
+    file.read(reinterpret_cast<char *>(blob.data()), size);
+    if (!file) {
+      return {};
+    }
+  }
+  return blobs;
+}
+
+void AsCache::store(uint64_t key,
+                    const std::vector<std::vector<uint8_t>> &blobs) const {
+  std::error_code error;
+  std::filesystem::create_directories(dir, error);
+  // written next to the target and renamed, so a crash never leaves a
+  // truncated file behind
+  std::string target = path(key);
+  std::string tmp = target + ".tmp";
+  {
+    std::ofstream file{tmp, std::ios::binary | std::ios::trunc};
+    if (!file.is_open()) {
+      return;
+    }
+    CacheHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.key = key;
+    std::memcpy(header.deviceUUID, deviceUUID.data(), VK_UUID_SIZE);
+    header.driverVersion = driverVersion;
+    header.nBlobs = static_cast<uint32_t>(blobs.size());
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const auto &blob : blobs) {
+      uint64_t size = blob.size();
+      file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+      file.write(reinterpret_cast<const char *>(blob.data()), size);
+    }
+    if (!file) {
+      file.close();
+      std::filesystem::remove(tmp, error);
+      return;
+    }
+  }
+  std::filesystem::rename(tmp, target, error);
+}
+} // namespace rn
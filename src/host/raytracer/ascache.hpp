@@ -0,0 +1,41 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "geometryloader/geometry.hpp"
+
+namespace rn {
+// serialized bottom level acceleration structures on disk, one file per
+// geometry. A file is only read back on the device and driver version that
+// wrote it, anything else is treated as a miss and the structures are
+// rebuilt.
+class AsCache {
+public:
+  AsCache(vk::PhysicalDevice physDevice, std::string dir_ = "cache");
+
+  // hash of everything the blases are built from, flags included
+  static uint64_t hashGeometry(const GeometryHandler &geom,
+                               vk::BuildAccelerationStructureFlagsKHR flags);
+  // serialized blobs of the last store with this key, empty on a miss
+  std::vector<std::vector<uint8_t>> load(uint64_t key) const;
+  // a failed write only costs the next startup a rebuild
+  void store(uint64_t key,
+             const std::vector<std::vector<uint8_t>> &blobs) const;
+
+  // the blob header of VK_KHR_acceleration_structure, driver and
+  // compatibility uuid are followed by the serialized and the deserialized
+  // size
+  static constexpr size_t DESERIALIZED_SIZE_OFFSET = 2 * VK_UUID_SIZE + 8;
+  static constexpr size_t BLOB_HEADER_SIZE = 2 * VK_UUID_SIZE + 24;
+
+private:
+  std::string path(uint64_t key) const;
+
+  std::array<uint8_t, VK_UUID_SIZE> deviceUUID;
+  uint32_t driverVersion;
+  std::string dir;
+};
+} // namespace rn
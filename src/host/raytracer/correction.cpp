@@ -0,0 +1,64 @@
+#include "correction.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace rn {
+void correctViewFactors(std::vector<float> &vf, const std::vector<float> &areas,
+                        bool closed, uint32_t iterations) {
+  size_t n = areas.size();
+  if (vf.size() != n * n) {
+    throw std::runtime_error("view factor matrix does not match the areas!");
+  }
+
+  // targets are taken before anything is changed
+  std::vector<double> target(n);
+  for (size_t i = 0; i < n; ++i) {
+    double sum = 1.0;
+    if (!closed) {
+      sum = 0.0;
+      for (size_t j = 0; j < n; ++j) {
+        sum += vf[i * n + j];
+      }
+    }
+    target[i] = areas[i] * sum;
+  }
+
+  // reciprocity on the exchange areas
+  std::vector<double> g(n * n);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = i; j < n; ++j) {
+      double mean = 0.5 * (static_cast<double>(areas[i]) * vf[i * n + j] +
+                           static_cast<double>(areas[j]) * vf[j * n + i]);
+      g[i * n + j] = mean;
+      g[j * n + i] = mean;
+    }
+  }
+
+  // symmetric Sinkhorn scaling keeps the matrix symmetric
+  std::vector<double> scale(n);
+  for (uint32_t it = 0; it < std::max(iterations, 1u); ++it) {
+    for (size_t i = 0; i < n; ++i) {
+      double sum = 0.0;
+      for (size_t j = 0; j < n; ++j) {
+        sum += g[i * n + j];
+      }
+      scale[i] = sum > 0.0 ? std::sqrt(target[i] / sum) : 1.0;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        g[i * n + j] *= scale[i] * scale[j];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      vf[i * n + j] =
+          areas[i] > 0.f ? static_cast<float>(g[i * n + j] / areas[i]) : 0.f;
+    }
+  }
+}
+} // namespace rn
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace rn {
+// CPU counterpart of src/shaders/vfCorrect.comp. vf is the row major
+// n x n view factor matrix, areas the n triangle areas.
+// A_i F_ij and A_j F_ji are replaced by their mean, then the exchange areas
+// are scaled symmetrically until every row sums up to 1 (closed) or to the
+// fraction of the row that did not escape to space (open)
+void correctViewFactors(std::vector<float> &vf, const std::vector<float> &areas,
+                        bool closed, uint32_t iterations);
+} // namespace rn
@@ -0,0 +1,235 @@
+#include "gebhart.hpp"
+#include "cputracer/workstealing.hpp"
+#include "pipeline.hpp"
+#include "viewfactor.hpp"
+#include "vknhandler.hpp"
+#include "vma.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace rn {
+namespace {
+// sweeps recorded between two residual checks
+constexpr uint32_t CHECK_EVERY = 8;
+constexpr uint32_t GROUP_SIZE = 64;
+// rows of a task of solveCpu, enough of them for the workers to steal
+constexpr size_t ROWS_PER_TASK = 64;
+} // namespace
+
+GebhartSolver::GebhartSolver(std::shared_ptr<VulkanHandler> vlkn_)
+    : vlkn(vlkn_), cpGebhart(vlkn, std::string("spv/gebhart.comp.spv"),
+                             sizeof(GebhartConsts)) {
+  vk::BufferCreateInfo createInfo{
+      {},
+      sizeof(uint32_t),
+      vk::BufferUsageFlagBits::eStorageBuffer |
+          vk::BufferUsageFlagBits::eShaderDeviceAddress |
+          vk::BufferUsageFlagBits::eTransferDst};
+  VmaAllocationCreateInfo info{VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                                   VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                               VMA_MEMORY_USAGE_AUTO,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+  residualBuffer = vlkn->getVma()->createBuffer(residualAlloc, residualAllocInfo,
+                                                createInfo, info);
+}
+
+GebhartSolver::~GebhartSolver() {
+  if (capacity != 0) {
+    vlkn->getVma()->destroyBuffer(factorAllocs[0], factorBuffers[0]);
+    vlkn->getVma()->destroyBuffer(factorAllocs[1], factorBuffers[1]);
+  }
+  vlkn->getVma()->destroyBuffer(residualAlloc, residualBuffer);
+}
+
+void GebhartSolver::reserve(uint32_t n) {
+  if (n <= capacity) {
+    return;
+  }
+  vlkn->getDevice().waitIdle();
+  for (uint32_t i = 0; i < 2; ++i) {
+    if (capacity != 0) {
+      vlkn->getVma()->destroyBuffer(factorAllocs[i], factorBuffers[i]);
+    }
+    factorBuffers[i] = vlkn->getVma()->createStorageBuffer(
+        static_cast<vk::DeviceSize>(n) * n * sizeof(float), factorAllocs[i]);
+  }
+  capacity = n;
+}
+
+bool GebhartSolver::start(const ViewFactorMatrix &vf,
+                          vk::DeviceAddress emissivity, float tolerance_,
+                          uint32_t maxIterations_) {
+  nTris = vf.rows();
+  iterations = 0;
+  maxIterations = maxIterations_;
+  tolerance = tolerance_;
+  if (nTris == 0 || vf.deviceRowOffsets() == 0) {
+    maxIterations = 0;
+    return false;
+  }
+  reserve(nTris);
+  consts = GebhartConsts{vf.deviceRowOffsets(),
+                         vf.deviceColumns(),
+                         vf.deviceValues(),
+                         emissivity,
+                         0,
+                         0,
+                         vlkn->getVma()->getDeviceAddress(residualBuffer),
+                         nTris};
+  current = 0;
+  return true;
+}
+
+bool GebhartSolver::record(vk::CommandBuffer buffer) {
+  if (iterations >= maxIterations) {
+    return false;
+  }
+  auto vma = vlkn->getVma();
+  if (iterations == 0) {
+    // B starts at zero, the first sweep yields F E
+    buffer.fillBuffer(factorBuffers[current], 0, VK_WHOLE_SIZE, 0);
+  } else {
+    vmaInvalidateAllocation(vma->vma(), residualAlloc, 0, VK_WHOLE_SIZE);
+    float residual;
+    memcpy(&residual, residualAllocInfo.pMappedData, sizeof(float));
+    if (residual < tolerance) {
+      maxIterations = iterations;
+      return false;
+    }
+  }
+
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite |
+                                vk::AccessFlagBits::eTransferWrite,
+                            vk::AccessFlagBits::eShaderRead |
+                                vk::AccessFlagBits::eShaderWrite};
+  vk::MemoryBarrier residualBarrier{vk::AccessFlagBits::eShaderRead |
+                                        vk::AccessFlagBits::eShaderWrite,
+                                    vk::AccessFlagBits::eTransferWrite};
+  buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cpGebhart.get());
+  uint32_t sweeps = std::min(CHECK_EVERY, maxIterations - iterations);
+  for (uint32_t s = 0; s < sweeps; ++s) {
+    // only the residual of the last sweep is looked at, the sweep before
+    // still writes to it
+    if (s + 1 == sweeps) {
+      buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                             vk::PipelineStageFlagBits::eTransfer, {},
+                             residualBarrier, nullptr, nullptr);
+      buffer.fillBuffer(residualBuffer, 0, sizeof(uint32_t), 0);
+    }
+    buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader |
+                               vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eComputeShader, {},
+                           barrier, nullptr, nullptr);
+    consts.src = vma->getDeviceAddress(factorBuffers[current]);
+    consts.dst = vma->getDeviceAddress(factorBuffers[1 - current]);
+    buffer.pushConstants(cpGebhart.getLayout(),
+                         vk::ShaderStageFlagBits::eCompute, 0,
+                         sizeof(GebhartConsts), &consts);
+    ComputePipeline::dispatchRows(buffer, (nTris + GROUP_SIZE - 1) / GROUP_SIZE,
+                                  nTris);
+    current = 1 - current;
+  }
+  iterations += sweeps;
+  return true;
+}
+
+void GebhartSolver::copyRow(vk::CommandBuffer buffer, uint32_t row,
+                            vk::Buffer dst) {
+  if (capacity == 0 || row >= nTris) {
+    return;
+  }
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite,
+                            vk::AccessFlagBits::eTransferRead};
+  buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                         vk::PipelineStageFlagBits::eTransfer, {}, barrier,
+                         nullptr, nullptr);
+  vk::BufferCopy region{static_cast<vk::DeviceSize>(row) * nTris *
+                            sizeof(float),
+                        0, nTris * sizeof(float)};
+  buffer.copyBuffer(factorBuffers[current], dst, region);
+}
+
+std::vector<float> GebhartSolver::getFactors() {
+  std::vector<float> factors(static_cast<size_t>(nTris) * nTris);
+  if (capacity != 0) {
+    vlkn->getVma()->downloadBuffer(factorBuffers[current], factors.data(),
+                                   factors.size() * sizeof(float));
+  }
+  return factors;
+}
+
+std::vector<float> GebhartSolver::getRow(uint32_t row) {
+  std::vector<float> factors(nTris);
+  if (capacity != 0 && row < nTris) {
+    vlkn->getVma()->downloadBuffer(
+        factorBuffers[current], factors.data(), nTris * sizeof(float),
+        static_cast<vk::DeviceSize>(row) * nTris * sizeof(float));
+  }
+  return factors;
+}
+
+std::vector<float> GebhartSolver::solveCpu(const ViewFactorMatrix &vf,
+                                           const std::vector<float> &emissivity,
+                                           float tolerance,
+                                           uint32_t maxIterations,
+                                           uint32_t nThreads) {
+  size_t n = vf.rows();
+  const auto &rows = vf.getRowOffsets();
+  const auto &cols = vf.getColumns();
+  const auto &vals = vf.getValues();
+  std::vector<float> src(n * n, 0.f);
+  std::vector<float> dst(n * n, 0.f);
+  if (n == 0 || rows.empty()) {
+    return src;
+  }
+  if (nThreads == 0) {
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  uint64_t nTasks = (n + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+  nThreads = static_cast<uint32_t>(std::min<uint64_t>(nThreads, nTasks));
+  // the workers are started once, every sweep deals them blocks of rows
+  WorkStealingPool pool(nThreads);
+  // largest change of the rows every worker handled in a sweep
+  std::vector<float> residuals(pool.size());
+
+  auto sweep = [&](uint64_t task, uint32_t worker) {
+    float residual = 0.f;
+    size_t end = std::min<size_t>((task + 1) * ROWS_PER_TASK, n);
+    for (size_t i = task * ROWS_PER_TASK; i < end; ++i) {
+      float *out = dst.data() + i * n;
+      std::fill(out, out + n, 0.f);
+      for (uint32_t nz = rows[i]; nz < rows[i + 1]; ++nz) {
+        uint32_t k = cols[nz];
+        float f = vals[nz];
+        float reflected = f * (1.f - emissivity[k]);
+        const float *in = src.data() + static_cast<size_t>(k) * n;
+        for (size_t j = 0; j < n; ++j) {
+          out[j] += reflected * in[j];
+        }
+        out[k] += f * emissivity[k];
+      }
+      for (size_t j = 0; j < n; ++j) {
+        residual = std::max(residual, std::abs(out[j] - src[i * n + j]));
+      }
+    }
+    residuals[worker] = std::max(residuals[worker], residual);
+  };
+
+  for (uint32_t it = 0; it < maxIterations; ++it) {
+    std::fill(residuals.begin(), residuals.end(), 0.f);
+    pool.run(nTasks, sweep);
+    std::swap(src, dst);
+    if (*std::max_element(residuals.begin(), residuals.end()) < tolerance) {
+      break;
+    }
+  }
+  return src;
+}
+} // namespace rn
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "pipeline.hpp"
+#include "viewfactor.hpp"
+#include "vknhandler.hpp"
+#include "vma.hpp"
+
+namespace rn {
+// Gebhart factors B_ij, the fraction of the energy emitted by i that is
+// absorbed by j after any number of diffuse reflections:
+// B = F E + F (I - E) B, E = diag(emissivity).
+// Solved by Jacobi iterations on the sparse view factors, the result is a
+// dense row major nTris x nTris matrix.
+class GebhartSolver {
+public:
+  GebhartSolver(std::shared_ptr<VulkanHandler> vlkn_);
+  ~GebhartSolver();
+
+  // iterates on the device copy of vf until the largest change drops below
+  // tolerance. start() resets the solve, every record() adds the next
+  // sweeps to buffer and returns false without recording once the residual
+  // of the previous ones is below tolerance or maxIterations are reached.
+  // The commands of the previous record() have to be done by then
+  bool start(const ViewFactorMatrix &vf, vk::DeviceAddress emissivity,
+             float tolerance, uint32_t maxIterations);
+  bool record(vk::CommandBuffer buffer);
+  uint32_t getIterations() const { return iterations; };
+  // copies row of the result to the start of dst, after the last record()
+  void copyRow(vk::CommandBuffer buffer, uint32_t row, vk::Buffer dst);
+  // row major result of the last solve
+  std::vector<float> getFactors();
+  std::vector<float> getRow(uint32_t row);
+
+  // the same iteration on the downloaded matrix, blocks of rows are dealt
+  // to nThreads threads that steal from each other, 0 = hardware
+  // concurrency
+  static std::vector<float> solveCpu(const ViewFactorMatrix &vf,
+                                     const std::vector<float> &emissivity,
+                                     float tolerance, uint32_t maxIterations,
+                                     uint32_t nThreads = 0);
+
+  // push constants of src/shaders/gebhart.comp
+  struct GebhartConsts {
+    vk::DeviceAddress rows;
+    vk::DeviceAddress cols;
+    vk::DeviceAddress vals;
+    vk::DeviceAddress emissivity;
+    vk::DeviceAddress src;
+    vk::DeviceAddress dst;
+    vk::DeviceAddress residual;
+    uint32_t nTris;
+  };
+
+private:
+  std::shared_ptr<VulkanHandler> vlkn;
+  void reserve(uint32_t n);
+
+  uint32_t nTris = 0;
+  uint32_t capacity = 0;
+  GebhartConsts consts{};
+  float tolerance = 0.f;
+  uint32_t maxIterations = 0;
+  uint32_t iterations = 0;
+  // the result lives in factorBuffers[current]
+  uint32_t current = 0;
+  vk::Buffer factorBuffers[2];
+  VmaAllocation factorAllocs[2];
+  vk::Buffer residualBuffer;
+  VmaAllocation residualAlloc;
+  VmaAllocationInfo residualAllocInfo;
+
+  ComputePipeline cpGebhart;
+};
+} // namespace rn
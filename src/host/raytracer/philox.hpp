@@ -0,0 +1,38 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+namespace rn {
+// host side of philox() in src/shaders/random.glsl. Gives the same
+// numbers as the device, so any ray of a launch can be reproduced from
+// RtConsts::seed, the emitter, RtConsts::batch and its index in the batch
+inline std::array<uint32_t, 4> philox(std::array<uint32_t, 4> ctr,
+                                      std::array<uint32_t, 2> key) {
+  constexpr uint32_t M0 = 0xd2511f53u;
+  constexpr uint32_t M1 = 0xcd9e8d57u;
+  for (uint32_t i = 0; i < 10; ++i) {
+    uint64_t p0 = static_cast<uint64_t>(M0) * ctr[0];
+    uint64_t p1 = static_cast<uint64_t>(M1) * ctr[2];
+    ctr = {static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ key[0],
+           static_cast<uint32_t>(p1),
+           static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ key[1],
+           static_cast<uint32_t>(p0)};
+    key[0] += 0x9e3779b9u;
+    key[1] += 0xbb67ae85u;
+  }
+  return ctr;
+}
+
+// the four uniforms u of src/shaders/rttri.rgen, .xy place the origin and
+// .zw the direction. global launches pick the emitter with
+// emitter = 0xffffffff
+inline std::array<float, 4> raySample(uint32_t seed, uint32_t emitter,
+                                      uint32_t batch, uint32_t ray) {
+  auto x = philox({ray, batch, emitter, 0}, {seed, 0});
+  std::array<float, 4> u;
+  for (uint32_t i = 0; i < 4; ++i) {
+    u[i] = static_cast<float>(x[i] >> 8) / static_cast<float>(0x01000000);
+  }
+  return u;
+}
+} // namespace rn
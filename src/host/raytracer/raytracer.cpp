@@ -4,9 +4,14 @@
 #include "pipeline.hpp"
 #include "vknhandler.hpp"
 #include "vma.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_core.h>
@@ -15,6 +20,9 @@
 #include <vulkan/vulkan_structs.hpp>
 
 namespace rn {
+// ViewFactorMatrix sorts hit records as 16 byte items
+static_assert(sizeof(Raytracer::HitRecord) == 16);
+
 Raytracer::Raytracer(std::shared_ptr<VulkanHandler> vlkn_,
                      GeometryHandler &geom)
     : vlkn(vlkn_), descriptor(vlkn_),
@@ -26,10 +34,36 @@ Raytracer::Raytracer(std::shared_ptr<VulkanHandler> vlkn_,
                      std::string("spv/rttri.rchit.spv"),
                      std::string("spv/rttri.rgen.spv"),
                      std::string("spv/rttri.rmiss.spv")),
-      cpSumOneTri(vlkn, std::string("spv/addUpSingleTri.comp.spv")) {
-              
-              buildBlas(geom);
-  buildTlas();
+      cpSumOneTri(vlkn, std::string("spv/addUpSingleTri.comp.spv"),
+                  sizeof(ReduceConsts)),
+      cpNormalizeBins(vlkn,
+                      vlkn_->hasSubgroupInt64()
+                          ? std::string("spv/normalizeBins.comp.spv")
+                          : std::string("spv/normalizeBins.comp.shared.spv"),
+                      sizeof(ReduceConsts)),
+      cpConvergence(vlkn,
+                    vlkn_->hasSubgroupInt64()
+                        ? std::string("spv/convergence.comp.spv")
+                        : std::string("spv/convergence.comp.shared.spv"),
+                    sizeof(ReduceConsts)),
+      cpCorrect(vlkn, std::string("spv/vfCorrect.comp.spv"),
+                sizeof(CorrectConsts)),
+      cpMeshReduce(vlkn, std::string("spv/meshReduce.comp.spv"),
+                   sizeof(MeshConsts)),
+      vfMatrix(vlkn_), gebhart(vlkn_), asCache(vlkn_->getPhysDevice()) {
+  if (vlkn->hasRayQuery()) {
+    cpRayQuery = std::make_unique<ComputePipeline>(
+        vlkn, std::string("spv/rqtri.comp.spv"));
+  }
+  nTris = static_cast<uint32_t>(geom.indices.size() / 3);
+  emissivity = geom.emissivity;
+  emissivityAddress = vlkn->getVma()->getDeviceAddress(geom.getEmissivity());
+  nMeshes = static_cast<uint32_t>(geom.meshOffsets.size() - 1);
+  meshOffsetAddress =
+      vlkn->getVma()->getDeviceAddress(geom.getMeshOffsets());
+
+  buildBlas(geom);
+  buildTlas(geom);
   buildDescriptorSet();
 
   vk::FenceCreateInfo createInfo{vk::FenceCreateFlagBits::eSignaled};
@@ -38,147 +72,520 @@ Raytracer::Raytracer(std::shared_ptr<VulkanHandler> vlkn_,
   updatePushConstantsPoints(geom);
 
   // create output buffer for raytracer nTris + miss + total hit bins
-  createOutputBufferRays(1000 * sizeof(HitRecord),
+  createOutputBufferRays(outData.size() * sizeof(HitRecord),
                          geom.indices.size() * sizeof(float));
+  hitCapacity = outData.size();
   updatePushConstantsRays(geom);
 };
 
 
 Raytracer::~Raytracer() {
+  wait();
   vlkn->getDevice().destroyDescriptorSetLayout(layout);
-  vlkn->getDevice().destroyAccelerationStructureKHR(tlas);
-  vlkn->getVma()->destroyBuffer(tlasAlloc, tlasBuffer);
-  vlkn->getDevice().destroyAccelerationStructureKHR(blas);
-  vlkn->getVma()->destroyBuffer(blasAlloc, blasBuffer);
-  vlkn->getVma()->destroyBuffer(instanceAlloc, instanceBuffer);
+  destroyTlas();
+  destroyBlas();
   vlkn->getVma()->destroyBuffer(outAlloc, outBuffer);
   vlkn->getVma()->destroyBuffer(oriAlloc, oriBuffer);
   vlkn->getVma()->destroyBuffer(dirAlloc, dirBuffer);
   vlkn->getVma()->destroyBuffer(hitAlloc, hitBuffer);
   vlkn->getVma()->destroyBuffer(energyAlloc, energyBuffer);
+  if (vfBuffer) {
+    vlkn->getVma()->destroyBuffer(vfAlloc, vfBuffer);
+  }
+  for (uint32_t i = 0; i < 2 && streamCapacity != 0; ++i) {
+    vlkn->getVma()->destroyBuffer(streamAllocs[i], streamBuffers[i]);
+  }
+  if (binBuffer) {
+    vlkn->getVma()->destroyBuffer(binAlloc, binBuffer);
+  }
+  if (listBuffer) {
+    vlkn->getVma()->destroyBuffer(listAlloc, listBuffer);
+    vlkn->getVma()->destroyBuffer(errorAlloc, errorBuffer);
+  }
+  if (targetBuffer) {
+    vlkn->getVma()->destroyBuffer(targetAlloc, targetBuffer);
+    vlkn->getVma()->destroyBuffer(scaleAlloc, scaleBuffer);
+  }
+  if (meshBuffer) {
+    vlkn->getVma()->destroyBuffer(meshTmpAlloc, meshTmpBuffer);
+    vlkn->getVma()->destroyBuffer(meshAlloc, meshBuffer);
+  }
   vlkn->getDevice().destroyFence(fence);
 }
 
 void Raytracer::buildBlas(GeometryHandler &geom) {
+  // one structure per unique mesh, copies of it are instanced in the tlas
+  size_t nBlas = geom.uniqueMeshes.size();
+  vk::DeviceAddress vertexAddress =
+      vlkn->getVma()->getDeviceAddress(geom.getUniqueVert());
+  vk::DeviceAddress indexAddress =
+      vlkn->getVma()->getDeviceAddress(geom.getUniqueIdx());
 
-  uint32_t primitiveCount = geom.indices.size() / 3;
-  
-  vk::AccelerationStructureGeometryTrianglesDataKHR triangles{
-    vk::Format::eR32G32B32Sfloat,
-        vlkn->getVma()->getDeviceAddress(geom.getVert()),
+  // compacted structures are smaller and faster to trace, but take a second
+  // pass over the device. every structure can be refit in place later on
+  bool compact = buildMode == BuildMode::eFastTrace;
+  blasFlags =
+      vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate |
+      (compact ? vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+                     vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction
+               : vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastBuild);
+
+  std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> buildInfos(nBlas);
+  std::vector<vk::DeviceSize> sizes(nBlas);
+  vk::DeviceSize scratchSize = 0;
+  blases.resize(nBlas);
+  for (size_t i = 0; i < nBlas; ++i) {
+    const auto &mesh = geom.uniqueMeshes[i];
+    if (mesh.nVertices == 0 || static_cast<uint64_t>(mesh.firstVertex) +
+                                       mesh.nVertices >
+                                   geom.uniqueVertices.size()) {
+      throw std::runtime_error("unique mesh " + std::to_string(i) +
+                               " reaches past the unique vertices");
+    }
+    // highest vertex addressed, the indices are offset by firstVertex
+    vk::AccelerationStructureGeometryTrianglesDataKHR triangles{
+        vk::Format::eR32G32B32Sfloat,
+        vertexAddress,
         static_cast<uint32_t>(sizeof(glm::vec4)),
-        primitiveCount,
-      vk::IndexType::eUint32,
-      vlkn->getVma()->getDeviceAddress(geom.getIdx()),
-      {}};
+        mesh.firstVertex + mesh.nVertices - 1,
+        vk::IndexType::eUint32,
+        indexAddress,
+        {}};
+    blases[i].geometry = vk::AccelerationStructureGeometryKHR{
+        vk::GeometryTypeKHR::eTriangles, triangles,
+        vk::GeometryFlagBitsKHR::eOpaque};
+    // indices are local to the mesh
+    blases[i].range = vk::AccelerationStructureBuildRangeInfoKHR{
+        mesh.nTris,
+        static_cast<uint32_t>(mesh.firstIndex * sizeof(uint32_t)),
+        mesh.firstVertex, 0};
+    buildInfos[i] = vk::AccelerationStructureBuildGeometryInfoKHR{
+        vk::AccelerationStructureTypeKHR::eBottomLevel,
+        blasFlags,
+        vk::BuildAccelerationStructureModeKHR::eBuild,
+        VK_NULL_HANDLE,
+        VK_NULL_HANDLE,
+        1,
+        &blases[i].geometry};
 
-  vk::AccelerationStructureGeometryKHR geometryInfo{
-      vk::GeometryTypeKHR::eTriangles, triangles,
-      vk::GeometryFlagBitsKHR::eOpaque};
+    vk::AccelerationStructureBuildSizesInfoKHR sizeInfo =
+        vlkn->getDevice().getAccelerationStructureBuildSizesKHR(
+            vk::AccelerationStructureBuildTypeKHR::eDevice, buildInfos[i],
+            mesh.nTris);
+    sizes[i] = sizeInfo.accelerationStructureSize;
+    scratchSize = std::max({scratchSize, sizeInfo.buildScratchSize,
+                            sizeInfo.updateScratchSize});
+  }
 
-  vk::AccelerationStructureBuildRangeInfoKHR rangeInfo{
-      primitiveCount, 0, 0, 0};
+  // scratch buffer, shared by the builds one after another and kept for
+  // the refits
+  blasScratch = createScratchBuffer(scratchSize, blasScratchAlloc);
+  vk::DeviceAddress scratchAddress =
+      vlkn->getDevice().getBufferAddress(blasScratch);
 
-  vk::AccelerationStructureBuildGeometryInfoKHR buildInfo{
-      vk::AccelerationStructureTypeKHR::eBottomLevel,
-      {},
-      vk::BuildAccelerationStructureModeKHR::eBuild,
-      VK_NULL_HANDLE,
-      VK_NULL_HANDLE,
-      1,
-      &geometryInfo};
+  // structures of earlier runs on the same geometry are read back instead
+  uint64_t key = AsCache::hashGeometry(geom, blasFlags);
+  if (!loadBlas(key)) {
+    for (size_t i = 0; i < nBlas; ++i) {
+      blases[i].size = sizes[i];
+      blases[i].handle =
+          createAccelerationStructure(sizes[i], buildInfos[i].type,
+                                      blases[i].buffer, blases[i].alloc);
+      buildInfos[i].dstAccelerationStructure = blases[i].handle;
+    }
+    buildBlas(buildInfos, scratchAddress, compact);
+    storeBlas(key);
+  }
+  blasSize = 0;
+  for (const auto &blas : blases) {
+    blasSize += blas.size;
+  }
+}
 
-  vk::AccelerationStructureBuildSizesInfoKHR sizeInfo =
-      vlkn->getDevice().getAccelerationStructureBuildSizesKHR(
-          vk::AccelerationStructureBuildTypeKHR::eDevice, buildInfo,
-          primitiveCount);
+void Raytracer::buildBlas(
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> &buildInfos,
+    vk::DeviceAddress scratchAddress, bool compact) {
+  size_t nBlas = blases.size();
+  vk::QueryPool queryPool;
+  if (compact) {
+    queryPool = vlkn->getDevice().createQueryPool(vk::QueryPoolCreateInfo{
+        {},
+        vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+        static_cast<uint32_t>(nBlas)});
+  }
 
-  vk::BufferCreateInfo blasBufferCreateInfo{
+  // the next build reuses the scratch memory, the sizes can only be
+  // queried once the builds have finished
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+                            vk::AccessFlagBits::eAccelerationStructureReadKHR |
+                                vk::AccessFlagBits::eAccelerationStructureWriteKHR};
+  std::vector<vk::AccelerationStructureKHR> handles;
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  for (size_t i = 0; i < nBlas; ++i) {
+    buildInfos[i].scratchData.deviceAddress = scratchAddress;
+    buffer.buildAccelerationStructuresKHR(buildInfos[i], &blases[i].range);
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+        barrier, nullptr, nullptr);
+    handles.push_back(blases[i].handle);
+  }
+  if (compact && nBlas > 0) {
+    buffer.resetQueryPool(queryPool, 0, static_cast<uint32_t>(nBlas));
+    buffer.writeAccelerationStructuresPropertiesKHR(
+        handles, vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+        queryPool, 0);
+  }
+  vlkn->endComputeCommands(buffer);
+
+  if (compact && nBlas > 0) {
+    compactBlas(queryPool);
+  }
+  if (compact) {
+    vlkn->getDevice().destroyQueryPool(queryPool);
+  }
+}
+
+vk::Buffer Raytracer::createSerializationBuffer(vk::DeviceSize size,
+                                                VmaAllocation &alloc) {
+  VmaAllocationInfo allocInfo;
+  vk::BufferCreateInfo createInfo{
       {},
-      sizeInfo.accelerationStructureSize,
+      size,
       vk::BufferUsageFlagBits::eStorageBuffer |
           vk::BufferUsageFlagBits::eShaderDeviceAddress |
-          vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR};
-  VmaAllocationInfo blasInfo{};
-  VmaAllocationCreateInfo blasAllocCreateInfo{
-      {}, VMA_MEMORY_USAGE_GPU_ONLY, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, {}};
+          vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
+          vk::BufferUsageFlagBits::eTransferSrc |
+          vk::BufferUsageFlagBits::eTransferDst};
+  VmaAllocationCreateInfo allocCreateInfo{{}, VMA_MEMORY_USAGE_GPU_ONLY};
+  return vlkn->getVma()->createBuffer(alloc, allocInfo, createInfo,
+                                      allocCreateInfo);
+}
 
-  blasBuffer = vlkn->getVma()->createBuffer(
-      blasAlloc, blasInfo, blasBufferCreateInfo, blasAllocCreateInfo);
+bool Raytracer::loadBlas(uint64_t key) {
+  std::vector<std::vector<uint8_t>> blobs = asCache.load(key);
+  if (blobs.empty() || blobs.size() != blases.size()) {
+    return false;
+  }
+  // the driver has the last word on whether it can read its blobs
+  std::vector<vk::DeviceSize> offsets(blobs.size());
+  vk::DeviceSize total = 0;
+  for (size_t i = 0; i < blobs.size(); ++i) {
+    vk::AccelerationStructureVersionInfoKHR version{blobs[i].data()};
+    if (vlkn->getDevice().getAccelerationStructureCompatibilityKHR(version) !=
+        vk::AccelerationStructureCompatibilityKHR::eCompatible) {
+      return false;
+    }
+    offsets[i] = total;
+    total += (blobs[i].size() + SERIALIZE_ALIGNMENT - 1) /
+             SERIALIZE_ALIGNMENT * SERIALIZE_ALIGNMENT;
+  }
 
-  vk::AccelerationStructureCreateInfoKHR createInfo{
-      {},
-      blasBuffer,
-      0,
-      sizeInfo.accelerationStructureSize,
-      buildInfo.type};
+  // the blobs have to sit at aligned device addresses
+  VmaAllocation alloc;
+  vk::Buffer blobBuffer =
+      createSerializationBuffer(total + SERIALIZE_ALIGNMENT, alloc);
+  vk::DeviceAddress address = vlkn->getVma()->getDeviceAddress(blobBuffer);
+  vk::DeviceSize base =
+      (SERIALIZE_ALIGNMENT - address % SERIALIZE_ALIGNMENT) % SERIALIZE_ALIGNMENT;
+  for (size_t i = 0; i < blobs.size(); ++i) {
+    vlkn->getVma()->uploadBuffer(blobBuffer, blobs[i].data(), blobs[i].size(),
+                                 base + offsets[i]);
+  }
+
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  for (size_t i = 0; i < blobs.size(); ++i) {
+    uint64_t size;
+    std::memcpy(&size, blobs[i].data() + AsCache::DESERIALIZED_SIZE_OFFSET,
+                sizeof(size));
+    blases[i].size = size;
+    blases[i].handle = createAccelerationStructure(
+        size, vk::AccelerationStructureTypeKHR::eBottomLevel, blases[i].buffer,
+        blases[i].alloc);
+    vk::CopyMemoryToAccelerationStructureInfoKHR copyInfo{
+        {}, blases[i].handle, vk::CopyAccelerationStructureModeKHR::eDeserialize};
+    copyInfo.src.deviceAddress = address + base + offsets[i];
+    buffer.copyMemoryToAccelerationStructureKHR(copyInfo);
+  }
+  vlkn->endComputeCommands(buffer);
+  vlkn->getVma()->destroyBuffer(alloc, blobBuffer);
+  return true;
+}
+
+void Raytracer::storeBlas(uint64_t key) {
+  if (blases.empty()) {
+    return;
+  }
+  uint32_t nBlas = static_cast<uint32_t>(blases.size());
+  vk::QueryPool queryPool =
+      vlkn->getDevice().createQueryPool(vk::QueryPoolCreateInfo{
+          {}, vk::QueryType::eAccelerationStructureSerializationSizeKHR, nBlas});
+  std::vector<vk::AccelerationStructureKHR> handles;
+  for (const auto &blas : blases) {
+    handles.push_back(blas.handle);
+  }
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  buffer.resetQueryPool(queryPool, 0, nBlas);
+  buffer.writeAccelerationStructuresPropertiesKHR(
+      handles, vk::QueryType::eAccelerationStructureSerializationSizeKHR,
+      queryPool, 0);
+  vlkn->endComputeCommands(buffer);
+  std::vector<vk::DeviceSize> sizes =
+      vlkn->getDevice()
+          .getQueryPoolResults<vk::DeviceSize>(
+              queryPool, 0, nBlas, nBlas * sizeof(vk::DeviceSize),
+              sizeof(vk::DeviceSize),
+              vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait)
+          .value;
+  vlkn->getDevice().destroyQueryPool(queryPool);
+
+  std::vector<vk::DeviceSize> offsets(nBlas);
+  vk::DeviceSize total = 0;
+  for (uint32_t i = 0; i < nBlas; ++i) {
+    offsets[i] = total;
+    total += (sizes[i] + SERIALIZE_ALIGNMENT - 1) / SERIALIZE_ALIGNMENT *
+             SERIALIZE_ALIGNMENT;
+  }
+  VmaAllocation alloc;
+  vk::Buffer blobBuffer =
+      createSerializationBuffer(total + SERIALIZE_ALIGNMENT, alloc);
+  vk::DeviceAddress address = vlkn->getVma()->getDeviceAddress(blobBuffer);
+  vk::DeviceSize base =
+      (SERIALIZE_ALIGNMENT - address % SERIALIZE_ALIGNMENT) % SERIALIZE_ALIGNMENT;
+
+  buffer = vlkn->beginComputeCommands();
+  for (uint32_t i = 0; i < nBlas; ++i) {
+    vk::CopyAccelerationStructureToMemoryInfoKHR copyInfo{
+        blases[i].handle, {}, vk::CopyAccelerationStructureModeKHR::eSerialize};
+    copyInfo.dst.deviceAddress = address + base + offsets[i];
+    buffer.copyAccelerationStructureToMemoryKHR(copyInfo);
+  }
+  vlkn->endComputeCommands(buffer);
+
+  std::vector<std::vector<uint8_t>> blobs(nBlas);
+  for (uint32_t i = 0; i < nBlas; ++i) {
+    blobs[i].resize(sizes[i]);
+    vlkn->getVma()->downloadBuffer(blobBuffer, blobs[i].data(), sizes[i],
+                                   base + offsets[i]);
+  }
+  vlkn->getVma()->destroyBuffer(alloc, blobBuffer);
+  asCache.store(key, blobs);
+}
+
+void Raytracer::compactBlas(vk::QueryPool queryPool) {
+  std::vector<vk::DeviceSize> sizes =
+      vlkn->getDevice()
+          .getQueryPoolResults<vk::DeviceSize>(
+              queryPool, 0, static_cast<uint32_t>(blases.size()),
+              blases.size() * sizeof(vk::DeviceSize), sizeof(vk::DeviceSize),
+              vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait)
+          .value;
 
-  blas = vlkn->getDevice().createAccelerationStructureKHR(createInfo);
-  buildInfo.dstAccelerationStructure = blas;
+  // copy into structures of the compacted size and free the originals
+  std::vector<Blas> compacted(blases);
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  for (size_t i = 0; i < blases.size(); ++i) {
+    compacted[i].size = sizes[i];
+    compacted[i].handle =
+        createAccelerationStructure(sizes[i],
+                                    vk::AccelerationStructureTypeKHR::eBottomLevel,
+                                    compacted[i].buffer, compacted[i].alloc);
+    buffer.copyAccelerationStructureKHR(vk::CopyAccelerationStructureInfoKHR{
+        blases[i].handle, compacted[i].handle,
+        vk::CopyAccelerationStructureModeKHR::eCompact});
+  }
+  vlkn->endComputeCommands(buffer);
 
-  // scratch buffer
-  VmaAllocation scratchAlloc;
-  VmaAllocationInfo scratchAllocInfo;
-  vk::BufferCreateInfo scratchBufferCreateInfo{
+  for (auto &blas : blases) {
+    vlkn->getDevice().destroyAccelerationStructureKHR(blas.handle);
+    vlkn->getVma()->destroyBuffer(blas.alloc, blas.buffer);
+  }
+  blases = std::move(compacted);
+}
+
+void Raytracer::destroyBlas() {
+  for (auto &blas : blases) {
+    vlkn->getDevice().destroyAccelerationStructureKHR(blas.handle);
+    vlkn->getVma()->destroyBuffer(blas.alloc, blas.buffer);
+  }
+  blases.clear();
+  if (blasScratch) {
+    vlkn->getVma()->destroyBuffer(blasScratchAlloc, blasScratch);
+    blasScratch = nullptr;
+  }
+}
+
+void Raytracer::destroyTlas() {
+  vlkn->getDevice().destroyAccelerationStructureKHR(tlas);
+  vlkn->getVma()->destroyBuffer(tlasAlloc, tlasBuffer);
+  vlkn->getVma()->destroyBuffer(instanceAlloc, instanceBuffer);
+  vlkn->getVma()->destroyBuffer(tlasScratchAlloc, tlasScratch);
+  if (instanceStaging) {
+    vlkn->getVma()->destroyBuffer(instanceStagingAlloc, instanceStaging);
+    instanceStaging = nullptr;
+  }
+}
+
+vk::Buffer Raytracer::createScratchBuffer(vk::DeviceSize size,
+                                          VmaAllocation &alloc) {
+  VmaAllocationInfo allocInfo;
+  vk::BufferCreateInfo createInfo{
       {},
-      sizeInfo.buildScratchSize,
+      size,
       vk::BufferUsageFlagBits::eStorageBuffer |
           vk::BufferUsageFlagBits::eShaderDeviceAddress};
-  VmaAllocationCreateInfo scratchInfo{
+  VmaAllocationCreateInfo allocCreateInfo{
       VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
       VMA_MEMORY_USAGE_GPU_ONLY,
       VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
       {}};
-  vk::Buffer scratch = vlkn->getVma()->createBuffer(
-      scratchAlloc, scratchAllocInfo, scratchBufferCreateInfo, scratchInfo);
+  return vlkn->getVma()->createBuffer(alloc, allocInfo, createInfo,
+                                      allocCreateInfo);
+}
 
-  buildInfo.scratchData.deviceAddress =
-      vlkn->getDevice().getBufferAddress(scratch);
+vk::AccelerationStructureKHR Raytracer::createAccelerationStructure(
+    vk::DeviceSize size, vk::AccelerationStructureTypeKHR type,
+    vk::Buffer &buffer, VmaAllocation &alloc) {
+  vk::BufferCreateInfo bufferCreateInfo{
+      {},
+      size,
+      vk::BufferUsageFlagBits::eStorageBuffer |
+          vk::BufferUsageFlagBits::eShaderDeviceAddress |
+          vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR};
+  VmaAllocationInfo info{};
+  VmaAllocationCreateInfo allocCreateInfo{
+      {}, VMA_MEMORY_USAGE_GPU_ONLY, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, {}};
 
-  vk::CommandBuffer buffer = vlkn->beginSingleTimeCommands();
-  buffer.buildAccelerationStructuresKHR(buildInfo, &rangeInfo);
-  vlkn->endSingleTimeCommands(buffer);
+  buffer =
+      vlkn->getVma()->createBuffer(alloc, info, bufferCreateInfo, allocCreateInfo);
 
-  // destroy buffers
-  vlkn->getVma()->destroyBuffer(scratchAlloc, scratch);
+  vk::AccelerationStructureCreateInfoKHR createInfo{{}, buffer, 0, size, type};
+  return vlkn->getDevice().createAccelerationStructureKHR(createInfo);
 }
 
-void Raytracer::buildTlas() {
-  vk::AccelerationStructureDeviceAddressInfoKHR addressInfo{blas};
-  vk::DeviceAddress blasAddress =
-      vlkn->getDevice().getAccelerationStructureAddressKHR(addressInfo);
+void Raytracer::rebuildAccelerationStructures(GeometryHandler &geom,
+                                              BuildMode mode) {
+  wait();
+  destroyTlas();
+  destroyBlas();
 
-  instance.transform.matrix[0][0] = 1.f;
-  instance.transform.matrix[1][1] = 1.f;
-  instance.transform.matrix[2][2] = 1.f;
-  instance.instanceCustomIndex = 0;
-  instance.mask = 0xFF;
-  instance.instanceShaderBindingTableRecordOffset = 0;
-  instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-  instance.accelerationStructureReference = blasAddress;
+  buildMode = mode;
+  buildBlas(geom);
+  buildTlas(geom);
+  buildDescriptorSet();
+}
 
-  VmaAllocationInfo instanceInfo;
+void Raytracer::refitAccelerationStructures(GeometryHandler &geom) {
+  wait();
+  std::vector<uint32_t> deformed = geom.updateBuffers();
+  setAliasTable(geom);
+  updateInstances(geom);
+  vk::DeviceSize instanceBytes = instances.size() * sizeof(instances[0]);
+  if (!instanceStaging) {
+    instanceStaging = vlkn->getVma()->stagingBuffer(
+        instanceBytes, instanceStagingAlloc, instanceStagingInfo);
+  }
+  memcpy(instanceStagingInfo.pMappedData, instances.data(), instanceBytes);
+  vmaFlushAllocation(vlkn->getVma()->vma(), instanceStagingAlloc, 0,
+                     VK_WHOLE_SIZE);
+  vlkn->getVma()->copyRegions(
+      instanceStaging, {{instanceBuffer, vk::BufferCopy{0, 0, instanceBytes}}});
 
-  instanceBuffer = vlkn->getVma()->uploadInstanceB(instance, instanceAlloc);
+  // the refits share the scratch buffer, the tlas reads the refit blases
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+                            vk::AccessFlagBits::eAccelerationStructureReadKHR |
+                                vk::AccessFlagBits::eAccelerationStructureWriteKHR};
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  for (uint32_t u : deformed) {
+    Blas &blas = blases[u];
+    vk::AccelerationStructureBuildGeometryInfoKHR buildInfo{
+        vk::AccelerationStructureTypeKHR::eBottomLevel,
+        blasFlags,
+        vk::BuildAccelerationStructureModeKHR::eUpdate,
+        blas.handle,
+        blas.handle,
+        1,
+        &blas.geometry};
+    buildInfo.scratchData.deviceAddress =
+        vlkn->getDevice().getBufferAddress(blasScratch);
+    buffer.buildAccelerationStructuresKHR(buildInfo, &blas.range);
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+        barrier, nullptr, nullptr);
+  }
+  vk::AccelerationStructureBuildRangeInfoKHR rangeInfo{
+      static_cast<uint32_t>(instances.size()), 0, 0, 0};
+  vk::AccelerationStructureBuildGeometryInfoKHR buildInfo{
+      vk::AccelerationStructureTypeKHR::eTopLevel,
+      tlasFlags,
+      vk::BuildAccelerationStructureModeKHR::eUpdate,
+      tlas,
+      tlas,
+      1,
+      &tlasGeometry};
+  buildInfo.scratchData.deviceAddress =
+      vlkn->getDevice().getBufferAddress(tlasScratch);
+  buffer.buildAccelerationStructuresKHR(buildInfo, &rangeInfo);
+  vlkn->endComputeCommands(buffer);
+}
+
+void Raytracer::updateInstances(GeometryHandler &geom) {
+  // every mesh places its unique mesh, hits are mapped back to the global
+  // triangles through instanceCustomIndex + gl_PrimitiveID
+  instances.clear();
+  for (const auto &mesh : geom.meshInstances) {
+    // instanceCustomIndex has 24 bits
+    const auto &unique = geom.uniqueMeshes[mesh.uniqueMesh];
+    if (static_cast<uint64_t>(mesh.firstTri) + unique.nTris > (1u << 24)) {
+      throw std::runtime_error(
+          "more than 2^24 triangles can not be told apart by the instances");
+    }
+    vk::AccelerationStructureDeviceAddressInfoKHR addressInfo{
+        blases[mesh.uniqueMesh].handle};
+    vk::AccelerationStructureInstanceKHR instance;
+    std::copy(mesh.transform.begin(), mesh.transform.end(),
+              &instance.transform.matrix[0][0]);
+    instance.instanceCustomIndex = mesh.firstTri;
+    instance.mask = 0xFF;
+    instance.instanceShaderBindingTableRecordOffset = 0;
+    instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    instance.accelerationStructureReference =
+        vlkn->getDevice().getAccelerationStructureAddressKHR(addressInfo);
+    instances.push_back(instance);
+  }
+}
+
+void Raytracer::buildTlas(GeometryHandler &geom) {
+  updateInstances(geom);
+  uint32_t nInstances = static_cast<uint32_t>(instances.size());
+
+  instanceBuffer = vlkn->getVma()->uploadInstanceB(instances, instanceAlloc);
   vk::DeviceAddress instanceBufferAddress = vlkn->getVma()->getDeviceAddress(instanceBuffer);
 
-  vk::AccelerationStructureBuildRangeInfoKHR rangeInfo{1, 0, 0, 0};
+  vk::AccelerationStructureBuildRangeInfoKHR rangeInfo{nInstances, 0, 0, 0};
   vk::AccelerationStructureGeometryInstancesDataKHR instancesVK {VK_FALSE,instanceBufferAddress};
 
-  vk::AccelerationStructureGeometryKHR geometry{vk::GeometryTypeKHR::eInstances,
-                                                instancesVK};
+  tlasGeometry = vk::AccelerationStructureGeometryKHR{
+      vk::GeometryTypeKHR::eInstances, instancesVK};
+  tlasFlags =
+      vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate |
+      (buildMode == BuildMode::eFastTrace
+           ? vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
+           : vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastBuild);
   vk::AccelerationStructureBuildGeometryInfoKHR buildInfo{
       vk::AccelerationStructureTypeKHR::eTopLevel,
-      vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastBuild,
+      tlasFlags,
       vk::BuildAccelerationStructureModeKHR::eBuild,
       VK_NULL_HANDLE,
       VK_NULL_HANDLE,
       1,
-      &geometry};
+      &tlasGeometry};
 
   vk::AccelerationStructureBuildSizesInfoKHR sizeInfo =
       vlkn->getDevice().getAccelerationStructureBuildSizesKHR(
-          vk::AccelerationStructureBuildTypeKHR::eDevice, buildInfo, 1);
+          vk::AccelerationStructureBuildTypeKHR::eDevice, buildInfo,
+          nInstances);
 
   vk::BufferCreateInfo tlasBufferCreateInfo{
       {},
@@ -199,43 +606,37 @@ void Raytracer::buildTlas() {
 
   buildInfo.dstAccelerationStructure = tlas;
 
-  // scratch buffer
-  VmaAllocation scratchAlloc;
-  VmaAllocationInfo scratchAllocInfo;
-  vk::BufferCreateInfo scratchBufferCreateInfo{
-      {},
-      sizeInfo.buildScratchSize,
-      vk::BufferUsageFlagBits::eStorageBuffer |
-          vk::BufferUsageFlagBits::eShaderDeviceAddress};
-  VmaAllocationCreateInfo scratchInfo{
-    VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT |
-        VMA_ALLOCATION_CREATE_MAPPED_BIT,
-      VMA_MEMORY_USAGE_GPU_ONLY,
-      VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-      {}};
-  vk::Buffer scratch = vlkn->getVma()->createBuffer(
-      scratchAlloc, scratchAllocInfo, scratchBufferCreateInfo, scratchInfo);
-
-  vk::MemoryAllocateInfo allocInfo{sizeInfo.buildScratchSize};
+  // scratch buffer, kept for the refits
+  tlasScratch = createScratchBuffer(
+      std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize),
+      tlasScratchAlloc);
   buildInfo.scratchData.deviceAddress =
-      vlkn->getDevice().getBufferAddress(scratch);
+      vlkn->getDevice().getBufferAddress(tlasScratch);
 
-  vk::CommandBuffer buffer = vlkn->beginSingleTimeCommands();
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
   buffer.buildAccelerationStructuresKHR(buildInfo, &rangeInfo);
-  vlkn->endSingleTimeCommands(buffer);
-
-  // destroy buffers
-  vlkn->getVma()->destroyBuffer(scratchAlloc, scratch);
+  vlkn->endComputeCommands(buffer);
 }
 
-void Raytracer::buildDescriptorSet() { descriptor.writeSetup(tlas); }
+void Raytracer::buildDescriptorSet() {
+  descriptor.writeSetup(tlas);
+  // the ray query backend has no descriptors
+  rtPipelineRays.consts.tlas = vlkn->getDevice().getAccelerationStructureAddressKHR(
+      vk::AccelerationStructureDeviceAddressInfoKHR{tlas});
+}
 
 void Raytracer::traceOri(std::shared_ptr<State> state) {
-  vk::CommandBuffer buffer = vlkn->beginSingleTimeCommands();
+  // the visualised rays only have a ray generation shader
+  if (!hasRayTracingPipeline()) {
+    std::cerr << "tracing points needs the ray tracing pipeline\n";
+    return;
+  }
+  wait();
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
   rtPipelinePoints.bind(buffer);
 
   // update constants
-  rtPipelinePoints.consts.currTri = state->currTri;
+  rtPipelinePoints.consts.currTri = static_cast<uint32_t>(state->currTri);
 
 
   buffer.pushConstants(
@@ -248,24 +649,7 @@ void Raytracer::traceOri(std::shared_ptr<State> state) {
   buffer.traceRaysKHR(rtPipelinePoints.rgenRegion, rtPipelinePoints.missRegion,
                       rtPipelinePoints.hitRegion, {}, state->nPoints, 1, 1);
 
-  vlkn->endSingleTimeCommands(buffer);
-  
-//buffer.end();
-//  vk::SubmitInfo info{};
-//  info.setCommandBufferCount(1);
-//  info.pCommandBuffers = &buffer;
-//
-//  // reset fence
-//  vlkn->getDevice().resetFences(fence);
-//
-//  vlkn->getGqueue().submit(info, fence);
-//  if (vk::Result::eSuccess !=
-//      vlkn->getDevice().waitForFences(fence, VK_TRUE, UINT64_MAX)) {
-//    throw std::runtime_error("waited too long!");
-//  };
-//
-  vlkn->getGqueue().waitIdle();
-  vlkn->getDevice().waitIdle();
+  submit(buffer);
 
 //  const float *pData =
 //      reinterpret_cast<const float *>(outAllocInfo.pMappedData);
@@ -277,12 +661,413 @@ void Raytracer::traceOri(std::shared_ptr<State> state) {
 }
 
 void Raytracer::traceRays(std::shared_ptr<State> state) {
-  vk::CommandBuffer buffer = vlkn->beginSingleTimeCommands();
-  rtPipelineRays.bind(buffer);
+  wait();
+  reserveBinBuffer(1);
 
   // update constants
-  rtPipelineRays.consts.currTri = state->currTri;
+  rtPipelineRays.consts.currTri = static_cast<uint32_t>(state->currTri);
+  rtPipelineRays.consts.flags =
+      state->sobol ? RaytracingPipeline::TRACE_SOBOL : 0;
+  reseed(state);
+  selectBackend(state);
+  startStream(state, state->nRays, 1, 1, false, {});
+}
+
+void Raytracer::traceAll(std::shared_ptr<State> state) {
+  // global launches draw the emitter of every ray from the alias table,
+  // the hits are not grouped by row so they have to be binned or sorted
+  bool global = state->global;
+  uint64_t width = global ? state->globalRays : state->nRays;
+  uint32_t height = global ? 1 : nTris;
+  // the sparse matrix is built from the hit records, skip the dense bins
+  bool sparse = state->sparse && !state->binned;
+  bool binned = !sparse && (state->binned || global);
+  // the sparse matrix is sorted from all hits at once, they have to fit
+  // into a single allocation and a 32 bit count
+  vk::DeviceSize maxHits = maxSparseHits();
+  if (sparse && height != 0 && width > maxHits / height) {
+    throw std::runtime_error(
+        "sparse launch of " + std::to_string(width) + " x " +
+        std::to_string(height) + " rays exceeds the " +
+        std::to_string(maxHits) + " hits the device can sort at once");
+  }
+  wait();
+  selectBackend(state);
+  uint32_t launchWidth = maxLaunchWidth(height);
+
+  // currTri only selects the row that is shown
+  rtPipelineRays.consts.currTri = static_cast<uint32_t>(state->currTri);
+  rtPipelineRays.consts.flags = RaytracingPipeline::TRACE_BATCH;
+  if (binned) {
+    rtPipelineRays.consts.flags |= RaytracingPipeline::TRACE_BINS;
+  }
+  if (global) {
+    rtPipelineRays.consts.flags |= RaytracingPipeline::TRACE_GLOBAL;
+  }
+  if (state->sobol) {
+    rtPipelineRays.consts.flags |= RaytracingPipeline::TRACE_SOBOL;
+  }
+  vfCurrent = !sparse;
+  reseed(state);
+
+  if (!sparse) {
+    reserveBinBuffer(nTris);
+    reserveVfBuffer();
+    // bins are indexed by emitter, so all rows are normalised
+    startStream(state, width, height, nTris, state->correct,
+                [this, state]() { reduceMeshes(state); });
+    return;
+  }
+
+  // the sparse matrix is sorted from all hits at once, so these launches
+  // are not streamed. both fit into 32 bits, see above
+  uint32_t nHits = static_cast<uint32_t>(width * height);
+  reserveHitBuffer(nHits);
+  vk::DeviceAddress hits = vlkn->getVma()->getDeviceAddress(hitBuffer);
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  // wider launches than the device takes are split into chunks of rays
+  // like streamChunks, each writes its own range of the hit records. The
+  // sort does not care about their order
+  for (uint64_t traced = 0; traced < width; traced += launchWidth) {
+    uint32_t chunk =
+        static_cast<uint32_t>(std::min<uint64_t>(launchWidth, width - traced));
+    rtPipelineRays.consts.hit = hits + traced * height * sizeof(HitRecord);
+    rtPipelineRays.consts.sampleOffset = static_cast<uint32_t>(traced);
+    rtPipelineRays.consts.batch = static_cast<uint32_t>(traced / launchWidth);
+    trace(buffer, chunk, height);
+  }
+  rtPipelineRays.consts.hit = hits;
+  rtPipelineRays.consts.sampleOffset = 0;
+  rtPipelineRays.consts.batch = 0;
+  vfMatrix.build(buffer, hitBuffer, nHits, nTris, nTris);
+
+  // the results are read back once the launch has finished
+  submit(buffer, [this, state]() {
+    vfMatrix.download();
+    // the mesh reduction needs the dense matrix
+    state->meshViewFactors.clear();
+    if (state->gebhart) {
+      solveGebhart(state);
+    } else {
+      showRow(vfMatrix, static_cast<uint32_t>(state->currTri));
+    }
+  });
+}
+
+void Raytracer::startStream(std::shared_ptr<State> state, uint64_t nRays,
+                            uint32_t nEmitters, uint32_t nRows, bool correct,
+                            std::function<void()> finish) {
+  bool binned = rtPipelineRays.consts.flags & RaytracingPipeline::TRACE_BINS;
+  // a single emitter row has to fit into a chunk
+  vk::DeviceSize chunkHits = std::max<vk::DeviceSize>(CHUNK_HITS, nEmitters);
+  if (!binned) {
+    reserveStreamBuffers(chunkHits);
+  }
+  uint32_t chunk = static_cast<uint32_t>(std::min<uint64_t>(
+      {chunkHits / nEmitters, nRays, maxLaunchWidth(nEmitters)}));
+  stream = Stream{state, nRays, 0, nEmitters, nRows, chunk, correct,
+                  std::move(finish)};
+
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  clearBins(buffer);
+  streamChunks(buffer);
+}
+
+void Raytracer::streamChunks(vk::CommandBuffer buffer) {
+  bool binned = rtPipelineRays.consts.flags & RaytracingPipeline::TRACE_BINS;
+  // chunk n has to be traced before it is summed up, and summed up before
+  // chunk n + 2 overwrites its hits
+  vk::MemoryBarrier traced{vk::AccessFlagBits::eShaderWrite,
+                           vk::AccessFlagBits::eShaderRead};
+  vk::MemoryBarrier summed{{}, vk::AccessFlagBits::eShaderWrite};
+  uint32_t n = 0;
+  uint32_t lastWidth = 0;
+  for (; n < CHUNKS_PER_SUBMIT && stream.traced < stream.nRays; ++n) {
+    uint32_t width = static_cast<uint32_t>(
+        std::min<uint64_t>(stream.chunk, stream.nRays - stream.traced));
+    if (!binned) {
+      rtPipelineRays.consts.hit =
+          vlkn->getVma()->getDeviceAddress(streamBuffers[n % 2]);
+    }
+    // every chunk draws the next samples of the sequence
+    rtPipelineRays.consts.sampleOffset = static_cast<uint32_t>(stream.traced);
+    rtPipelineRays.consts.batch =
+        static_cast<uint32_t>(stream.traced / stream.chunk);
+    trace(buffer, width, stream.nEmitters);
+    stream.traced += width;
+    if (binned) {
+      continue;
+    }
+    // the previous chunk is summed up while this one is traced
+    if (n > 0) {
+      accumulate(buffer, streamBuffers[(n - 1) % 2], lastWidth);
+      buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                             traceStage(), {}, summed, nullptr, nullptr);
+    }
+    buffer.pipelineBarrier(traceStage(),
+                           vk::PipelineStageFlagBits::eComputeShader, {},
+                           traced, nullptr, nullptr);
+    lastWidth = width;
+  }
+  if (!binned && n > 0) {
+    accumulate(buffer, streamBuffers[(n - 1) % 2], lastWidth);
+  }
+  rtPipelineRays.consts.sampleOffset = 0;
+  rtPipelineRays.consts.batch = 0;
+
+  // the device is kept busy by one submission at a time, short enough to
+  // not run into the driver timeouts
+  if (stream.traced < stream.nRays) {
+    submit(buffer, [this]() {
+      vk::CommandBuffer next = vlkn->beginComputeCommands();
+      streamChunks(next);
+    });
+    return;
+  }
+  normalize(buffer, stream.nRows);
+  if (stream.correct) {
+    correct(buffer, stream.state);
+  }
+  stream.state = nullptr;
+  submit(buffer, std::move(stream.finish));
+}
+
+void Raytracer::solveGebhart(std::shared_ptr<State> state) {
+  uint32_t row = static_cast<uint32_t>(state->currTri);
+  if (state->gebhartCpu) {
+    float tolerance = state->gebhartTolerance;
+    uint32_t iterations = state->gebhartIterations;
+    runAsync(
+        [this, tolerance, iterations]() {
+          gebhartFactors = GebhartSolver::solveCpu(vfMatrix, emissivity,
+                                                   tolerance, iterations);
+        },
+        [this, row]() {
+          if (row < nTris) {
+            showRow(std::vector<float>(
+                gebhartFactors.begin() + static_cast<size_t>(row) * nTris,
+                gebhartFactors.begin() + static_cast<size_t>(row + 1) * nTris));
+          }
+        });
+    return;
+  }
+  gebhartFactors.clear();
+  if (!gebhart.start(vfMatrix, emissivityAddress, state->gebhartTolerance,
+                     state->gebhartIterations)) {
+    showRow(std::vector<float>());
+    return;
+  }
+  stepGebhart(row);
+}
+
+void Raytracer::stepGebhart(uint32_t row) {
+  // every submission ends with the residual check of its last sweep
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  if (gebhart.record(buffer)) {
+    submit(buffer, [this, row]() { stepGebhart(row); });
+    return;
+  }
+  // only the shown row is fetched
+  if (row < nTris) {
+    gebhart.copyRow(buffer, row, energyBuffer);
+  }
+  submit(buffer);
+}
+
+std::vector<float> Raytracer::getMeshViewFactors() {
+  wait();
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  bool recorded = recordMeshReduce(buffer);
+  vlkn->endComputeCommands(buffer);
+  return recorded ? readMeshViewFactors() : std::vector<float>();
+}
+
+void Raytracer::reduceMeshes(std::shared_ptr<State> state) {
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  if (!recordMeshReduce(buffer)) {
+    vlkn->freeComputeCommands(buffer);
+    state->meshViewFactors.clear();
+    return;
+  }
+  submit(buffer,
+         [this, state]() { state->meshViewFactors = readMeshViewFactors(); });
+}
+
+bool Raytracer::recordMeshReduce(vk::CommandBuffer buffer) {
+  if (!vfBuffer || !vfCurrent || nMeshes == 0) {
+    return false;
+  }
+  if (!meshBuffer) {
+    meshTmpBuffer = vlkn->getVma()->createStorageBuffer(
+        static_cast<vk::DeviceSize>(nTris) * nMeshes * sizeof(float),
+        meshTmpAlloc);
+    // read back through mapped memory
+    meshBuffer = createMappedBuffer(
+        static_cast<vk::DeviceSize>(nMeshes) * nMeshes * sizeof(float),
+        meshAlloc, meshAllocInfo);
+  }
+  MeshConsts consts{vlkn->getVma()->getDeviceAddress(vfBuffer),
+                    rtPipelineRays.consts.frames,
+                    meshOffsetAddress,
+                    vlkn->getVma()->getDeviceAddress(meshTmpBuffer),
+                    vlkn->getVma()->getDeviceAddress(meshBuffer),
+                    nTris,
+                    nMeshes,
+                    MESH_RECEIVERS};
+
+  buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cpMeshReduce.get());
+  buffer.pushConstants(cpMeshReduce.getLayout(),
+                       vk::ShaderStageFlagBits::eCompute, 0,
+                       sizeof(MeshConsts), &consts);
+  // one workgroup per triangle, more than 65535 are split along y
+  uint32_t x = std::min(nTris, 65535u);
+  buffer.dispatch(x, (nTris + x - 1) / x, 1);
+
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite,
+                            vk::AccessFlagBits::eShaderRead};
+  buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                         vk::PipelineStageFlagBits::eComputeShader, {},
+                         barrier, nullptr, nullptr);
+  consts.mode = MESH_EMITTERS;
+  buffer.pushConstants(cpMeshReduce.getLayout(),
+                       vk::ShaderStageFlagBits::eCompute, 0,
+                       sizeof(MeshConsts), &consts);
+  // one workgroup per mesh
+  buffer.dispatch(nMeshes, 1, 1);
+
+  vk::MemoryBarrier hostBarrier{vk::AccessFlagBits::eShaderWrite,
+                                vk::AccessFlagBits::eHostRead};
+  buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                         vk::PipelineStageFlagBits::eHost, {}, hostBarrier,
+                         nullptr, nullptr);
+  return true;
+}
+
+std::vector<float> Raytracer::readMeshViewFactors() {
+  std::vector<float> meshVf(static_cast<size_t>(nMeshes) * nMeshes);
+  vmaInvalidateAllocation(vlkn->getVma()->vma(), meshAlloc, 0, VK_WHOLE_SIZE);
+  memcpy(meshVf.data(), meshAllocInfo.pMappedData,
+         meshVf.size() * sizeof(float));
+  return meshVf;
+}
+
+std::vector<float> Raytracer::getGebhartFactors() {
+  if (!gebhartFactors.empty()) {
+    return gebhartFactors;
+  }
+  return gebhart.getFactors();
+}
+
+void Raytracer::showRow(const std::vector<float> &values) {
+  float *pData = reinterpret_cast<float *>(energyAllocInfo.pMappedData);
+  memset(pData, 0, nTris * sizeof(float));
+  memcpy(pData, values.data(),
+         std::min<size_t>(values.size(), nTris) * sizeof(float));
+  vmaFlushAllocation(vlkn->getVma()->vma(), energyAlloc, 0, VK_WHOLE_SIZE);
+}
+
+void Raytracer::showRow(const ViewFactorMatrix &matrix, uint32_t row) {
+  float *pData = reinterpret_cast<float *>(energyAllocInfo.pMappedData);
+  memset(pData, 0, nTris * sizeof(float));
+  if (row < matrix.rows()) {
+    const auto &offsets = matrix.getRowOffsets();
+    for (uint32_t i = offsets[row]; i < offsets[row + 1]; ++i) {
+      pData[matrix.getColumns()[i]] = matrix.getValues()[i];
+    }
+  }
+  vmaFlushAllocation(vlkn->getVma()->vma(), energyAlloc, 0, VK_WHOLE_SIZE);
+}
+
+void Raytracer::submit(vk::CommandBuffer buffer, std::function<void()> finish) {
+  // results are read back through mapped memory
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite |
+                                vk::AccessFlagBits::eTransferWrite,
+                            vk::AccessFlagBits::eHostRead};
+  buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
+                         vk::PipelineStageFlagBits::eHost, {}, barrier,
+                         nullptr, nullptr);
+  vlkn->submitCompute(buffer, fence);
+  pendingBuffer = buffer;
+  onFinish = std::move(finish);
+}
+
+bool Raytracer::poll() {
+  if (pendingTask.valid()) {
+    if (pendingTask.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      return false;
+    }
+    // rethrows what the work threw
+    pendingTask.get();
+  } else if (pendingBuffer) {
+    if (vlkn->getDevice().getFenceStatus(fence) != vk::Result::eSuccess) {
+      return false;
+    }
+    vlkn->freeComputeCommands(pendingBuffer);
+    pendingBuffer = nullptr;
+  } else {
+    return true;
+  }
+  // finish may start a follow up launch, so it is moved out first
+  auto finish = std::move(onFinish);
+  onFinish = nullptr;
+  if (finish) {
+    finish();
+  }
+  return !busy();
+}
+
+void Raytracer::wait() {
+  while (busy()) {
+    if (pendingTask.valid()) {
+      pendingTask.wait();
+    } else if (vk::Result::eSuccess !=
+               vlkn->getDevice().waitForFences(fence, VK_TRUE, UINT64_MAX)) {
+      throw std::runtime_error("waited too long!");
+    }
+    poll();
+  }
+}
 
+void Raytracer::runAsync(std::function<void()> work,
+                         std::function<void()> finish) {
+  pendingTask = std::async(std::launch::async, std::move(work));
+  onFinish = std::move(finish);
+}
+
+void Raytracer::reseed(std::shared_ptr<State> state) {
+  // a new key gives streams that are independent of all earlier launches
+  if (!state->pinSeed) {
+    ++state->seed;
+  }
+  rtPipelineRays.consts.seed = state->seed;
+}
+
+void Raytracer::selectBackend(std::shared_ptr<State> state) {
+  // devices without the pipeline have ray queries, isDeviceSuitable
+  useRayQuery = (state->rayQuery || !hasRayTracingPipeline()) && cpRayQuery;
+}
+
+vk::PipelineStageFlags Raytracer::traceStage() const {
+  return useRayQuery ? vk::PipelineStageFlagBits::eComputeShader
+                     : vk::PipelineStageFlagBits::eRayTracingShaderKHR;
+}
+
+void Raytracer::trace(vk::CommandBuffer buffer, uint32_t nRays,
+                      uint32_t nEmitters) {
+  if (useRayQuery) {
+    // 256 rays of a row per workgroup, see src/shaders/rqtri.comp
+    rtPipelineRays.consts.width = nRays;
+    rtPipelineRays.consts.rows = nEmitters;
+    buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cpRayQuery->get());
+    buffer.pushConstants(cpRayQuery->getLayout(),
+                         vk::ShaderStageFlagBits::eCompute, 0,
+                         sizeof(RaytracingPipeline::RtConsts),
+                         &rtPipelineRays.consts);
+    ComputePipeline::dispatchRows(buffer, (nRays + 255) / 256, nEmitters);
+    return;
+  }
+  rtPipelineRays.bind(buffer);
 
   buffer.pushConstants(
       rtPipelineRays.getLayout(), vk::ShaderStageFlagBits::eRaygenKHR, 0,
@@ -292,25 +1077,272 @@ void Raytracer::traceRays(std::shared_ptr<State> state) {
                             rtPipelineRays.getLayout(), 0, 1,
                             &descriptor.getSets().front(), 0, nullptr);
   buffer.traceRaysKHR(rtPipelineRays.rgenRegion, rtPipelineRays.missRegion,
-                      rtPipelineRays.hitRegion, {}, state->nRays, 1, 1);
-
+                      rtPipelineRays.hitRegion, {}, nRays, nEmitters, 1);
+}
 
-  // add memory barrier
-  vk::MemoryBarrier barrier{};
-  barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
-  barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+void Raytracer::accumulate(vk::CommandBuffer buffer, vk::Buffer hits,
+                           uint32_t nRays) {
+  ReduceConsts consts = reduceConsts(nRays);
+  consts.hit = vlkn->getVma()->getDeviceAddress(hits);
+  consts.nRows = stream.nEmitters;
+  // sort the hits into the bins, one workgroup per 256 hits and row
+  buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cpSumOneTri.get());
+  buffer.pushConstants(cpSumOneTri.getLayout(),
+                       vk::ShaderStageFlagBits::eCompute, 0,
+                       sizeof(ReduceConsts), &consts);
+  ComputePipeline::dispatchRows(buffer, (nRays + 255) / 256,
+                                stream.nEmitters);
+}
 
-  buffer.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+void Raytracer::normalize(vk::CommandBuffer buffer, uint32_t nRows) {
+  // the bins are filled by the launch or by accumulate()
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite,
+                            vk::AccessFlagBits::eShaderRead};
+  buffer.pipelineBarrier(vlkn->traceStages(),
                          vk::PipelineStageFlagBits::eComputeShader, {}, barrier,
                          nullptr, nullptr);
-  buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cpSumOneTri.get());
-  buffer.dispatch(12, 1, 1);
 
-  vlkn->endSingleTimeCommands(buffer);
-  
-  vlkn->getGqueue().waitIdle();
-  vlkn->getDevice().waitIdle();
+  ReduceConsts consts = reduceConsts(0);
+  consts.nRows = nRows;
+  buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cpNormalizeBins.get());
+  buffer.pushConstants(cpNormalizeBins.getLayout(),
+                       vk::ShaderStageFlagBits::eCompute, 0,
+                       sizeof(ReduceConsts), &consts);
+  // one workgroup per row
+  ComputePipeline::dispatchRows(buffer, 1, nRows);
+}
+
+Raytracer::ReduceConsts Raytracer::reduceConsts(uint32_t nRays) {
+  return ReduceConsts{
+      rtPipelineRays.consts.hit,
+      rtPipelineRays.consts.energy,
+      vfBuffer ? vlkn->getVma()->getDeviceAddress(vfBuffer) : 0,
+      rtPipelineRays.consts.bins,
+      nTris,
+      nRays,
+      rtPipelineRays.consts.currTri,
+      rtPipelineRays.consts.flags,
+      listBuffer ? vlkn->getVma()->getDeviceAddress(listBuffer) : 0,
+      errorBuffer ? vlkn->getVma()->getDeviceAddress(errorBuffer) : 0,
+      0.f,
+      nTris};
+}
+
+void Raytracer::startProgressive(std::shared_ptr<State> state) {
+  wait();
+  reserveBinBuffer(nTris);
+  reserveVfBuffer();
+  reserveProgressiveBuffers();
+
+  // every emitter starts out active
+  uint32_t *pList = reinterpret_cast<uint32_t *>(listAllocInfo.pMappedData);
+  pList[0] = nTris;
+  for (uint32_t i = 0; i < nTris; ++i) {
+    pList[i + 1] = i;
+  }
+  vmaFlushAllocation(vlkn->getVma()->vma(), listAlloc, 0, VK_WHOLE_SIZE);
+
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+  clearBins(buffer);
+  submit(buffer);
 
+  samplesTraced = 0;
+  batchesTraced = 0;
+  reseed(state);
+  selectBackend(state);
+  state->raysTraced = 0;
+  state->nActive = nTris;
+  state->maxError = std::numeric_limits<float>::infinity();
+  state->progRunning = true;
+}
+
+void Raytracer::stepProgressive(std::shared_ptr<State> state) {
+  wait();
+  uint32_t nActive = state->nActive;
+  uint64_t remaining = state->rayBudget > state->raysTraced
+                           ? state->rayBudget - state->raysTraced
+                           : 0;
+  if (nActive == 0 || state->nRays == 0 || remaining < nActive) {
+    state->progRunning = false;
+    reduceMeshes(state);
+    return;
+  }
+  // the last batch spreads what is left of the budget evenly
+  uint32_t nRays =
+      static_cast<uint32_t>(std::min<uint64_t>(state->nRays, remaining / nActive));
+  // the batch is traced in chunks of at most CHUNK_HITS rays like
+  // streamChunks, so large batches stay within the dispatch limits
+  uint32_t chunk = static_cast<uint32_t>(std::min<uint64_t>(
+      {std::max<uint64_t>(CHUNK_HITS / nActive, 1), nRays,
+       maxLaunchWidth(nActive)}));
+
+  vk::CommandBuffer buffer = vlkn->beginComputeCommands();
+
+  rtPipelineRays.consts.currTri = static_cast<uint32_t>(state->currTri);
+  rtPipelineRays.consts.flags = RaytracingPipeline::TRACE_BATCH |
+                                RaytracingPipeline::TRACE_BINS |
+                                RaytracingPipeline::TRACE_LIST;
+  rtPipelineRays.consts.emitters = vlkn->getVma()->getDeviceAddress(listBuffer);
+  if (state->sobol) {
+    rtPipelineRays.consts.flags |= RaytracingPipeline::TRACE_SOBOL;
+  }
+  // all active emitters were traced in every batch so far. Every chunk
+  // continues the sequence and counts as a batch of its own, the rays of a
+  // chunk restart at id.x = 0
+  uint32_t nChunks = 0;
+  for (uint64_t traced = 0; traced < nRays; traced += chunk, ++nChunks) {
+    rtPipelineRays.consts.sampleOffset =
+        samplesTraced + static_cast<uint32_t>(traced);
+    rtPipelineRays.consts.batch = batchesTraced + nChunks;
+    trace(buffer,
+          static_cast<uint32_t>(std::min<uint64_t>(chunk, nRays - traced)),
+          nActive);
+  }
+  vfCurrent = true;
+  // bins are indexed by emitter, so all rows are normalised
+  normalize(buffer, nTris);
+  checkConvergence(buffer, state->tolerance);
+  // the error estimate is taken from the bins, not the corrected matrix
+  if (state->correct) {
+    correct(buffer, state);
+  }
+
+  // the offset is part of the recorded push constants
+  rtPipelineRays.consts.sampleOffset = 0;
+  rtPipelineRays.consts.batch = 0;
+  submit(buffer, [this, state, nRays, nActive, nChunks]() {
+    samplesTraced += nRays;
+    batchesTraced += nChunks;
+    state->raysTraced += static_cast<uint64_t>(nRays) * nActive;
+
+    vmaInvalidateAllocation(vlkn->getVma()->vma(), listAlloc, 0,
+                            VK_WHOLE_SIZE);
+    state->nActive =
+        reinterpret_cast<const uint32_t *>(listAllocInfo.pMappedData)[0];
+    std::vector<float> errors = getErrors();
+    state->maxError =
+        errors.empty() ? 0.f : *std::max_element(errors.begin(), errors.end());
+    if (state->nActive == 0) {
+      state->progRunning = false;
+    }
+    if (!state->progRunning) {
+      reduceMeshes(state);
+    }
+  });
+}
+
+void Raytracer::checkConvergence(vk::CommandBuffer buffer, float tolerance) {
+  // the launch read the list that is rebuilt now
+  vk::MemoryBarrier readBarrier{vk::AccessFlagBits::eShaderRead,
+                                vk::AccessFlagBits::eTransferWrite};
+  buffer.pipelineBarrier(traceStage(),
+                         vk::PipelineStageFlagBits::eTransfer, {}, readBarrier,
+                         nullptr, nullptr);
+  buffer.fillBuffer(listBuffer, 0, sizeof(uint32_t), 0);
+  vk::MemoryBarrier fillBarrier{vk::AccessFlagBits::eTransferWrite,
+                                vk::AccessFlagBits::eShaderRead |
+                                    vk::AccessFlagBits::eShaderWrite};
+  buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                         vk::PipelineStageFlagBits::eComputeShader, {},
+                         fillBarrier, nullptr, nullptr);
+
+  ReduceConsts consts = reduceConsts(0);
+  consts.tolerance = tolerance;
+  buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cpConvergence.get());
+  buffer.pushConstants(cpConvergence.getLayout(),
+                       vk::ShaderStageFlagBits::eCompute, 0,
+                       sizeof(ReduceConsts), &consts);
+  // one workgroup per row
+  ComputePipeline::dispatchRows(buffer, 1, consts.nRows);
+}
+
+void Raytracer::correct(vk::CommandBuffer buffer,
+                        std::shared_ptr<State> state) {
+  if (!targetBuffer) {
+    targetBuffer = vlkn->getVma()->createStorageBuffer(nTris * sizeof(float),
+                                                       targetAlloc);
+    scaleBuffer = vlkn->getVma()->createStorageBuffer(nTris * sizeof(float),
+                                                      scaleAlloc);
+  }
+  CorrectConsts consts{vlkn->getVma()->getDeviceAddress(vfBuffer),
+                       rtPipelineRays.consts.frames,
+                       vlkn->getVma()->getDeviceAddress(targetBuffer),
+                       vlkn->getVma()->getDeviceAddress(scaleBuffer),
+                       rtPipelineRays.consts.energy,
+                       nTris,
+                       CORRECT_TARGET,
+                       state->closed ? CORRECT_CLOSED : 0u,
+                       static_cast<uint32_t>(state->currTri)};
+
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite,
+                            vk::AccessFlagBits::eShaderRead |
+                                vk::AccessFlagBits::eShaderWrite};
+  auto pass = [&](uint32_t mode, uint32_t flags) {
+    consts.mode = mode;
+    consts.flags = flags;
+    buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                           vk::PipelineStageFlagBits::eComputeShader, {},
+                           barrier, nullptr, nullptr);
+    buffer.pushConstants(cpCorrect.getLayout(),
+                         vk::ShaderStageFlagBits::eCompute, 0,
+                         sizeof(CorrectConsts), &consts);
+    // one workgroup per row
+    ComputePipeline::dispatchRows(buffer, 1, nTris);
+  };
+
+  buffer.bindPipeline(vk::PipelineBindPoint::eCompute, cpCorrect.get());
+  uint32_t flags = consts.flags;
+  pass(CORRECT_TARGET, flags);
+  pass(CORRECT_SYMMETRIZE, flags);
+  uint32_t iterations = std::max(state->closureIterations, 1u);
+  for (uint32_t i = 0; i < iterations; ++i) {
+    pass(CORRECT_SCALE, flags);
+    pass(CORRECT_APPLY, i + 1 == iterations ? flags | CORRECT_LAST : flags);
+  }
+}
+
+std::vector<float> Raytracer::getErrors() {
+  std::vector<float> errors;
+  if (!errorBuffer) {
+    return errors;
+  }
+  errors.resize(nTris);
+  vmaInvalidateAllocation(vlkn->getVma()->vma(), errorAlloc, 0, VK_WHOLE_SIZE);
+  memcpy(errors.data(), errorAllocInfo.pMappedData,
+         errors.size() * sizeof(float));
+  return errors;
+}
+
+void Raytracer::clearBins(vk::CommandBuffer buffer) {
+  buffer.fillBuffer(binBuffer, 0, VK_WHOLE_SIZE, 0);
+
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eTransferWrite,
+                            vk::AccessFlagBits::eShaderRead |
+                                vk::AccessFlagBits::eShaderWrite};
+  buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                         vlkn->traceStages(), {}, barrier, nullptr, nullptr);
+}
+
+std::vector<float> Raytracer::getViewFactors() {
+  std::vector<float> vf;
+  if (!vfBuffer) {
+    return vf;
+  }
+  vf.resize(static_cast<size_t>(nTris) * nTris);
+  vmaInvalidateAllocation(vlkn->getVma()->vma(), vfAlloc, 0, VK_WHOLE_SIZE);
+  memcpy(vf.data(), vfAllocInfo.pMappedData, vf.size() * sizeof(float));
+  return vf;
+}
+
+std::vector<Raytracer::Bin> Raytracer::getBins() {
+  std::vector<Bin> bins;
+  if (!binBuffer) {
+    return bins;
+  }
+  bins.resize(static_cast<size_t>(binRows) * (nTris + 1));
+  vmaInvalidateAllocation(vlkn->getVma()->vma(), binAlloc, 0, VK_WHOLE_SIZE);
+  memcpy(bins.data(), binAllocInfo.pMappedData, bins.size() * sizeof(Bin));
+  return bins;
 }
 
 void Raytracer::updatePushConstantsPoints(GeometryHandler &geom) {
@@ -319,11 +1351,20 @@ void Raytracer::updatePushConstantsPoints(GeometryHandler &geom) {
   rtPipelinePoints.consts.out = vlkn->getVma()->getDeviceAddress(outBuffer);
 }
 
+void Raytracer::setAliasTable(GeometryHandler &geom) {
+  rtPipelineRays.consts.alias =
+      vlkn->getVma()->getDeviceAddress(geom.getAlias());
+}
+
 void Raytracer::updatePushConstantsRays(GeometryHandler &geom) {
   rtPipelineRays.consts.verts = vlkn->getVma()->getDeviceAddress(geom.getVert());
   rtPipelineRays.consts.idx = vlkn->getVma()->getDeviceAddress(geom.getIdx());
   rtPipelineRays.consts.ori = vlkn->getVma()->getDeviceAddress(oriBuffer);
   rtPipelineRays.consts.dir = vlkn->getVma()->getDeviceAddress(dirBuffer);
+  rtPipelineRays.consts.frames =
+      vlkn->getVma()->getDeviceAddress(geom.getFrames());
+  setAliasTable(geom);
+  rtPipelineRays.consts.nTris = nTris;
 }
 
 void Raytracer::createOutputBuffer() {
@@ -338,6 +1379,7 @@ void Raytracer::createOutputBuffer() {
                                   VMA_MEMORY_USAGE_AUTO,
                                   VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT};
 
+  shareWithRenderer(outBufferCreateInfo);
   outBuffer = vlkn->getVma()->createBuffer(outAlloc, outAllocInfo,
                                            outBufferCreateInfo, outInfo);
 
@@ -357,6 +1399,7 @@ void Raytracer::createOutputBufferRays(vk::DeviceSize hitBufferSize, vk::DeviceS
                                   VMA_MEMORY_USAGE_AUTO,
                                   VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT};
 
+  shareWithRenderer(oriBufferCreateInfo);
   oriBuffer = vlkn->getVma()->createBuffer(oriAlloc, oriAllocInfo,
                                            oriBufferCreateInfo, oriInfo);
   dirBuffer = vlkn->getVma()->createBuffer(dirAlloc, dirAllocInfo,
@@ -366,7 +1409,10 @@ void Raytracer::createOutputBufferRays(vk::DeviceSize hitBufferSize, vk::DeviceS
   oriBufferCreateInfo.setSize(hitBufferSize);
   hitBuffer = vlkn->getVma()->createBuffer(hitAlloc, hitAllocInfo,
                                            oriBufferCreateInfo, oriInfo);
+  // rows of the Gebhart factors are copied in on the device
   oriBufferCreateInfo.setSize(energyBufferSize);
+  oriBufferCreateInfo.setUsage(oriBufferCreateInfo.usage |
+                               vk::BufferUsageFlagBits::eTransferDst);
   energyBuffer = vlkn->getVma()->createBuffer(energyAlloc, energyAllocInfo,
                                               oriBufferCreateInfo, oriInfo);
   
@@ -375,6 +1421,143 @@ void Raytracer::createOutputBufferRays(vk::DeviceSize hitBufferSize, vk::DeviceS
   rtPipelineRays.consts.hit = vlkn->getVma()->getDeviceAddress(hitBuffer);
   rtPipelineRays.consts.energy = vlkn->getVma()->getDeviceAddress(energyBuffer);
 }
+
+void Raytracer::shareWithRenderer(vk::BufferCreateInfo &info) {
+  // written on the compute queue and drawn on the graphics queue
+  sharedFamilies = {vlkn->gQueueIndex(), vlkn->cQueueIndex()};
+  if (sharedFamilies[0] != sharedFamilies[1]) {
+    info.setSharingMode(vk::SharingMode::eConcurrent);
+    info.setQueueFamilyIndices(sharedFamilies);
+  }
+}
+
+vk::Buffer Raytracer::createMappedBuffer(vk::DeviceSize size,
+                                         VmaAllocation &alloc,
+                                         VmaAllocationInfo &allocInfo) {
+  vk::BufferCreateInfo createInfo{
+      {},
+      size,
+      vk::BufferUsageFlagBits::eStorageBuffer |
+          vk::BufferUsageFlagBits::eShaderDeviceAddress |
+          vk::BufferUsageFlagBits::eTransferDst};
+  VmaAllocationCreateInfo info{VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                                   VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                               VMA_MEMORY_USAGE_AUTO,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+  return vlkn->getVma()->createBuffer(alloc, allocInfo, createInfo, info);
+}
+
+vk::DeviceSize Raytracer::maxSparseHits() const {
+  // ViewFactorMatrix counts the hits in 32 bits and keeps a sorted copy in
+  // an allocation of the same size
+  auto properties = vlkn->getPhysDevice()
+                        .getProperties2<vk::PhysicalDeviceProperties2,
+                                        vk::PhysicalDeviceVulkan11Properties>();
+  vk::DeviceSize maxAlloc =
+      properties.get<vk::PhysicalDeviceVulkan11Properties>()
+          .maxMemoryAllocationSize;
+  return std::min<vk::DeviceSize>(std::numeric_limits<uint32_t>::max(),
+                                  maxAlloc / sizeof(HitRecord));
+}
+
+uint32_t Raytracer::maxLaunchWidth(uint32_t nRows) const {
+  uint64_t width = 0;
+  uint64_t height = std::numeric_limits<uint32_t>::max();
+  if (useRayQuery) {
+    // 256 rays per workgroup along x, dispatchRows spreads the rows over y
+    // and z
+    auto limits = vlkn->getPhysDevice().getProperties().limits;
+    width = uint64_t{limits.maxComputeWorkGroupCount[0]} * 256;
+  } else {
+    auto properties =
+        vlkn->getPhysDevice()
+            .getProperties2<vk::PhysicalDeviceProperties2,
+                            vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
+    const vk::PhysicalDeviceLimits &limits =
+        properties.get<vk::PhysicalDeviceProperties2>().properties.limits;
+    uint64_t invocations =
+        properties.get<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>()
+            .maxRayDispatchInvocationCount;
+    // the launch size is bounded like a dispatch of each dimension
+    width = std::min<uint64_t>(uint64_t{limits.maxComputeWorkGroupCount[0]} *
+                                   limits.maxComputeWorkGroupSize[0],
+                               invocations / std::max(nRows, 1u));
+    height = uint64_t{limits.maxComputeWorkGroupCount[1]} *
+             limits.maxComputeWorkGroupSize[1];
+  }
+  if (width == 0 || nRows > height) {
+    throw std::runtime_error("launch of " + std::to_string(nRows) +
+                             " rows exceeds the ray dispatch limits of the "
+                             "device");
+  }
+  return static_cast<uint32_t>(
+      std::min<uint64_t>(width, std::numeric_limits<uint32_t>::max()));
+}
+
+void Raytracer::reserveHitBuffer(vk::DeviceSize nHits) {
+  if (nHits <= hitCapacity) {
+    return;
+  }
+  // the old buffer might still be in use
+  vlkn->getDevice().waitIdle();
+  vlkn->getVma()->destroyBuffer(hitAlloc, hitBuffer);
+  // hits are only consumed on the device
+  hitBuffer =
+      vlkn->getVma()->createStorageBuffer(nHits * sizeof(HitRecord), hitAlloc);
+  hitCapacity = nHits;
+  rtPipelineRays.consts.hit = vlkn->getVma()->getDeviceAddress(hitBuffer);
+}
+
+void Raytracer::reserveStreamBuffers(vk::DeviceSize nHits) {
+  if (nHits <= streamCapacity) {
+    return;
+  }
+  for (uint32_t i = 0; i < 2; ++i) {
+    if (streamCapacity != 0) {
+      vlkn->getVma()->destroyBuffer(streamAllocs[i], streamBuffers[i]);
+    }
+    streamBuffers[i] = vlkn->getVma()->createStorageBuffer(
+        nHits * sizeof(HitRecord), streamAllocs[i]);
+  }
+  streamCapacity = nHits;
+}
+
+void Raytracer::reserveVfBuffer() {
+  if (vfBuffer) {
+    return;
+  }
+  vfBuffer = createMappedBuffer(static_cast<vk::DeviceSize>(nTris) * nTris *
+                                    sizeof(float),
+                                vfAlloc, vfAllocInfo);
+}
+
+void Raytracer::reserveProgressiveBuffers() {
+  if (listBuffer) {
+    return;
+  }
+  // count followed by up to nTris emitters
+  listBuffer = createMappedBuffer(
+      (static_cast<vk::DeviceSize>(nTris) + 1) * sizeof(uint32_t), listAlloc,
+      listAllocInfo);
+  errorBuffer = createMappedBuffer(nTris * sizeof(float), errorAlloc,
+                                   errorAllocInfo);
+}
+
+void Raytracer::reserveBinBuffer(uint32_t nRows) {
+  if (nRows <= binRows) {
+    return;
+  }
+  if (binBuffer) {
+    vlkn->getDevice().waitIdle();
+    vlkn->getVma()->destroyBuffer(binAlloc, binBuffer);
+  }
+  // nTris receivers + one miss bin per row
+  binBuffer = createMappedBuffer(static_cast<vk::DeviceSize>(nRows) *
+                                     (nTris + 1) * sizeof(Bin),
+                                 binAlloc, binAllocInfo);
+  binRows = nRows;
+  rtPipelineRays.consts.bins = vlkn->getVma()->getDeviceAddress(binBuffer);
+}
   
 // namespace rn
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
+#include <array>
+#include <functional>
+#include <future>
 #include <memory>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 
+#include "ascache.hpp"
 #include "descriptors.hpp"
 #include "geometryloader/geometry.hpp"
 #include "pipeline.hpp"
@@ -10,6 +14,8 @@
 #include <glm/fwd.hpp>
 #include <vulkan/vulkan_handles.hpp>
 #include "state.hpp"
+#include "gebhart.hpp"
+#include "viewfactor.hpp"
 
 
 namespace rn {
@@ -17,44 +23,271 @@ class Raytracer {
 public:
   Raytracer(std::shared_ptr<VulkanHandler> vlkn_, GeometryHandler &geom);
   ~Raytracer();
+  // fast trace structures are compacted after the build, fast build ones
+  // suit geometry that is rebuilt often
+  enum class BuildMode { eFastTrace, eFastBuild };
+  void rebuildAccelerationStructures(GeometryHandler &geom, BuildMode mode);
+  // uploads the meshes moved with GeometryHandler::setMeshTransform or
+  // setMeshVertices and refits the structures in place instead of
+  // rebuilding them. refits keep the topology of the last build, rebuild
+  // after large deformations
+  void refitAccelerationStructures(GeometryHandler &geom);
+  // bytes held by the bottom level structures
+  vk::DeviceSize getBlasSize() const { return blasSize; };
   RaytracingPipeline::RtConsts &getRtConstsPoints() {
     return rtPipelinePoints.consts;
   };
   RaytracingPipeline::RtConsts &getRtConstsRays() {
     return rtPipelineRays.consts;
   };
+  // launches are submitted to the compute queue and return right away,
+  // starting a new one waits for the previous launch to finish
   void traceOri(std::shared_ptr<State> state);
   void traceRays(std::shared_ptr<State> state);
+  // traces state->nRays rays from every triangle in a single launch, or
+  // state->globalRays rays in total with state->global. sparse launches
+  // keep every hit on the device, throws if they do not fit
+  void traceAll(std::shared_ptr<State> state);
+  // finishes the launch in flight once the device is done with it, state is
+  // updated from here. returns false while a launch is still running
+  bool poll();
+  bool busy() const { return pendingBuffer || pendingTask.valid(); };
+  // blocks until the launch in flight has finished
+  void wait();
+  bool hasRayQuery() const { return static_cast<bool>(cpRayQuery); };
+  // without it every launch runs on ray queries and traceOri does nothing
+  bool hasRayTracingPipeline() const { return vlkn->hasRayTracingPipeline(); };
+  // picks up a rebuilt GeometryHandler::aliasTable for global launches
+  void setAliasTable(GeometryHandler &geom);
+  // progressive mode, resets the running sums and activates all emitters
+  void startProgressive(std::shared_ptr<State> state);
+  // adds one batch of state->nRays rays for every emitter that is still
+  // above state->tolerance, clears state->progRunning once all converged
+  // or the budget is used up
+  void stepProgressive(std::shared_ptr<State> state);
+  // estimated error per emitter of the last progressive step
+  std::vector<float> getErrors();
+  // row major nTris x nTris matrix of the last traceAll, row = emitter
+  std::vector<float> getViewFactors();
+  // sparse matrix of the last traceAll with state->sparse set
+  const ViewFactorMatrix &getViewFactorMatrix() const { return vfMatrix; };
+  // row major nMeshes x nMeshes area weighted view factors of the meshes,
+  // reduced on the device from the dense triangle view factors, blocks
+  // until the reduction is done
+  std::vector<float> getMeshViewFactors();
+  uint32_t getMeshCount() const { return nMeshes; };
+  // row major nTris x nTris Gebhart factors of the last sparse traceAll
+  // with state->gebhart set
+  std::vector<float> getGebhartFactors();
 
+  // streamed launches never hold more than two chunks of hits, a chunk
+  // has at most CHUNK_HITS of them (64 MiB)
+  static constexpr vk::DeviceSize CHUNK_HITS = 1 << 22;
+  static constexpr uint32_t CHUNKS_PER_SUBMIT = 16;
+
+  // tri: emitter in the upper, receiver in the lower 32 bits
   struct HitRecord {
     uint64_t tri;
     float energy;
   };
-  
+
+  // energy is stored as fixed point number, scaled by BIN_SCALE
+  struct Bin {
+    uint64_t energy;
+    uint64_t count;
+  };
+  static constexpr double BIN_SCALE = 1048576.0;
+  // nTris x (nTris + 1) bins of the last binned traceAll, the last column
+  // holds the rays that escaped to space
+  std::vector<Bin> getBins();
+
+  // push constants of the reduction passes, see src/shaders/consts.glsl
+  struct ReduceConsts {
+    vk::DeviceAddress hit;
+    vk::DeviceAddress energy;
+    vk::DeviceAddress vf;
+    vk::DeviceAddress bins;
+    uint32_t nTris;
+    uint32_t nRays;
+    uint32_t currTri;
+    uint32_t flags;
+    vk::DeviceAddress list;
+    vk::DeviceAddress errors;
+    float tolerance;
+    // workgroup rows of the dispatch, see ComputePipeline::dispatchRows
+    uint32_t nRows;
+  };
+
+  // push constants of the reciprocity/closure pass, see src/shaders/consts.glsl
+  struct CorrectConsts {
+    vk::DeviceAddress vf;
+    vk::DeviceAddress frames;
+    vk::DeviceAddress target;
+    vk::DeviceAddress scale;
+    vk::DeviceAddress energy;
+    uint32_t nTris;
+    uint32_t mode;
+    uint32_t flags;
+    uint32_t currTri;
+  };
+  // push constants of src/shaders/meshReduce.comp
+  struct MeshConsts {
+    vk::DeviceAddress vf;
+    vk::DeviceAddress frames;
+    vk::DeviceAddress offsets;
+    vk::DeviceAddress tmp;
+    vk::DeviceAddress mesh;
+    uint32_t nTris;
+    uint32_t nMeshes;
+    uint32_t mode;
+  };
+  static constexpr uint32_t MESH_RECEIVERS = 0;
+  static constexpr uint32_t MESH_EMITTERS = 1;
+
+  static constexpr uint32_t CORRECT_TARGET = 0;
+  static constexpr uint32_t CORRECT_SYMMETRIZE = 1;
+  static constexpr uint32_t CORRECT_SCALE = 2;
+  static constexpr uint32_t CORRECT_APPLY = 3;
+  static constexpr uint32_t CORRECT_CLOSED = 1u << 0;
+  static constexpr uint32_t CORRECT_LAST = 1u << 1;
+
 private:
   std::shared_ptr<VulkanHandler> vlkn;
+  // reads the blases from the cache, or builds and stores them
   void buildBlas(GeometryHandler &geom);
-  void buildTlas();
+  void buildBlas(
+      std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> &buildInfos,
+      vk::DeviceAddress scratchAddress, bool compact);
+  // false if the cache has nothing the device can use
+  bool loadBlas(uint64_t key);
+  void storeBlas(uint64_t key);
+  vk::Buffer createSerializationBuffer(vk::DeviceSize size,
+                                       VmaAllocation &alloc);
+  void buildTlas(GeometryHandler &geom);
+  // replaces the blases by copies of their compacted size, queryPool holds
+  // the sizes of the last build
+  void compactBlas(vk::QueryPool queryPool);
+  void destroyBlas();
+  void destroyTlas();
+  // fills instances from GeometryHandler::meshInstances
+  void updateInstances(GeometryHandler &geom);
+  vk::Buffer createScratchBuffer(vk::DeviceSize size, VmaAllocation &alloc);
+  vk::AccelerationStructureKHR
+  createAccelerationStructure(vk::DeviceSize size,
+                              vk::AccelerationStructureTypeKHR type,
+                              vk::Buffer &buffer, VmaAllocation &alloc);
   void buildDescriptorSet();
   void updatePushConstantsPoints(GeometryHandler &geom);
   void updatePushConstantsRays(GeometryHandler &geom);
   void createOutputBuffer();
   void createOutputBufferRays(vk::DeviceSize hitBufferSize, vk::DeviceSize energyBufferSize);
+  void shareWithRenderer(vk::BufferCreateInfo &info);
+  vk::Buffer createMappedBuffer(vk::DeviceSize size, VmaAllocation &alloc,
+                                VmaAllocationInfo &allocInfo);
+  void reserveHitBuffer(vk::DeviceSize nHits);
+  // largest sparse launch, in hit records
+  vk::DeviceSize maxSparseHits() const;
+  // rays per row of a single trace of nRows rows on the current backend,
+  // bounded by maxRayDispatchInvocationCount and the compute workgroup
+  // limits. Throws if not even one ray per row fits
+  uint32_t maxLaunchWidth(uint32_t nRows) const;
+  void reserveStreamBuffers(vk::DeviceSize nHits);
+  void reserveVfBuffer();
+  void reserveBinBuffer(uint32_t nRows);
+  void clearBins(vk::CommandBuffer buffer);
+  // moves the seed of the random streams on for a new launch
+  void reseed(std::shared_ptr<State> state);
+  // ray tracing pipeline or ray queries from a compute shader, from
+  // state->rayQuery
+  void selectBackend(std::shared_ptr<State> state);
+  // stage the rays of the selected backend are traced in
+  vk::PipelineStageFlags traceStage() const;
+  // ends buffer and submits it, finish runs in poll() once it is done
+  void submit(vk::CommandBuffer buffer, std::function<void()> finish = {});
+  void trace(vk::CommandBuffer buffer, uint32_t nRays, uint32_t nEmitters);
+  // traces nRays rays for each of the nEmitters launch rows in chunks, the
+  // nRows rows of bins are normalised after the last one
+  void startStream(std::shared_ptr<State> state, uint64_t nRays,
+                   uint32_t nEmitters, uint32_t nRows, bool correct,
+                   std::function<void()> finish);
+  // records the next CHUNKS_PER_SUBMIT chunks of the stream and submits
+  void streamChunks(vk::CommandBuffer buffer);
+  // sums the hits of one chunk up into the bins
+  void accumulate(vk::CommandBuffer buffer, vk::Buffer hits, uint32_t nRays);
+  void normalize(vk::CommandBuffer buffer, uint32_t nRows);
+  ReduceConsts reduceConsts(uint32_t nRays);
+  void reserveProgressiveBuffers();
+  void checkConvergence(vk::CommandBuffer buffer, float tolerance);
+  // reciprocity and closure of the dense matrix, after reduce()
+  void correct(vk::CommandBuffer buffer, std::shared_ptr<State> state);
+  void showRow(const ViewFactorMatrix &matrix, uint32_t row);
+  void showRow(const std::vector<float> &values);
+  // the follow up work of a launch is chained as further submissions, the
+  // finish callbacks run on the thread that polls
+  void solveGebhart(std::shared_ptr<State> state);
+  void stepGebhart(uint32_t row);
+  // state->meshViewFactors once the submitted reduction is done
+  void reduceMeshes(std::shared_ptr<State> state);
+  bool recordMeshReduce(vk::CommandBuffer buffer);
+  std::vector<float> readMeshViewFactors();
+  // host work that poll() waits for like for a submission, then finish runs
+  void runAsync(std::function<void()> work, std::function<void()> finish);
 
-  vk::AccelerationStructureKHR blas;
+  uint32_t nTris = 0;
+  uint32_t nMeshes = 0;
+  // vfBuffer holds the result of the last launch
+  bool vfCurrent = false;
+  vk::DeviceAddress meshOffsetAddress = 0;
+  std::vector<float> emissivity;
+  vk::DeviceAddress emissivityAddress = 0;
+  // result of the cpu solver, the gpu one keeps it on the device
+  std::vector<float> gebhartFactors;
+
+  BuildMode buildMode = BuildMode::eFastTrace;
+  vk::DeviceSize blasSize = 0;
+  struct Blas {
+    vk::AccelerationStructureKHR handle;
+    vk::Buffer buffer;
+    VmaAllocation alloc;
+    vk::DeviceSize size;
+    // build input, kept for the refits
+    vk::AccelerationStructureGeometryKHR geometry;
+    vk::AccelerationStructureBuildRangeInfoKHR range;
+  };
+  // one per GeometryHandler::uniqueMeshes
+  std::vector<Blas> blases;
   vk::AccelerationStructureKHR tlas;
-  vk::Buffer blasBuffer;
-  VmaAllocation blasAlloc;
+  vk::AccelerationStructureGeometryKHR tlasGeometry;
+  // refits have to use the flags of the build
+  vk::BuildAccelerationStructureFlagsKHR blasFlags;
+  vk::BuildAccelerationStructureFlagsKHR tlasFlags;
+  // scratch memory of the last build, sized for refits as well
+  vk::Buffer blasScratch;
+  VmaAllocation blasScratchAlloc;
+  vk::Buffer tlasScratch;
+  VmaAllocation tlasScratchAlloc;
   vk::Buffer tlasBuffer;
   VmaAllocation tlasAlloc;
   vk::Buffer instanceBuffer;
   VmaAllocation instanceAlloc;
+  // refits rewrite the instances through it until the next rebuild
+  vk::Buffer instanceStaging;
+  VmaAllocation instanceStagingAlloc;
+  VmaAllocationInfo instanceStagingInfo;
 
   vk::Buffer outBuffer;
   vk::Buffer oriBuffer;
   vk::Buffer dirBuffer;
   vk::Buffer hitBuffer;
   vk::Buffer energyBuffer;
+  vk::Buffer vfBuffer;
+  vk::Buffer binBuffer;
+  vk::Buffer listBuffer;
+  vk::Buffer errorBuffer;
+  vk::Buffer targetBuffer;
+  vk::Buffer scaleBuffer;
+  vk::Buffer meshTmpBuffer;
+  vk::Buffer meshBuffer;
   VmaAllocation outAlloc;
   VmaAllocationInfo outAllocInfo;
   VmaAllocation oriAlloc;
@@ -65,19 +298,72 @@ private:
   VmaAllocationInfo hitAllocInfo;
   VmaAllocation energyAlloc;
   VmaAllocationInfo energyAllocInfo;
+  VmaAllocation vfAlloc;
+  VmaAllocationInfo vfAllocInfo;
+  VmaAllocation binAlloc;
+  VmaAllocationInfo binAllocInfo;
+  VmaAllocation listAlloc;
+  VmaAllocationInfo listAllocInfo;
+  VmaAllocation errorAlloc;
+  VmaAllocationInfo errorAllocInfo;
+  VmaAllocation targetAlloc;
+  VmaAllocation scaleAlloc;
+  VmaAllocation meshTmpAlloc;
+  VmaAllocation meshAlloc;
+  VmaAllocationInfo meshAllocInfo;
+  vk::DeviceSize hitCapacity = 0;
+  // double buffered hits of streamed launches
+  std::array<vk::Buffer, 2> streamBuffers;
+  std::array<VmaAllocation, 2> streamAllocs;
+  vk::DeviceSize streamCapacity = 0;
+  struct Stream {
+    std::shared_ptr<State> state;
+    uint64_t nRays;
+    uint64_t traced;
+    uint32_t nEmitters;
+    uint32_t nRows;
+    // rays per emitter and chunk
+    uint32_t chunk;
+    bool correct;
+    std::function<void()> finish;
+  };
+  Stream stream;
+  uint32_t binRows = 0;
+  // rays per emitter of the running progressive launch
+  uint32_t samplesTraced = 0;
+  uint32_t batchesTraced = 0;
   std::vector<glm::vec4> outData{1000};
+  std::array<uint32_t, 2> sharedFamilies;
 
-  vk::AccelerationStructureInstanceKHR instance;
+  // one per GeometryHandler::meshInstances
+  std::vector<vk::AccelerationStructureInstanceKHR> instances;
   TraceDescriptors descriptor;
   vk::DescriptorSetLayout layout;
   vk::DescriptorPool pool;
   vk::DescriptorSet set;
 
+  // signalled once the launch in flight has finished
   vk::Fence fence;
+  vk::CommandBuffer pendingBuffer;
+  // host work in flight instead of pendingBuffer, see runAsync
+  std::future<void> pendingTask;
+  std::function<void()> onFinish;
 
   RaytracingPipeline rtPipelinePoints;
   RaytracingPipeline rtPipelineRays;
   ComputePipeline cpSumOneTri;
+  ComputePipeline cpNormalizeBins;
+  ComputePipeline cpConvergence;
+  ComputePipeline cpCorrect;
+  ComputePipeline cpMeshReduce;
+  // only if the device has VK_KHR_ray_query
+  std::unique_ptr<ComputePipeline> cpRayQuery;
+  bool useRayQuery = false;
+  ViewFactorMatrix vfMatrix;
+  GebhartSolver gebhart;
+  AsCache asCache;
+  // device addresses of serialized structures have to be aligned to this
+  static constexpr vk::DeviceSize SERIALIZE_ALIGNMENT = 256;
   };
 
 } // namespace rn
@@ -0,0 +1,313 @@
+#include "viewfactor.hpp"
+#include "pipeline.hpp"
+#include "vknhandler.hpp"
+#include "vma.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_enums.hpp>
+
+namespace rn {
+namespace {
+// size of Raytracer::HitRecord
+constexpr vk::DeviceSize HIT_SIZE = 16;
+// items per workgroup and digit values per pass, see src/shaders/csr.glsl
+constexpr uint32_t TILE = 256;
+constexpr uint32_t RADIX = 16;
+constexpr uint32_t RADIX_BITS = 4;
+constexpr uint32_t MAX_GROUPS = 65535;
+// items per workgroup of the hierarchical scan, SCAN_BLOCK of csr.glsl
+constexpr uint32_t SCAN_BLOCK = TILE * 16;
+
+// bits needed to store all values up to and including n
+uint32_t bitsFor(uint32_t n) {
+  uint32_t bits = 0;
+  while (bits < 32 && (n >> bits) != 0) {
+    ++bits;
+  }
+  return bits;
+}
+
+// block sums of every level of a scan of n items, each with its total
+vk::DeviceSize scanScratch(vk::DeviceSize n) {
+  vk::DeviceSize size = 0;
+  while (n > SCAN_BLOCK) {
+    n = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    size += n + 1;
+  }
+  return std::max<vk::DeviceSize>(size, 1) * sizeof(uint32_t);
+}
+} // namespace
+
+ViewFactorMatrix::ViewFactorMatrix(std::shared_ptr<VulkanHandler> vlkn_)
+    : vlkn(vlkn_),
+      cpRadixCount(vlkn, std::string("spv/radixCount.comp.spv"),
+                   sizeof(CsrConsts)),
+      cpRadixScatter(vlkn, std::string("spv/radixScatter.comp.spv"),
+                     sizeof(CsrConsts)),
+      cpScan(vlkn, std::string("spv/scan.comp.spv"), sizeof(CsrConsts)),
+      cpScanReduce(vlkn, std::string("spv/scanReduce.comp.spv"),
+                   sizeof(CsrConsts)),
+      cpScanDown(vlkn, std::string("spv/scanDown.comp.spv"),
+                 sizeof(CsrConsts)),
+      cpHeads(vlkn, std::string("spv/csrHeads.comp.spv"), sizeof(CsrConsts)),
+      cpValues(vlkn, std::string("spv/csrValues.comp.spv"),
+               sizeof(CsrConsts)),
+      cpFinalize(vlkn, std::string("spv/csrFinalize.comp.spv"),
+                 sizeof(CsrConsts)) {}
+
+ViewFactorMatrix::~ViewFactorMatrix() {
+  if (hitCapacity != 0) {
+    vlkn->getVma()->destroyBuffer(tmpAlloc, tmpBuffer);
+    vlkn->getVma()->destroyBuffer(histAlloc, histBuffer);
+    vlkn->getVma()->destroyBuffer(headAlloc, headBuffer);
+    vlkn->getVma()->destroyBuffer(sumAlloc, sumBuffer);
+    vlkn->getVma()->destroyBuffer(colAlloc, colBuffer);
+    vlkn->getVma()->destroyBuffer(valAlloc, valBuffer);
+  }
+  if (rowCapacity != 0) {
+    vlkn->getVma()->destroyBuffer(rowAlloc, rowBuffer);
+    vlkn->getVma()->destroyBuffer(totalAlloc, totalBuffer);
+  }
+  if (scanCapacity != 0) {
+    vlkn->getVma()->destroyBuffer(scanAlloc, scanBuffer);
+  }
+}
+
+void ViewFactorMatrix::reserve(uint32_t nHits, uint32_t nRows_) {
+  auto vma = vlkn->getVma();
+  if (nHits > hitCapacity) {
+    // the old buffers might still be in use
+    vlkn->getDevice().waitIdle();
+    if (hitCapacity != 0) {
+      vma->destroyBuffer(tmpAlloc, tmpBuffer);
+      vma->destroyBuffer(histAlloc, histBuffer);
+      vma->destroyBuffer(headAlloc, headBuffer);
+      vma->destroyBuffer(sumAlloc, sumBuffer);
+      vma->destroyBuffer(colAlloc, colBuffer);
+      vma->destroyBuffer(valAlloc, valBuffer);
+    }
+    vk::DeviceSize n = nHits;
+    vk::DeviceSize nGroups = (n + TILE - 1) / TILE;
+    tmpBuffer = vma->createStorageBuffer(n * HIT_SIZE, tmpAlloc);
+    // scans write their total behind the last element
+    histBuffer = vma->createStorageBuffer(
+        (RADIX * nGroups + 1) * sizeof(uint32_t), histAlloc);
+    headBuffer = vma->createStorageBuffer((n + 1) * sizeof(uint32_t), headAlloc);
+    // there are at most as many nonzeros as hits
+    sumBuffer = vma->createStorageBuffer(n * sizeof(uint64_t), sumAlloc);
+    colBuffer = vma->createStorageBuffer(n * sizeof(uint32_t), colAlloc);
+    valBuffer = vma->createStorageBuffer(n * sizeof(float), valAlloc);
+    hitCapacity = nHits;
+  }
+  if (nRows_ > rowCapacity) {
+    vlkn->getDevice().waitIdle();
+    if (rowCapacity != 0) {
+      vma->destroyBuffer(rowAlloc, rowBuffer);
+      vma->destroyBuffer(totalAlloc, totalBuffer);
+    }
+    rowBuffer = vma->createStorageBuffer(
+        (static_cast<vk::DeviceSize>(nRows_) + 1) * sizeof(uint32_t),
+        rowAlloc);
+    totalBuffer = vma->createStorageBuffer(
+        static_cast<vk::DeviceSize>(nRows_) * sizeof(uint64_t), totalAlloc);
+    rowCapacity = nRows_;
+  }
+  // the radix histograms, the run heads and the row counts are scanned
+  vk::DeviceSize nGroups = (vk::DeviceSize{hitCapacity} + TILE - 1) / TILE;
+  vk::DeviceSize nScan =
+      std::max<vk::DeviceSize>({RADIX * nGroups, hitCapacity, rowCapacity});
+  if (nScan > scanCapacity) {
+    vlkn->getDevice().waitIdle();
+    if (scanCapacity != 0) {
+      vma->destroyBuffer(scanAlloc, scanBuffer);
+    }
+    scanBuffer = vma->createStorageBuffer(scanScratch(nScan), scanAlloc);
+    scanCapacity = nScan;
+  }
+}
+
+void ViewFactorMatrix::build(vk::CommandBuffer buffer, vk::Buffer hits,
+                             uint32_t nHits, uint32_t nRows_,
+                             uint32_t nCols_) {
+  nRows = nRows_;
+  nCols = nCols_;
+  if (nRows == 0) {
+    return;
+  }
+  reserve(nHits, nRows);
+  auto vma = vlkn->getVma();
+  vk::MemoryBarrier transfer{vk::AccessFlagBits::eShaderWrite |
+                                 vk::AccessFlagBits::eTransferWrite,
+                             vk::AccessFlagBits::eTransferRead |
+                                 vk::AccessFlagBits::eShaderRead};
+  if (nHits == 0) {
+    // all rows empty, the offsets of the previous build must not be read
+    buffer.fillBuffer(rowBuffer, 0, VK_WHOLE_SIZE, 0);
+    buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eTransfer |
+                               vk::PipelineStageFlagBits::eComputeShader,
+                           {}, transfer, nullptr, nullptr);
+    return;
+  }
+  uint32_t nGroups = (nHits + TILE - 1) / TILE;
+
+  CsrConsts consts{};
+  consts.hist = vma->getDeviceAddress(histBuffer);
+  consts.rows = vma->getDeviceAddress(rowBuffer);
+  consts.cols = vma->getDeviceAddress(colBuffer);
+  consts.sums = vma->getDeviceAddress(sumBuffer);
+  consts.vals = vma->getDeviceAddress(valBuffer);
+  consts.totals = vma->getDeviceAddress(totalBuffer);
+  vk::DeviceAddress scratch = vma->getDeviceAddress(scanBuffer);
+  consts.nItems = nHits;
+  consts.nRows = nRows;
+  consts.nCols = nCols;
+  consts.nGroups = nGroups;
+  // misses are sorted as receiver nCols
+  consts.receiverBits = bitsFor(nCols);
+
+  // the previous pass might still write the hits
+  barrier(buffer, vlkn->traceStages());
+
+  // lsd radix sort over the packed (emitter, receiver) keys, ping pong
+  // between the hit and the temporary buffer. src is the sorted copy
+  // afterwards, the temporary buffer after an odd number of passes
+  vk::DeviceAddress src = vma->getDeviceAddress(hits);
+  vk::DeviceAddress dst = vma->getDeviceAddress(tmpBuffer);
+  uint32_t keyBits = consts.receiverBits + bitsFor(nRows - 1);
+  for (uint32_t shift = 0; shift < keyBits; shift += RADIX_BITS) {
+    consts.src = src;
+    consts.dst = dst;
+    consts.shift = shift;
+    dispatch(buffer, cpRadixCount, consts, nGroups);
+    barrier(buffer);
+
+    scan(buffer, consts, consts.hist, RADIX * nGroups, scratch);
+
+    dispatch(buffer, cpRadixScatter, consts, nGroups);
+    barrier(buffer);
+    std::swap(src, dst);
+  }
+  consts.src = src;
+
+  // row counts and totals are accumulated, nonzero sums as well
+  buffer.fillBuffer(rowBuffer, 0, VK_WHOLE_SIZE, 0);
+  buffer.fillBuffer(totalBuffer, 0, VK_WHOLE_SIZE, 0);
+  buffer.fillBuffer(sumBuffer, 0, VK_WHOLE_SIZE, 0);
+  barrier(buffer, vk::PipelineStageFlagBits::eTransfer);
+
+  // flag the first hit of every run, heads uses the hist address
+  consts.hist = vma->getDeviceAddress(headBuffer);
+  dispatch(buffer, cpHeads, consts, nGroups);
+  barrier(buffer);
+
+  // run index of every head and row offsets, one after the other as they
+  // share the scratch buffer
+  scan(buffer, consts, consts.hist, nHits, scratch);
+  scan(buffer, consts, consts.rows, nRows, scratch);
+
+  dispatch(buffer, cpValues, consts, nGroups);
+  barrier(buffer);
+
+  dispatch(buffer, cpFinalize, consts, (nRows + TILE - 1) / TILE);
+
+  buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                         vk::PipelineStageFlagBits::eTransfer, {}, transfer,
+                         nullptr, nullptr);
+}
+
+void ViewFactorMatrix::download() {
+  rowOffsets.clear();
+  columns.clear();
+  values.clear();
+  if (rowCapacity == 0 || nRows == 0) {
+    return;
+  }
+  auto vma = vlkn->getVma();
+  rowOffsets.resize(static_cast<size_t>(nRows) + 1);
+  vma->downloadBuffer(rowBuffer, rowOffsets.data(),
+                      rowOffsets.size() * sizeof(uint32_t));
+
+  // only the nonzeros are fetched
+  columns.resize(rowOffsets.back());
+  values.resize(rowOffsets.back());
+  if (columns.empty()) {
+    return;
+  }
+  vma->downloadBuffer(colBuffer, columns.data(),
+                      columns.size() * sizeof(uint32_t));
+  vma->downloadBuffer(valBuffer, values.data(), values.size() * sizeof(float));
+}
+
+float ViewFactorMatrix::at(uint32_t row, uint32_t col) const {
+  if (row >= nRows || rowOffsets.empty()) {
+    return 0.f;
+  }
+  // columns are sorted within every row
+  auto begin = columns.begin() + rowOffsets[row];
+  auto end = columns.begin() + rowOffsets[row + 1];
+  auto it = std::lower_bound(begin, end, col);
+  if (it == end || *it != col) {
+    return 0.f;
+  }
+  return values[it - columns.begin()];
+}
+
+vk::DeviceAddress ViewFactorMatrix::deviceRowOffsets() const {
+  return rowCapacity == 0 ? 0 : vlkn->getVma()->getDeviceAddress(rowBuffer);
+}
+
+vk::DeviceAddress ViewFactorMatrix::deviceColumns() const {
+  return hitCapacity == 0 ? 0 : vlkn->getVma()->getDeviceAddress(colBuffer);
+}
+
+vk::DeviceAddress ViewFactorMatrix::deviceValues() const {
+  return hitCapacity == 0 ? 0 : vlkn->getVma()->getDeviceAddress(valBuffer);
+}
+
+void ViewFactorMatrix::dispatch(vk::CommandBuffer buffer,
+                                ComputePipeline &pipeline,
+                                const CsrConsts &consts, uint32_t nGroups) {
+  buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.get());
+  buffer.pushConstants(pipeline.getLayout(), vk::ShaderStageFlagBits::eCompute,
+                       0, sizeof(CsrConsts), &consts);
+  // more than 65535 workgroups are split along y, see groupIndex()
+  uint32_t x = std::min(nGroups, MAX_GROUPS);
+  buffer.dispatch(x, (nGroups + x - 1) / x, 1);
+}
+
+void ViewFactorMatrix::scan(vk::CommandBuffer buffer, CsrConsts consts,
+                            vk::DeviceAddress items, uint32_t nItems,
+                            vk::DeviceAddress scratch) {
+  consts.hist = items;
+  consts.nItems = nItems;
+  if (nItems <= SCAN_BLOCK) {
+    dispatch(buffer, cpScan, consts, 1);
+    barrier(buffer);
+    return;
+  }
+  uint32_t nBlocks = (nItems + SCAN_BLOCK - 1) / SCAN_BLOCK;
+  consts.blocks = scratch;
+  consts.nGroups = nBlocks;
+  dispatch(buffer, cpScanReduce, consts, nBlocks);
+  barrier(buffer);
+  // the levels above follow behind the block sums and their total
+  scan(buffer, consts, scratch, nBlocks,
+       scratch + (static_cast<vk::DeviceSize>(nBlocks) + 1) * sizeof(uint32_t));
+  dispatch(buffer, cpScanDown, consts, nBlocks);
+  barrier(buffer);
+}
+
+void ViewFactorMatrix::barrier(vk::CommandBuffer buffer,
+                               vk::PipelineStageFlags src) {
+  vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite |
+                                vk::AccessFlagBits::eTransferWrite,
+                            vk::AccessFlagBits::eShaderRead |
+                                vk::AccessFlagBits::eShaderWrite};
+  buffer.pipelineBarrier(src, vk::PipelineStageFlagBits::eComputeShader, {},
+                         barrier, nullptr, nullptr);
+}
+} // namespace rn
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "pipeline.hpp"
+#include "vknhandler.hpp"
+#include "vma.hpp"
+
+namespace rn {
+// sparse view factor matrix in compressed sparse row format, built on the
+// device from the hit records of a batch launch. Only the (emitter, receiver)
+// pairs that were actually hit are stored and downloaded.
+class ViewFactorMatrix {
+public:
+  ViewFactorMatrix(std::shared_ptr<VulkanHandler> vlkn_);
+  ~ViewFactorMatrix();
+
+  // records sort and run length encoding of nHits hit records into buffer.
+  // the sort ping pongs between hits and an internal buffer, so hits is
+  // overwritten and does not necessarily end up sorted. rows are emitters,
+  // receivers >= nCols are misses and only count towards the row total.
+  // without hits the matrix is recorded as empty
+  void build(vk::CommandBuffer buffer, vk::Buffer hits, uint32_t nHits,
+             uint32_t nRows, uint32_t nCols);
+  // fetches the matrix of the last build, the command buffer has to be done
+  void download();
+
+  uint32_t rows() const { return nRows; };
+  uint32_t cols() const { return nCols; };
+  uint32_t nonZeros() const {
+    return rowOffsets.empty() ? 0 : rowOffsets.back();
+  };
+  // nonzeros of row i are columns/values[rowOffsets[i], rowOffsets[i + 1])
+  const std::vector<uint32_t> &getRowOffsets() const { return rowOffsets; };
+  const std::vector<uint32_t> &getColumns() const { return columns; };
+  const std::vector<float> &getValues() const { return values; };
+  float at(uint32_t row, uint32_t col) const;
+
+  // the matrix of the last build stays on the device for later passes
+  vk::DeviceAddress deviceRowOffsets() const;
+  vk::DeviceAddress deviceColumns() const;
+  vk::DeviceAddress deviceValues() const;
+
+  // push constants of the sparse matrix passes, see src/shaders/csr.glsl
+  struct CsrConsts {
+    vk::DeviceAddress src;
+    vk::DeviceAddress dst;
+    vk::DeviceAddress hist;
+    vk::DeviceAddress rows;
+    vk::DeviceAddress cols;
+    vk::DeviceAddress sums;
+    vk::DeviceAddress vals;
+    vk::DeviceAddress totals;
+    // block sums of the hierarchical scan
+    vk::DeviceAddress blocks;
+    uint32_t nItems;
+    uint32_t nRows;
+    uint32_t nCols;
+    uint32_t nGroups;
+    uint32_t shift;
+    uint32_t receiverBits;
+  };
+
+private:
+  std::shared_ptr<VulkanHandler> vlkn;
+  void reserve(uint32_t nHits, uint32_t nRows_);
+  void dispatch(vk::CommandBuffer buffer, ComputePipeline &pipeline,
+                const CsrConsts &consts, uint32_t nGroups);
+  // in place exclusive scan of nItems uints at items, the total is written
+  // behind the last one. Larger arrays are reduced per block, the block
+  // sums are scanned the same way into scratch and added back. Ends with a
+  // barrier
+  void scan(vk::CommandBuffer buffer, CsrConsts consts,
+            vk::DeviceAddress items, uint32_t nItems,
+            vk::DeviceAddress scratch);
+  void barrier(vk::CommandBuffer buffer,
+               vk::PipelineStageFlags src =
+                   vk::PipelineStageFlagBits::eComputeShader);
+
+  uint32_t nRows = 0;
+  uint32_t nCols = 0;
+  std::vector<uint32_t> rowOffsets;
+  std::vector<uint32_t> columns;
+  std::vector<float> values;
+
+  // device side scratch, sized for the largest build so far
+  uint32_t hitCapacity = 0;
+  uint32_t rowCapacity = 0;
+  // items of the largest scan
+  vk::DeviceSize scanCapacity = 0;
+  vk::Buffer tmpBuffer;
+  vk::Buffer histBuffer;
+  vk::Buffer headBuffer;
+  vk::Buffer sumBuffer;
+  vk::Buffer colBuffer;
+  vk::Buffer valBuffer;
+  vk::Buffer rowBuffer;
+  vk::Buffer totalBuffer;
+  vk::Buffer scanBuffer;
+  VmaAllocation tmpAlloc;
+  VmaAllocation histAlloc;
+  VmaAllocation headAlloc;
+  VmaAllocation sumAlloc;
+  VmaAllocation colAlloc;
+  VmaAllocation valAlloc;
+  VmaAllocation rowAlloc;
+  VmaAllocation totalAlloc;
+  VmaAllocation scanAlloc;
+
+  ComputePipeline cpRadixCount;
+  ComputePipeline cpRadixScatter;
+  ComputePipeline cpScan;
+  ComputePipeline cpScanReduce;
+  ComputePipeline cpScanDown;
+  ComputePipeline cpHeads;
+  ComputePipeline cpValues;
+  ComputePipeline cpFinalize;
+};
+} // namespace rn
@@ -111,8 +111,11 @@ public:
     addPoolSize(vk::DescriptorType::eAccelerationStructureKHR, 1);
     createPool(1);
 
+    // ray query only devices have no raygen stage, the binding is unused
     addBinding(0, vk::DescriptorType::eAccelerationStructureKHR,
-               vk::ShaderStageFlagBits::eRaygenKHR);
+               vlkn->hasRayTracingPipeline()
+                   ? vk::ShaderStageFlagBits::eRaygenKHR
+                   : vk::ShaderStageFlagBits::eCompute);
 
 
     layout = vlkn->getDevice().createDescriptorSetLayout(
@@ -50,10 +50,10 @@ void Gui::oriMenu() {
 void Gui::rayMenu() {
 
   static int current_item = 0;
-  static int nRays = 100;
+  static uint64_t nRays = 100;
   ImGui::Combo("Triangle", &current_item, &State::itemGetter,
                triangleNames->data(), triangleNames->size());
-  ImGui::DragInt("Number of rays to launch", &nRays, 1, 0, 1000);
+  ImGui::InputScalar("Number of rays to launch", ImGuiDataType_U64, &nRays);
   if (ImGui::Button("Launch")) {
     state->currTri = current_item;
     state->nRays = nRays;
@@ -63,6 +63,125 @@ void Gui::rayMenu() {
   }
 };
 
+void Gui::allMenu() {
+
+  static int current_item = 0;
+  static uint64_t nRays = 100;
+  ImGui::Combo("Shown triangle", &current_item, &State::itemGetter,
+               triangleNames->data(), triangleNames->size());
+  ImGui::Checkbox("Global ray budget", &state->global);
+  ImGui::SameLine();
+  HelpMarker("Draw the emitter of every ray from an alias table over\n"
+             "area x emissivity, instead of tracing the same number\n"
+             "of rays from every triangle");
+  if (state->global) {
+    ImGui::InputScalar("Total number of rays", ImGuiDataType_U64,
+                       &state->globalRays);
+    ImGui::Checkbox("Weight by T^4", &state->weightTemperature);
+  } else {
+    ImGui::InputScalar("Number of rays per triangle", ImGuiDataType_U64,
+                       &nRays);
+  }
+  ImGui::Checkbox("Accumulate on device", &state->binned);
+  ImGui::SameLine();
+  HelpMarker("Sum up the hits per emitter and receiver while tracing,\n"
+             "instead of storing every single hit");
+  if (!state->binned) {
+    ImGui::Checkbox("Sparse matrix", &state->sparse);
+    ImGui::SameLine();
+    HelpMarker("Sort the hits on the device and only keep the\n"
+               "emitter/receiver pairs that see each other");
+    if (state->sparse) {
+      ImGui::Checkbox("Gebhart factors", &state->gebhart);
+      ImGui::SameLine();
+      HelpMarker("Include diffuse reflections between surfaces with\n"
+                 "emissivity < 1, solved on the sparse view factors");
+      if (state->gebhart) {
+        ImGui::Checkbox("Solve on the CPU", &state->gebhartCpu);
+        ImGui::InputScalar("Max iterations", ImGuiDataType_U32,
+                           &state->gebhartIterations);
+      }
+    }
+  }
+  if (ImGui::Button("Launch")) {
+    state->currTri = current_item;
+    state->nRays = nRays;
+    state->bLaunch = true;
+    state->hitShow = true;
+    state->rayShow = true;
+  }
+  if (state->tracing) {
+    ImGui::SameLine();
+    ImGui::Text("tracing...");
+  }
+};
+
+
+void Gui::progMenu() {
+
+  static int current_item = 0;
+  static int nRays = 100;
+  ImGui::Combo("Shown triangle", &current_item, &State::itemGetter,
+               triangleNames->data(), triangleNames->size());
+  ImGui::DragInt("Rays per triangle and batch", &nRays, 1, 1, 1000);
+  ImGui::DragFloat("Tolerance", &state->tolerance, 0.001f, 0.001f, 1.f,
+                   "%.3f");
+  ImGui::SameLine();
+  HelpMarker("Largest standard error of a view factor relative to\n"
+             "the view factor, view factors below 0.01 are judged\n"
+             "by their absolute error instead");
+  ImGui::InputScalar("Ray budget", ImGuiDataType_U64, &state->rayBudget);
+
+  if (!state->progRunning) {
+    if (ImGui::Button("Start")) {
+      state->currTri = current_item;
+      state->nRays = nRays;
+      state->progStart = true;
+      state->hitShow = true;
+      state->rayShow = true;
+    }
+  } else if (ImGui::Button("Stop")) {
+    state->progRunning = false;
+  }
+
+  ImGui::Text("Active triangles: %u / %zu", state->nActive,
+              triangleNames->size());
+  ImGui::Text("Rays traced: %llu",
+              static_cast<unsigned long long>(state->raysTraced));
+  ImGui::Text("Worst error: %.4f", state->maxError);
+}
+
+void Gui::meshTable() {
+  size_t n = state->meshNames.size();
+  if (n == 0 || state->meshViewFactors.size() != n * n) {
+    return;
+  }
+  if (!ImGui::CollapsingHeader("Mesh view factors")) {
+    return;
+  }
+  // row = emitting mesh, column = receiving mesh
+  if (ImGui::BeginTable("meshVf", static_cast<int>(n) + 1,
+                        ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollX |
+                            ImGuiTableFlags_ScrollY,
+                        ImVec2(0, ImGui::GetTextLineHeightWithSpacing() * 12))) {
+    ImGui::TableSetupScrollFreeze(1, 1);
+    ImGui::TableSetupColumn("from \\ to");
+    for (const auto &name : state->meshNames) {
+      ImGui::TableSetupColumn(name.c_str());
+    }
+    ImGui::TableHeadersRow();
+    for (size_t i = 0; i < n; ++i) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(state->meshNames[i].c_str());
+      for (size_t j = 0; j < n; ++j) {
+        ImGui::TableNextColumn();
+        ImGui::Text("%.4f", state->meshViewFactors[i * n + j]);
+      }
+    }
+    ImGui::EndTable();
+  }
+}
 
 Gui::Gui(VulkanHandler &vlkn, Window &window, const SwapChain &swapchain,std::shared_ptr<std::vector<std::string>> triangleNames_)
     : vlkn(vlkn), window(window), triangleNames(triangleNames_) {
@@ -90,11 +209,15 @@ void Gui::gui() {
   ImGui::SameLine();
   ImGui::RadioButton("Trace Rays", &e, 1);
   ImGui::SameLine();
-  ImGui::RadioButton("C", &e, 2);
+  ImGui::RadioButton("Trace All", &e, 2);
+  ImGui::SameLine();
+  ImGui::RadioButton("Progressive", &e, 3);
   ImGui::SameLine();
   HelpMarker("Switch between tracing modes\n"\
              "A = show randomly sampled origins\n"\
-             "B = show hit points on the triangles");
+             "B = show hit points on the triangles\n"\
+             "C = trace all triangles in one launch\n"\
+             "D = add batches until the view factors converge");
 
   if(e == 0) {
     oriMenu();
@@ -103,8 +226,64 @@ void Gui::gui() {
     rayMenu();
   }
   if(e == 2) {
-    ImGui::Text("C");
+    allMenu();
+  }
+  if(e == 3) {
+    progMenu();
+  }
+
+  if (ImGui::Checkbox("Fast build", &state->fastBuild)) {
+    state->asRebuild = true;
   }
+  ImGui::SameLine();
+  HelpMarker("Build the acceleration structures quickly instead of\n"
+             "compacting them for fast traces");
+  ImGui::Text("BLAS: %.2f MiB", state->blasBytes / (1024. * 1024.));
+
+  ImGui::InputScalar("Articulated mesh", ImGuiDataType_U32,
+                     &state->articulatedMesh);
+  ImGui::Combo("Axis", &state->meshAxis, "x\0y\0z\0");
+  if (ImGui::SliderFloat("Angle", &state->meshAngle, -180.f, 180.f)) {
+    state->refit = true;
+  }
+  ImGui::SameLine();
+  HelpMarker("Rotates the mesh about its centre, the acceleration\n"
+             "structures are refit instead of rebuilt");
+
+  ImGui::Checkbox("Correct view factors", &state->correct);
+  ImGui::SameLine();
+  HelpMarker("Enforce A_i F_ij = A_j F_ji and scale the rows to their\n"
+             "closure target, 1 for closed enclosures, otherwise the\n"
+             "fraction that did not escape. Not applied to sparse results");
+  if (state->correct) {
+    ImGui::Checkbox("Closed enclosure", &state->closed);
+    ImGui::InputScalar("Closure iterations", ImGuiDataType_U32,
+                       &state->closureIterations);
+  }
+
+  ImGui::Checkbox("Quasi Monte Carlo", &state->sobol);
+  ImGui::Checkbox("Pin seed", &state->pinSeed);
+  ImGui::SameLine();
+  HelpMarker("Every launch draws new random numbers, a pinned seed\n"
+             "repeats the launch that used it");
+  if (state->pinSeed) {
+    ImGui::InputScalar("Seed", ImGuiDataType_U32, &state->seed);
+  } else {
+    ImGui::Text("Seed of the last launch: %u", state->seed);
+  }
+  ImGui::SameLine();
+  HelpMarker("Sample origins and directions from a scrambled Sobol\n"
+             "sequence instead of the pseudo random generator");
+
+  if (state->rayQueryAvailable) {
+    ImGui::Checkbox("Ray queries", &state->rayQuery);
+    ImGui::SameLine();
+    HelpMarker("Trace from a compute shader with inline ray queries\n"
+               "instead of the ray tracing pipeline. Binned launches\n"
+               "sum their hits in shared memory first");
+  }
+
+  meshTable();
 
   ImGui::Checkbox("Show Oris", &state->pShow);
   ImGui::SameLine();
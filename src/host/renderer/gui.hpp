@@ -38,6 +38,9 @@ private:
 
   void oriMenu();
   void rayMenu();
+  void allMenu();
+  void progMenu();
+  void meshTable();
 
   // gui
   void gui();
@@ -2,6 +2,7 @@
 #include "descriptors.hpp"
 #include "geometryloader/geometry.hpp"
 #include "vknhandler.hpp"
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <cstdint>
@@ -11,6 +12,8 @@
 #include <vector>
 #include "vma.hpp"
 #include <fstream>
+#include <future>
+#include <utility>
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
@@ -21,6 +24,10 @@
 
 
 namespace rn {
+namespace {
+// guaranteed maxComputeWorkGroupCount of every dimension
+constexpr uint32_t MAX_WORKGROUPS = 65535;
+} // namespace
 
 Pipeline::Pipeline(DescriptorSet *set_, vk::PipelineBindPoint bindP,
                    std::shared_ptr<VulkanHandler> vulkn_)
@@ -35,7 +42,13 @@ GraphicsPipeline::GraphicsPipeline(DescriptorSet &set_, vk::RenderPass renderPas
 
 ComputePipeline::ComputePipeline(std::shared_ptr<VulkanHandler> vlkn,
                                  const std::string &compPath)
-    : Pipeline(nullptr, vk::PipelineBindPoint::eCompute, vlkn), path(compPath) {
+    : ComputePipeline(vlkn, compPath, sizeof(RaytracingPipeline::RtConsts)) {}
+
+ComputePipeline::ComputePipeline(std::shared_ptr<VulkanHandler> vlkn,
+                                 const std::string &compPath,
+                                 uint32_t constSize)
+    : Pipeline(nullptr, vk::PipelineBindPoint::eCompute, vlkn), path(compPath),
+      constSize(constSize) {
 
   createLayout();
   config();
@@ -44,7 +57,7 @@ ComputePipeline::ComputePipeline(std::shared_ptr<VulkanHandler> vlkn,
 void ComputePipeline::createLayout() {
   // create layout
   vk::PushConstantRange pushConstRange{vk::ShaderStageFlagBits::eCompute, 0,
-                                       sizeof(RaytracingPipeline::RtConsts)};
+                                       constSize};
   vk::PipelineLayoutCreateInfo layoutInfo{{}, {}, pushConstRange};
   layout_ = vlkn->getDevice().createPipelineLayout(layoutInfo);
 };
@@ -56,11 +69,25 @@ void ComputePipeline::config() {
   vk::PipelineShaderStageCreateInfo shaderStage{
       {}, vk::ShaderStageFlagBits::eCompute, comp, "main"};
   vk::ComputePipelineCreateInfo createInfo{{}, shaderStage, layout_};
-  pipeline_ =
-      vlkn->getDevice().createComputePipeline(nullptr, createInfo).value;
-  destroyModule(comp);
+  createAsync([this, createInfo, comp]() {
+    vk::Pipeline pipeline =
+        vlkn->getDevice()
+            .createComputePipeline(vlkn->getPipelineCache(), createInfo)
+            .value;
+    destroyModule(comp);
+    return pipeline;
+  });
 };
 
+void ComputePipeline::dispatchRows(vk::CommandBuffer buffer, uint32_t groupsX,
+                                   uint32_t nRows) {
+  if (groupsX == 0 || nRows == 0) {
+    return;
+  }
+  uint32_t y = std::min(nRows, MAX_WORKGROUPS);
+  buffer.dispatch(groupsX, y, (nRows + y - 1) / y);
+}
+
 GraphicsPipelineTriangles::GraphicsPipelineTriangles(DescriptorSet &set_,
                             vk::RenderPass renderPass_,
                             std::shared_ptr<VulkanHandler> vlkn)
@@ -94,6 +121,11 @@ GraphicsPipelinePoints::GraphicsPipelinePoints(
 };
 
 RaytracingPipeline::~RaytracingPipeline() {
+  // the worker fills the sbt and uses the modules
+  wait();
+  if (!sbtBuffer) {
+    return;
+  }
   vlkn->getVma()->destroyBuffer(sbtAlloc, sbtBuffer);
       destroyModule(cHit);
       destroyModule(rGen);
@@ -106,8 +138,15 @@ RaytracingPipeline::RaytracingPipeline(DescriptorSet &set_,
                                        std::string cHitname,
                                        std::string rGenname,
                                        std::string rMissname)
-    : Pipeline(&set_, vk::PipelineBindPoint::eRayTracingKHR, vulkn_), cHit(createModule(cHitname)),
-      rGen(createModule(rGenname)), rMiss(createModule(rMissname)) {
+    : Pipeline(&set_, vk::PipelineBindPoint::eRayTracingKHR, vulkn_) {
+      // ray query only devices keep consts for the compute launches, but
+      // have neither the pipeline nor its shaders
+      if (!vlkn->hasRayTracingPipeline()) {
+        return;
+      }
+      cHit = createModule(cHitname);
+      rGen = createModule(rGenname);
+      rMiss = createModule(rMissname);
       RaytracingPipeline::createLayout();
 
       std::array<vk::PipelineShaderStageCreateInfo, 3> shaderStages{
@@ -122,14 +161,6 @@ RaytracingPipeline::RaytracingPipeline(DescriptorSet &set_,
             vk::ShaderUnusedKHR, 1, vk::ShaderUnusedKHR, vk::ShaderUnusedKHR},
            {vk::RayTracingShaderGroupTypeKHR::eGeneral, 2, vk::ShaderUnusedKHR,
             vk::ShaderUnusedKHR, vk::ShaderUnusedKHR}}};
-      vk::RayTracingPipelineCreateInfoKHR rtpci{{}, shaderStages, rtsgci};
-      rtpci.layout = layout_;
-
-      pipeline_ = vlkn->getDevice()
-                      .createRayTracingPipelinesKHR(VK_NULL_HANDLE,
-                                                    VK_NULL_HANDLE, rtpci)
-                      .value.front();
-
       uint32_t missCount = 1;
       uint32_t hitCount = 1;
       uint32_t rgCount = 1;
@@ -156,13 +187,6 @@ RaytracingPipeline::RaytracingPipeline(DescriptorSet &set_,
                                 props.shaderGroupBaseAlignment);
 
 
-      uint32_t dataSize = handleCount * handleSize;
-      handles.resize(dataSize);
-      if (vulkn_->getDevice().getRayTracingShaderGroupHandlesKHR(
-              pipeline_, 0, handleCount,dataSize,handles.data()) != vk::Result::eSuccess) {
-        throw std::runtime_error("failed to retrieve shader group handles!");
-      }
-
       vk::DeviceSize sbtSize =
           rgenRegion.size + missRegion.size + hitRegion.size;
       vk::BufferCreateInfo sbtBufferInfo{
@@ -188,31 +212,53 @@ RaytracingPipeline::RaytracingPipeline(DescriptorSet &set_,
       hitRegion.deviceAddress  = sbtAdress + rgenRegion.size;
       missRegion.deviceAddress = sbtAdress + rgenRegion.size + hitRegion.size;
 
-      std::vector<uint8_t> sbtDataHost(sbtSize);
-      uint32_t handleIdx = 0;
-      uint8_t *pData = sbtDataHost.data();
-      auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
-
-      // raygen
-      memcpy(pData, getHandle(handleIdx++), handleSize);
-
-      // chit
-      pData = sbtDataHost.data() + rgenRegion.size;
-      for (uint32_t c = 0; c < hitCount; ++c) {
+      // the sbt takes the group handles of the finished pipeline
+      createAsync([this, shaderStages, rtsgci, handleCount, handleSize,
+                   hitCount, missCount, sbtSize, rgen = rgenRegion,
+                   hit = hitRegion, miss = missRegion, alloc = sbtAlloc]() {
+        vk::RayTracingPipelineCreateInfoKHR rtpci{{}, shaderStages, rtsgci};
+        rtpci.layout = layout_;
+        vk::Pipeline pipeline =
+            vlkn->getDevice()
+                .createRayTracingPipelinesKHR(VK_NULL_HANDLE,
+                                              vlkn->getPipelineCache(), rtpci)
+                .value.front();
+
+        uint32_t dataSize = handleCount * handleSize;
+        std::vector<uint8_t> handles(dataSize);
+        if (vlkn->getDevice().getRayTracingShaderGroupHandlesKHR(
+                pipeline, 0, handleCount, dataSize, handles.data()) !=
+            vk::Result::eSuccess) {
+          throw std::runtime_error("failed to retrieve shader group handles!");
+        }
+
+        std::vector<uint8_t> sbtDataHost(sbtSize);
+        uint32_t handleIdx = 0;
+        uint8_t *pData = sbtDataHost.data();
+        auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
+
+        // raygen
         memcpy(pData, getHandle(handleIdx++), handleSize);
-        pData += hitRegion.stride;
-      }
-        // miss
-  pData = sbtDataHost.data() + rgenRegion.size + hitRegion.size;
-  for (uint32_t c = 0; c < missCount; ++c) {
-    memcpy(pData, getHandle(handleIdx++), handleSize);
-    pData += missRegion.stride;
-  }
 
-  void *pMapped = nullptr;
-  vmaMapMemory(vlkn->getVma()->vma(), sbtAlloc, &pMapped);
-  memcpy(pMapped, sbtDataHost.data(), sbtSize);
-  vmaUnmapMemory(vlkn->getVma()->vma(), sbtAlloc);
+        // chit
+        pData = sbtDataHost.data() + rgen.size;
+        for (uint32_t c = 0; c < hitCount; ++c) {
+          memcpy(pData, getHandle(handleIdx++), handleSize);
+          pData += hit.stride;
+        }
+        // miss
+        pData = sbtDataHost.data() + rgen.size + hit.size;
+        for (uint32_t c = 0; c < missCount; ++c) {
+          memcpy(pData, getHandle(handleIdx++), handleSize);
+          pData += miss.stride;
+        }
+
+        void *pMapped = nullptr;
+        vmaMapMemory(vlkn->getVma()->vma(), alloc, &pMapped);
+        memcpy(pMapped, sbtDataHost.data(), sbtSize);
+        vmaUnmapMemory(vlkn->getVma()->vma(), alloc);
+        return pipeline;
+      });
 };
 
 
@@ -299,12 +345,13 @@ void GraphicsPipelinePoints::config() {
    configInfo.inputAssemblyInfo.setTopology(vk::PrimitiveTopology::ePointList);
    }
 
-void GraphicsPipeline::create(vk::GraphicsPipelineCreateInfo &info) {
-  auto res = vlkn->getDevice().createGraphicsPipeline(nullptr, info);
+vk::Pipeline GraphicsPipeline::create(vk::GraphicsPipelineCreateInfo &info) {
+  auto res =
+      vlkn->getDevice().createGraphicsPipeline(vlkn->getPipelineCache(), info);
   if (res.result != vk::Result::eSuccess) {
     throw std::runtime_error("failed to create Pipeline!");
   }
-  pipeline_ = res.value;
+  return res.value;
 }
 
 void RaytracingPipeline::createLayout() {
@@ -327,23 +374,28 @@ void GraphicsPipeline::init(
       {{{}, vk::ShaderStageFlagBits::eVertex, vert, "main"},
        {{}, vk::ShaderStageFlagBits::eFragment, frag, "main"}}};
 
-  vk::GraphicsPipelineCreateInfo createInfo{{},
-                                            shaderStages,
-                                            &vertexInfo,
-                                            &configInfo.inputAssemblyInfo,
-                                            nullptr,
-                                            &configInfo.viewportInfo,
-                                            &configInfo.rasterizationInfo,
-                                            &configInfo.multisampleInfo,
-                                            &configInfo.depthStencilInfo,
-                                            &configInfo.colorBlendInfo,
-                                            &configInfo.dynamicStateInfo,
-                                            layout_,
-                                            renderPass,
-                                            configInfo.subpass};
-  create(createInfo);
-  destroyModule(vert);
-  destroyModule(frag);
+  // configInfo lives in the base class and outlasts the worker
+  createAsync([this, shaderStages, vertexInfo, vert, frag,
+               pass = renderPass]() {
+    vk::GraphicsPipelineCreateInfo createInfo{{},
+                                              shaderStages,
+                                              &vertexInfo,
+                                              &configInfo.inputAssemblyInfo,
+                                              nullptr,
+                                              &configInfo.viewportInfo,
+                                              &configInfo.rasterizationInfo,
+                                              &configInfo.multisampleInfo,
+                                              &configInfo.depthStencilInfo,
+                                              &configInfo.colorBlendInfo,
+                                              &configInfo.dynamicStateInfo,
+                                              layout_,
+                                              pass,
+                                              configInfo.subpass};
+    vk::Pipeline pipeline = create(createInfo);
+    destroyModule(vert);
+    destroyModule(frag);
+    return pipeline;
+  });
 }
 
 vk::ShaderModule Pipeline::createModule(const std::string &filepath) {
@@ -354,6 +406,16 @@ void Pipeline::destroyModule(vk::ShaderModule module) {
   vlkn->destroyShaderModule(module);
 }
 
+void Pipeline::createAsync(std::function<vk::Pipeline()> create) {
+  pending = std::async(std::launch::async, std::move(create));
+}
+
+void Pipeline::wait() {
+  if (pending.valid()) {
+    pipeline_ = pending.get();
+  }
+}
+
 std::vector<char> Pipeline::readFile(const std::string &filepath) {
   std::ifstream shadercode{filepath, std::ios::ate | std::ios::binary};
   if (!shadercode.is_open()) {
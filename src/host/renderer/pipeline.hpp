@@ -5,6 +5,8 @@
 #include "geometryloader/geometry.hpp"
 #include "vknhandler.hpp"
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -38,6 +40,7 @@ public:
   Pipeline(DescriptorSet *set_, vk::PipelineBindPoint bindP,
            std::shared_ptr<VulkanHandler> vulkn_);
   ~Pipeline() {
+    wait();
     vlkn->getDevice().destroyPipeline(pipeline_);
     vlkn->getDevice().destroyPipelineLayout(layout_);
   };
@@ -45,20 +48,29 @@ public:
   Pipeline(const Pipeline &) = delete;
   Pipeline &operator=(const Pipeline &) = delete;
   void bind(vk::CommandBuffer buffer) {
-    buffer.bindPipeline(bindPoint, pipeline_);
+    buffer.bindPipeline(bindPoint, get());
   }
   vk::ShaderModule createModule(const std::string &filepath);
   void destroyModule(vk::ShaderModule);
-  vk::Pipeline get() { return pipeline_; };
+  vk::Pipeline get() {
+    wait();
+    return pipeline_;
+  };
   vk::PipelineLayout getLayout() { return layout_; };
 
 protected:
   virtual void config() = 0;
   virtual void createLayout() = 0;
   void createLayout(vk::PushConstantRange &constRange);
+  // compiles on a worker thread, so every pipeline of the application is
+  // built at the same time. get() and bind() wait for the result, derived
+  // classes that free something create uses have to wait() first as well
+  void createAsync(std::function<vk::Pipeline()> create);
+  void wait();
   PipelineConfigInfo configInfo = {};
 
   vk::Pipeline pipeline_;
+  std::future<vk::Pipeline> pending;
   std::shared_ptr<VulkanHandler> vlkn;
   vk::PipelineLayout layout_;
 
@@ -72,11 +84,19 @@ class ComputePipeline : public Pipeline {
 public:
   ComputePipeline(std::shared_ptr<VulkanHandler> vlkn,
                   const std::string &compPath);
+  ComputePipeline(std::shared_ptr<VulkanHandler> vlkn,
+                  const std::string &compPath, uint32_t constSize);
   void createLayout() override;
   void config() override;
+  // groupsX x nRows workgroups, rows past 65535 are continued along z. The
+  // shaders read their row with rowIndex() of src/shaders/rows.glsl and
+  // skip the rows past nRows
+  static void dispatchRows(vk::CommandBuffer buffer, uint32_t groupsX,
+                           uint32_t nRows);
 
 protected:
   std::string path;
+  uint32_t constSize;
 };
 
 class GraphicsPipeline : public Pipeline {
@@ -90,7 +110,7 @@ protected:
   void init(const std::string &vertPath, const std::string &fragPath,
             vk::PipelineVertexInputStateCreateInfo const &vertexInfo);
   virtual void createLayout() override;
-  void create(vk::GraphicsPipelineCreateInfo &info);
+  vk::Pipeline create(vk::GraphicsPipelineCreateInfo &info);
 };
 
 class GraphicsPipelineTriangles : public GraphicsPipeline {
@@ -142,6 +162,21 @@ public:
 
 
 
+  // RtConsts::flags, mirrored in src/shaders/consts.glsl
+  // trace all triangles at once, gl_LaunchIDEXT.y is the emitter
+  static constexpr uint32_t TRACE_BATCH = 1u << 0;
+  // accumulate hits into per (emitter, receiver) bins instead of HitRecords
+  static constexpr uint32_t TRACE_BINS = 1u << 1;
+  // only trace the emitters listed at RtConsts::emitters, progressive mode
+  static constexpr uint32_t TRACE_LIST = 1u << 2;
+  // owen scrambled sobol points instead of the philox streams
+  static constexpr uint32_t TRACE_SOBOL = 1u << 3;
+  // 1D launch, the emitter of every ray is drawn from RtConsts::alias
+  static constexpr uint32_t TRACE_GLOBAL = 1u << 4;
+  // size of the ori/dir buffers the rays are drawn from, MAX_VIS_RAYS in
+  // src/shaders/consts.glsl
+  static constexpr uint32_t MAX_VIS_RAYS = 1000;
+
   struct RtConsts {
     vk::DeviceAddress verts;
     vk::DeviceAddress idx;
@@ -150,7 +185,30 @@ public:
     vk::DeviceAddress dir;
     vk::DeviceAddress hit;
     vk::DeviceAddress energy;
-    uint64_t currTri = 0;
+    uint32_t currTri = 0;
+    // launch rows of the ray query backend, see
+    // ComputePipeline::dispatchRows
+    uint32_t rows = 0;
+    uint32_t flags = 0;
+    uint32_t nTris = 0;
+    vk::DeviceAddress bins;
+    vk::DeviceAddress emitters;
+    // index of the first sample of the launch, successive progressive
+    // batches continue the sequence instead of repeating it
+    uint32_t sampleOffset = 0;
+    // key of the random streams of the launch, see philox.hpp
+    uint32_t seed = 0;
+    // GeometryHandler::TriFrame per triangle
+    vk::DeviceAddress frames;
+    // GeometryHandler::AliasEntry per triangle
+    vk::DeviceAddress alias;
+    // chunk or progressive batch, part of the counter of every ray
+    uint32_t batch = 0;
+    // rays per launch row of the ray query backend, src/shaders/rqtri.comp
+    uint32_t width = 0;
+    // the ray query backend reads the tlas through its address instead of
+    // a descriptor
+    vk::DeviceAddress tlas;
   } consts;
 
 private:
@@ -158,10 +216,12 @@ private:
   void createLayout() override;
   uint32_t alignUp(uint32_t val, uint32_t align);
 
-  std::vector<uint8_t> handles{};
-
   vk::Buffer sbtBuffer;
-  VmaAllocation sbtAlloc;
+  VmaAllocation sbtAlloc = nullptr;
   VmaAllocationInfo sbtAllocInfo;
 };
+
+// 128 bytes is the minimum push constant size every device has to support
+static_assert(sizeof(RaytracingPipeline::RtConsts) <= 128,
+              "RtConsts exceed the guaranteed push constant size!");
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "pipeline.hpp"
 #include "swapchain.hpp"
 #include "window.hpp"
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <memory>
@@ -47,6 +48,12 @@ void Renderer::freeCommandBuffers() {
   vlkn->getDevice().freeCommandBuffers(vlkn->getGpool(), commandBuffers);
 }
 
+uint32_t Renderer::visibleRays() {
+  // only the first rays of a launch are kept for drawing
+  return static_cast<uint32_t>(std::min<uint64_t>(
+      getGui()->state->nRays, RaytracingPipeline::MAX_VIS_RAYS));
+}
+
 void Renderer::updateCamera(float frameTime) {
   camera.updateView(frameTime);
 }
@@ -54,7 +61,8 @@ void Renderer::updateCamera(float frameTime) {
 void Renderer::render(vk::Buffer vertexBuffer, vk::Buffer indexBuffer,
                       size_t nIdx, RaytracingPipeline::RtConsts &RtConstsPoints,
                       RaytracingPipeline::RtConsts &RtConstsRays) {
-    vlkn->getDevice().waitIdle();
+  // traces keep running on the compute queue meanwhile
+  vlkn->getGqueue().waitIdle();
 
   auto idx =
       swapChain.aquireNextImage(swapChain.inFlightFences.at(syncIdx),
@@ -105,7 +113,7 @@ void Renderer::render(vk::Buffer vertexBuffer, vk::Buffer indexBuffer,
                             pipelineLin.getLayout(), 0,
                             descriptors.getSets().at(syncIdx), nullptr);
   buffer.bindVertexBuffers(0, vertexBuffer, {0});
-  buffer.draw(getGui()->state->nRays*2, 1, 0, 0);
+  buffer.draw(visibleRays() * 2, 1, 0, 0);
   };
 
   // render points
@@ -134,7 +142,7 @@ void Renderer::render(vk::Buffer vertexBuffer, vk::Buffer indexBuffer,
   buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
                             pipelinePts.getLayout(), 0,
                             descriptors.getSets().at(syncIdx), nullptr);
-  buffer.draw(getGui()->state->nRays, 1, 0, 0);
+  buffer.draw(visibleRays(), 1, 0, 0);
   };
 
 
@@ -164,7 +172,7 @@ void Renderer::render(vk::Buffer vertexBuffer, vk::Buffer indexBuffer,
     swapChain.recreate();
     return;
   }
-  vlkn->getDevice().waitIdle();
+  vlkn->getGqueue().waitIdle();
 
   if (getGui()->state->pShow) {
     RtConstsRays.out = temp;
@@ -59,6 +59,7 @@ private:
   void createCommandBuffers();
   void freeCommandBuffers();
   void recreateSwapchain();
+  uint32_t visibleRays();
   std::vector<vk::CommandBuffer> commandBuffers;
   uint32_t syncIdx = 0;
 };
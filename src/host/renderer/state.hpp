@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
+#include <vector>
 namespace rn {
 struct State {
 
@@ -17,6 +19,71 @@ struct State {
   bool pLaunch = false;
   bool pShow = false;
   bool rLaunch = false;
+  // launch rays from all triangles at once
+  bool bLaunch = false;
+  // accumulate hits on the device instead of storing every hit
+  bool binned = false;
+  // build a sparse view factor matrix from the hits of a launch
+  bool sparse = false;
+  // Gebhart factors on top of the sparse view factors
+  bool gebhart = false;
+  bool gebhartCpu = false;
+  float gebhartTolerance = 1e-5f;
+  uint32_t gebhartIterations = 200;
+  // spread globalRays rays over all triangles by their emitted power
+  bool global = false;
+  uint64_t globalRays = 100000;
+  // weight the emitted power with T^4 as well
+  bool weightTemperature = false;
+  // reciprocity and closure correction of dense view factors, closed
+  // enclosures are scaled to row sums of 1
+  bool correct = false;
+  bool closed = false;
+  uint32_t closureIterations = 20;
+
+  // trace with ray queries from a compute shader instead of the ray
+  // tracing pipeline, binned launches accumulate in shared memory first
+  bool rayQuery = false;
+  // the device supports VK_KHR_ray_query
+  bool rayQueryAvailable = false;
+
+  // owen scrambled sobol points instead of pseudo random numbers
+  bool sobol = false;
+  // key of the random streams, every launch moves it on unless it is
+  // pinned to reproduce a launch
+  uint32_t seed = 0;
+  bool pinSeed = false;
+
+  // progressive launches, one batch per frame until every emitter is
+  // below the tolerance or the budget is used up
+  bool progStart = false;
+  bool progRunning = false;
+  float tolerance = 0.05f;
+  uint64_t rayBudget = 10000000;
+  uint64_t raysTraced = 0;
+  uint32_t nActive = 0;
+  float maxError = 0.f;
+
+  // a launch is running on the compute queue
+  bool tracing = false;
+
+  // mesh x mesh view factors of the last dense launch
+  std::vector<float> meshViewFactors;
+  std::vector<std::string> meshNames;
+
+  // acceleration structures are built for fast builds instead of fast,
+  // compacted traces
+  bool fastBuild = false;
+  bool asRebuild = false;
+  uint64_t blasBytes = 0;
+
+  // rotates articulatedMesh by meshAngle degrees about the meshAxis axis
+  // through its centre and refits the acceleration structures
+  uint32_t articulatedMesh = 0;
+  int meshAxis = 2;
+  float meshAngle = 0.f;
+  bool refit = false;
+
   bool hitShow = false;
   bool rayShow = false;
 };
@@ -3,8 +3,12 @@
 
 #include <cstdint>
 #include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <set>
 #include <stdexcept>
 #include <string>
@@ -43,13 +47,16 @@ debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
   return VK_FALSE;
 }
 
-VulkanHandler::VulkanHandler() {
+VulkanHandler::VulkanHandler(bool headless_) : headless(headless_) {
   createInstance();
-  createDebugCallback();
+  if (debugUtils) {
+    createDebugCallback();
+  }
   pickPhysicalDevice();
   createLogicalDevice();
   createQueues();
   createCommandPools();
+  createPipelineCache();
   vma = std::make_shared<VMA>(
       this, VmaVulkanFunctions{
                 .vkGetInstanceProcAddr =
@@ -59,16 +66,71 @@ VulkanHandler::VulkanHandler() {
 }
 
 VulkanHandler::~VulkanHandler() {
+  savePipelineCache();
+  device.destroyPipelineCache(pipelineCache);
   device.destroyCommandPool(gPool);
   device.destroyCommandPool(cPool);
   device.destroyCommandPool(tPool);
   vma.reset();
   device.destroy();
 
-  instance->destroyDebugUtilsMessengerEXT(debugUtilsMessenger);
+  if (debugUtils) {
+    instance->destroyDebugUtilsMessengerEXT(debugUtilsMessenger);
+  }
   instance->destroy();
 }
 
+void VulkanHandler::createPipelineCache() {
+  std::vector<char> data;
+  std::ifstream file{pipelineCachePath, std::ios::ate | std::ios::binary};
+  if (file.is_open()) {
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+  }
+
+  // the header of VK_PIPELINE_CACHE_HEADER_VERSION_ONE identifies the device
+  // and driver, drivers are allowed to crash on anything else
+  vk::PhysicalDeviceProperties props = physicalDevice.getProperties();
+  VkPipelineCacheHeaderVersionOne header{};
+  bool valid = file && data.size() >= sizeof(header);
+  if (valid) {
+    std::memcpy(&header, data.data(), sizeof(header));
+    valid = header.headerSize >= sizeof(header) &&
+            header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            header.vendorID == props.vendorID &&
+            header.deviceID == props.deviceID &&
+            std::equal(props.pipelineCacheUUID.begin(),
+                       props.pipelineCacheUUID.end(),
+                       header.pipelineCacheUUID);
+  }
+  if (!valid) {
+    data.clear();
+  }
+  pipelineCache = device.createPipelineCache(
+      vk::PipelineCacheCreateInfo{{}, data.size(), data.data()});
+}
+
+void VulkanHandler::savePipelineCache() {
+  std::vector<uint8_t> data = device.getPipelineCacheData(pipelineCache);
+  std::error_code error;
+  std::filesystem::create_directories(
+      std::filesystem::path(pipelineCachePath).parent_path(), error);
+  // a crash while writing must not leave a truncated cache behind
+  std::string tmp = pipelineCachePath + ".tmp";
+  {
+    std::ofstream file{tmp, std::ios::binary | std::ios::trunc};
+    if (!file.is_open()) {
+      return;
+    }
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    if (!file) {
+      return;
+    }
+  }
+  std::filesystem::rename(tmp, pipelineCachePath, error);
+}
+
 void VulkanHandler::createInstance() {
   // calls the dynamically loaded functions
   VULKAN_HPP_DEFAULT_DISPATCHER.init();
@@ -83,11 +145,22 @@ void VulkanHandler::createInstance() {
       getLayers(instanceLayerNames, instanceLayerProps);
 
   auto instanceExtensionProps = vk::enumerateInstanceExtensionProperties();
-  std::vector<char const *> instanceExtensionNames{
-      VK_EXT_DEBUG_UTILS_EXTENSION_NAME, VK_KHR_SURFACE_EXTENSION_NAME,
-      VK_KHR_XCB_SURFACE_EXTENSION_NAME};
+  // headless instances have no surface, debug utils are added by
+  // getExtensions if they are available
+  std::vector<char const *> instanceExtensionNames;
+  if (!headless) {
+    instanceExtensionNames = {VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
+                              VK_KHR_SURFACE_EXTENSION_NAME,
+                              VK_KHR_XCB_SURFACE_EXTENSION_NAME};
+  }
   std::vector<char const *> enabledExtensions =
       getExtensions(instanceExtensionNames, instanceExtensionProps);
+  debugUtils = std::any_of(enabledExtensions.begin(), enabledExtensions.end(),
+                           [](char const *ext) {
+                             return strcmp(ext,
+                                           VK_EXT_DEBUG_UTILS_EXTENSION_NAME) ==
+                                    0;
+                           });
   vk::InstanceCreateInfo instCreateInfo({}, &appInfo, enabledLayers,
                                         enabledExtensions);
 
@@ -174,6 +247,9 @@ std::vector<char const *> VulkanHandler::getExtensions(
     enabledExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
   }
 
+  if (headless) {
+    return enabledExtensions;
+  }
   // lead gltf Extension, add here to support other window framework
   uint32_t glfwExtensionCount = 0;
   const char **glfwExtensions;
@@ -193,7 +269,7 @@ bool VulkanHandler::isDeviceSuitable(vk::PhysicalDevice device) {
     if (qf.queueCount > 0 && qf.queueFlags & vk::QueueFlagBits::eGraphics &&
         !indices.graphicsFamilyHasValue) {
       indices.graphicsFamily = idx;
-      indices.computeFamilyCount = qf.queueCount;
+      indices.graphicsFamilyCount = qf.queueCount;
       indices.graphicsFamilyHasValue = true;
       indices.graphicsHasPresentSupport =
           true; // should hold for almost all graphic cards
@@ -205,6 +281,7 @@ bool VulkanHandler::isDeviceSuitable(vk::PhysicalDevice device) {
         !(qf.queueFlags & vk::QueueFlagBits::eGraphics) &&
         !indices.dedicatedComputeFamilyHasValue) {
       indices.computeFamily = idx;
+      indices.computeFamilyCount = qf.queueCount;
       indices.dedicatedComputeFamilyHasValue = true;
     }
     // check for dedicated transfer family.
@@ -224,58 +301,153 @@ bool VulkanHandler::isDeviceSuitable(vk::PhysicalDevice device) {
   // familily was found. This is mostly the case for standard GPU hardware
   if (!indices.dedicatedComputeFamilyHasValue) {
     indices.computeFamily = indices.graphicsFamily;
-    indices.dedicatedComputeFamilyHasValue = true;
+    indices.computeFamilyCount = indices.graphicsFamilyCount;
+    indices.dedicatedComputeFamilyHasValue = indices.graphicsFamilyHasValue;
+  }
+  if (headless) {
+    // any family with compute will do, compute only devices have no
+    // graphics family to fall back to
+    for (uint32_t i = 0;
+         i < queueFamilies.size() && !indices.dedicatedComputeFamilyHasValue;
+         ++i) {
+      if (queueFamilies[i].queueCount > 0 &&
+          queueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute) {
+        indices.computeFamily = i;
+        indices.computeFamilyCount = queueFamilies[i].queueCount;
+        indices.dedicatedComputeFamilyHasValue = true;
+      }
+    }
+    // single time commands run on the compute family as well
+    indices.graphicsFamily = indices.computeFamily;
+    indices.graphicsFamilyCount = indices.computeFamilyCount;
+    indices.graphicsFamilyHasValue = indices.dedicatedComputeFamilyHasValue;
+    if (!indices.transferFamilyHasValue) {
+      indices.transferFamily = indices.computeFamily;
+      indices.transferFamilyCount = indices.computeFamilyCount;
+      indices.transferFamilyHasValue = indices.dedicatedComputeFamilyHasValue;
+    }
+  }
+
+  // the bins and the sparse matrix are summed up with 64 bit atomics by
+  // every accumulation shader, binned or not. Without them there is no
+  // view factor path to fall back to
+  auto features = device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                      vk::PhysicalDeviceVulkan12Features>();
+  const auto &features12 = features.get<vk::PhysicalDeviceVulkan12Features>();
+  if (!features12.bufferDeviceAddress ||
+      !features12.shaderBufferInt64Atomics ||
+      !features.get<vk::PhysicalDeviceFeatures2>().features.shaderInt64) {
+    return false;
   }
 
   bool extensionSupported = false;
   std::vector<vk::ExtensionProperties> devExtensions =
       device.enumerateDeviceExtensionProperties();
-  std::set<std::string> reqExtensions(deviceExtensionNames.begin(),
-                                      deviceExtensionNames.end());
+  std::vector<const char *> required = requiredDeviceExtensions();
+  std::set<std::string> reqExtensions(required.begin(), required.end());
   for (const auto &dE : devExtensions) {
     reqExtensions.erase(dE.extensionName.data());
     // std::cout << dE.extensionName << std::endl;
   }
-  if (reqExtensions.empty()) {
+  // something has to trace, the pipeline or ray queries from compute
+  if (reqExtensions.empty() &&
+      (hasExtension(device, VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME) ||
+       hasExtension(device, VK_KHR_RAY_QUERY_EXTENSION_NAME))) {
     queueFamilyIndices = indices;
     extensionSupported = true;
   }
 
   // determine capabilities of swapchain
-  return extensionSupported && indices.isComplete();
+  return extensionSupported &&
+         (headless ? indices.isCompleteHeadless() : indices.isComplete());
+}
+
+bool VulkanHandler::hasExtension(vk::PhysicalDevice device,
+                                 const char *name) const {
+  auto available = device.enumerateDeviceExtensionProperties();
+  return std::any_of(available.begin(), available.end(), [name](auto &ext) {
+    return std::string(ext.extensionName.data()) == name;
+  });
+}
+
+std::vector<const char *> VulkanHandler::requiredDeviceExtensions() const {
+  std::vector<const char *> extensions = deviceExtensionNames;
+  if (!headless) {
+    extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
+  return extensions;
 }
 
 void VulkanHandler::createLogicalDevice() {
   // is ignored by most drivers
-  float queuePrio = 0.f;
-  vk::DeviceQueueCreateInfo graphicsInfo({}, queueFamilyIndices.graphicsFamily,
-                                         1, &queuePrio);
-  vk::DeviceQueueCreateInfo computeInfo({}, queueFamilyIndices.computeFamily, 1,
-                                        &queuePrio);
-  vk::DeviceQueueCreateInfo transferInfo({}, queueFamilyIndices.transferFamily,
-                                         1, &queuePrio);
-  const std::array<const vk::DeviceQueueCreateInfo, 3> queueInfos{
-      graphicsInfo, computeInfo, transferInfo};
+  const std::array<float, 2> queuePrios{0.f, 0.f};
+  // a family may only be listed once, family -> number of queues. If
+  // compute shares the graphics family, a second queue of it keeps long
+  // traces from stalling the renderer. Without one there is nothing to stall
+  std::map<uint32_t, uint32_t> familyQueues;
+  familyQueues[queueFamilyIndices.graphicsFamily] = 1;
+  if (queueFamilyIndices.computeFamily == queueFamilyIndices.graphicsFamily) {
+    cQueueSlot =
+        !headless && queueFamilyIndices.graphicsFamilyCount > 1 ? 1 : 0;
+    familyQueues[queueFamilyIndices.graphicsFamily] = cQueueSlot + 1;
+  } else {
+    familyQueues[queueFamilyIndices.computeFamily] = 1;
+  }
+  // headless devices may transfer on the compute family
+  familyQueues.emplace(queueFamilyIndices.transferFamily, 1);
+  std::vector<vk::DeviceQueueCreateInfo> queueInfos;
+  for (const auto &[family, count] : familyQueues) {
+    queueInfos.emplace_back(vk::DeviceQueueCreateFlags{}, family, count,
+                            queuePrios.data());
+  }
 
   // p next chain
-  vk::PhysicalDeviceRayTracingPipelineFeaturesKHR raytracing;
-  raytracing.setRayTracingPipeline(VK_TRUE);
-
   vk::PhysicalDeviceAccelerationStructureFeaturesKHR acceleration;
   acceleration.accelerationStructure = VK_TRUE;
-  acceleration.pNext = &raytracing;
 
   vk::PhysicalDeviceVulkan12Features address;
   address.setBufferDeviceAddress(VK_TRUE);
+  // atomic accumulation of the view factor bins, checked by
+  // isDeviceSuitable
+  address.setShaderBufferInt64Atomics(VK_TRUE);
+  // subgroupAdd of the 64 bit bins, optional, the reductions have a shared
+  // memory variant
+  subgroupInt64 = physicalDevice
+                      .getFeatures2<vk::PhysicalDeviceFeatures2,
+                                    vk::PhysicalDeviceVulkan12Features>()
+                      .get<vk::PhysicalDeviceVulkan12Features>()
+                      .shaderSubgroupExtendedTypes;
+  address.setShaderSubgroupExtendedTypes(subgroupInt64);
   address.pNext = &acceleration;
 
+  // the ray tracing pipeline and inline ray queries from compute shaders,
+  // whichever the device has
+  std::vector<const char *> extensions = requiredDeviceExtensions();
+  void **pNext = &acceleration.pNext;
+  rayTracingPipeline =
+      hasExtension(physicalDevice, VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME);
+  vk::PhysicalDeviceRayTracingPipelineFeaturesKHR raytracing;
+  if (rayTracingPipeline) {
+    extensions.push_back(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME);
+    raytracing.setRayTracingPipeline(VK_TRUE);
+    *pNext = &raytracing;
+    pNext = &raytracing.pNext;
+  }
+  rayQuery = hasExtension(physicalDevice, VK_KHR_RAY_QUERY_EXTENSION_NAME);
+  vk::PhysicalDeviceRayQueryFeaturesKHR query;
+  if (rayQuery) {
+    extensions.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+    query.rayQuery = VK_TRUE;
+    *pNext = &query;
+  }
 
   vk::PhysicalDeviceFeatures features;
-  features.wideLines = VK_TRUE;
-  features.largePoints = VK_TRUE;
+  // only the renderer draws lines and points
+  features.wideLines = !headless;
+  features.largePoints = !headless;
   features.shaderInt64 = VK_TRUE;
 
-  vk::DeviceCreateInfo createInfo({}, queueInfos, {}, deviceExtensionNames,
+  vk::DeviceCreateInfo createInfo({}, queueInfos, {}, extensions,
                                   &features, &address);
   device = physicalDevice.createDevice(createInfo);
 
@@ -285,7 +457,7 @@ void VulkanHandler::createLogicalDevice() {
 
 void VulkanHandler::createQueues() {
   gQueue = device.getQueue(queueFamilyIndices.graphicsFamily, 0);
-  cQueue = device.getQueue(queueFamilyIndices.computeFamily, 0);
+  cQueue = device.getQueue(queueFamilyIndices.computeFamily, cQueueSlot);
   tQueue = device.getQueue(queueFamilyIndices.transferFamily, 0);
 }
 
@@ -329,4 +501,40 @@ void VulkanHandler::endSingleTimeCommands(vk::CommandBuffer buffer) {
   device.freeCommandBuffers(gPool, buffer);
 }
 
+vk::CommandBuffer VulkanHandler::beginComputeCommands() {
+  vk::CommandBufferAllocateInfo allocInfo{cPool,
+                                          vk::CommandBufferLevel::ePrimary, 1};
+  vk::CommandBuffer buffer = device.allocateCommandBuffers(allocInfo).front();
+  vk::CommandBufferBeginInfo beginInfo{
+      vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
+  buffer.begin(beginInfo);
+  return buffer;
+}
+
+void VulkanHandler::endComputeCommands(vk::CommandBuffer buffer) {
+  buffer.end();
+  vk::SubmitInfo info{};
+  info.setCommandBufferCount(1);
+  info.pCommandBuffers = &buffer;
+
+  cQueue.submit(info);
+  cQueue.waitIdle();
+
+  device.freeCommandBuffers(cPool, buffer);
+}
+
+void VulkanHandler::submitCompute(vk::CommandBuffer buffer, vk::Fence fence) {
+  buffer.end();
+  vk::SubmitInfo info{};
+  info.setCommandBufferCount(1);
+  info.pCommandBuffers = &buffer;
+
+  device.resetFences(fence);
+  cQueue.submit(info, fence);
+}
+
+void VulkanHandler::freeComputeCommands(vk::CommandBuffer buffer) {
+  device.freeCommandBuffers(cPool, buffer);
+}
+
 } // namespace rn
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 #ifndef VK_USE_PLATFORM_XCB_KHR
 #define VK_USE_PLATFORM_XCB_KHR
@@ -34,12 +35,19 @@ struct QueueFamilyIndices {
     return graphicsFamilyHasValue && graphicsHasPresentSupport &&
            dedicatedComputeFamilyHasValue && transferFamilyHasValue;
   }
+  // headless devices only need a compute family, graphics and transfer
+  // commands go there if the device has no family of its own for them
+  bool isCompleteHeadless() {
+    return dedicatedComputeFamilyHasValue && transferFamilyHasValue;
+  }
 };
 
 // class that interacts with vulkan directly
 class VulkanHandler {
 public:
-  VulkanHandler();
+  // headless handlers create no surface and need neither a window nor a
+  // display, the device only has to support compute and ray tracing
+  explicit VulkanHandler(bool headless = false);
   ~VulkanHandler();
 
   VulkanHandler(const VulkanHandler &) = delete;
@@ -51,17 +59,45 @@ public:
   const std::shared_ptr<VMA> getVma() const { return vma; };
   const vk::CommandPool &getGpool() const { return gPool; };
   const vk::CommandPool &getTpool() const { return tPool; };
+  const vk::CommandPool &getCpool() const { return cPool; };
 
   const vk::Queue &getGqueue() const { return gQueue; };
   const vk::Queue &getTqueue() const { return tQueue; };
+  const vk::Queue &getCqueue() const { return cQueue; };
+  // shared by every pipeline, loaded from and saved to pipelineCachePath
+  const vk::PipelineCache &getPipelineCache() const { return pipelineCache; };
 
 
   vk::ShaderModule createShaderModule(std::vector<char> code);
   void destroyShaderModule(vk::ShaderModule &module);
   uint32_t gQueueIndex() const { return queueFamilyIndices.graphicsFamily; };
+  uint32_t cQueueIndex() const { return queueFamilyIndices.computeFamily; };
+  // VK_KHR_ray_query and VK_KHR_ray_tracing_pipeline are optional, but a
+  // device needs at least one of them
+  bool hasRayQuery() const { return rayQuery; };
+  bool hasRayTracingPipeline() const { return rayTracingPipeline; };
+  // stages a launch may write from, for the barriers after it. The ray
+  // tracing stage is only valid on devices with the pipeline
+  vk::PipelineStageFlags traceStages() const {
+    vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    if (rayTracingPipeline) {
+      stages |= vk::PipelineStageFlagBits::eRayTracingShaderKHR;
+    }
+    return stages;
+  };
+  // shaderSubgroupExtendedTypes, subgroup arithmetic on 64 bit integers
+  bool hasSubgroupInt64() const { return subgroupInt64; };
+  bool isHeadless() const { return headless; };
 
   vk::CommandBuffer beginSingleTimeCommands();
   void endSingleTimeCommands(vk::CommandBuffer buffer);
+  // same on the compute queue, ray tracing and the reductions run there
+  vk::CommandBuffer beginComputeCommands();
+  void endComputeCommands(vk::CommandBuffer buffer);
+  // submits without waiting, fence is signalled once buffer has finished.
+  // buffer has to be freed with freeComputeCommands afterwards
+  void submitCompute(vk::CommandBuffer buffer, vk::Fence fence);
+  void freeComputeCommands(vk::CommandBuffer buffer);
 
 
 private:
@@ -76,10 +112,21 @@ private:
   QueueFamilyIndices queueFamilyIndices;
   vk::Queue gQueue;
   vk::Queue cQueue;
+  // index of cQueue in its family, the second queue if compute shares the
+  // graphics family
+  uint32_t cQueueSlot = 0;
   vk::Queue tQueue;
   vk::CommandPool gPool;
   vk::CommandPool cPool;
   vk::CommandPool tPool;
+  vk::PipelineCache pipelineCache;
+  bool rayQuery = false;
+  bool rayTracingPipeline = false;
+  bool subgroupInt64 = false;
+  bool headless = false;
+  // VK_EXT_debug_utils is only optional for headless instances
+  bool debugUtils = false;
+  const std::string pipelineCachePath = "cache/pipeline.bin";
 
   void createInstance();
   void createDebugCallback();
@@ -88,6 +135,10 @@ private:
   void createQueues();
   void createCommandPools();
   void createVMA();
+  // starts from the saved cache if it was written by this device and
+  // driver, empty otherwise
+  void createPipelineCache();
+  void savePipelineCache();
 
   // helpers
   std::vector<char const *>
@@ -97,14 +148,15 @@ private:
       std::vector<char const *> const &extensions,
       std::vector<vk::ExtensionProperties> const &extensionProperties);
   bool isDeviceSuitable(vk::PhysicalDevice device);
+  bool hasExtension(vk::PhysicalDevice device, const char *name) const;
+  // deviceExtensionNames and the swapchain, unless headless
+  std::vector<const char *> requiredDeviceExtensions() const;
   //  void hasGflwRequiredInstanceExtenstions() {
   //    auto extensions = vk::enumerateInstanceExtensionProperties();
   //  }
   const std::vector<const char *> deviceExtensionNames = {
-      VK_KHR_SWAPCHAIN_EXTENSION_NAME,
       VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
       VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
-      VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
       VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME};
   const std::vector<const char *> validationLayers; //= {
      // "VK_LAYER_KHRONOS_validation"};
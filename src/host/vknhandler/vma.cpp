@@ -58,6 +58,30 @@ void VMA::copyBuffer(vk::BufferCopy bufferCopy, vk::Buffer src, vk::Buffer dst)
   transferQ.waitIdle();
 }
 
+void VMA::copyRegions(
+    vk::Buffer src,
+    const std::vector<std::pair<vk::Buffer, vk::BufferCopy>> &copies) {
+  if (copies.empty()) {
+    return;
+  }
+  vk::CommandBuffer buf =
+      dev
+          .allocateCommandBuffers(vk::CommandBufferAllocateInfo{
+              transferPool, vk::CommandBufferLevel::ePrimary, 1})
+          .front();
+  buf.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+  for (const auto &[dst, region] : copies) {
+    buf.copyBuffer(src, dst, region);
+  }
+  buf.end();
+
+  vk::SubmitInfo info{};
+  info.setCommandBuffers(buf);
+  transferQ.submit(info);
+  transferQ.waitIdle();
+  dev.freeCommandBuffers(transferPool, buf);
+}
+
 vk::Buffer VMA::createBuffer(VmaAllocation &alloc, VmaAllocationInfo &allocInfo,
                              vk::BufferCreateInfo &createInfo,
                              VmaAllocationCreateInfo &allocCreateInfo) {
@@ -103,13 +127,23 @@ vk::Buffer VMA::uploadIndices(const std::vector<uint32_t> &idx, VmaAllocation &a
       {{}, VMA_MEMORY_USAGE_GPU_ONLY});
 }
 
-vk::Buffer VMA::uploadInstanceB(const vk::AccelerationStructureInstanceKHR &instance, VmaAllocation &alloc) {
+vk::Buffer VMA::uploadStorage(const void *pData, vk::DeviceSize size,
+                              VmaAllocation &alloc) {
+  return uploadWithStaging(pData, size, alloc,
+                           vk::BufferUsageFlagBits::eStorageBuffer |
+                               vk::BufferUsageFlagBits::eShaderDeviceAddress,
+                           {{}, VMA_MEMORY_USAGE_GPU_ONLY});
+}
+
+vk::Buffer VMA::uploadInstanceB(
+    const std::vector<vk::AccelerationStructureInstanceKHR> &instances,
+    VmaAllocation &alloc) {
 
 
   VmaAllocationCreateInfo instanceAllocCreateInfo{{},VMA_MEMORY_USAGE_GPU_ONLY};
 
   return uploadWithStaging(
-      &instance, sizeof(instance), alloc,
+      instances.data(), instances.size() * sizeof(instances[0]), alloc,
       vk::BufferUsageFlagBits::eShaderDeviceAddress |
           vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
       instanceAllocCreateInfo);
@@ -120,6 +154,55 @@ void VMA::updateDescriptor(const void *pData, vk::DeviceSize size,
   memcpy(info.pMappedData, pData, size);
 }
 
+vk::Buffer VMA::createStorageBuffer(vk::DeviceSize size,
+                                    VmaAllocation &alloc) {
+  vk::BufferCreateInfo createInfo{
+      {},
+      size,
+      vk::BufferUsageFlagBits::eStorageBuffer |
+          vk::BufferUsageFlagBits::eShaderDeviceAddress |
+          vk::BufferUsageFlagBits::eTransferSrc |
+          vk::BufferUsageFlagBits::eTransferDst};
+  VmaAllocationCreateInfo allocCreateInfo{{}, VMA_MEMORY_USAGE_GPU_ONLY};
+  VmaAllocationInfo info;
+  return createBuffer(alloc, info, createInfo, allocCreateInfo);
+}
+
+void VMA::downloadBuffer(vk::Buffer src, void *pData, vk::DeviceSize size,
+                         vk::DeviceSize offset) {
+  if (size == 0) {
+    return;
+  }
+  vk::BufferCreateInfo bufferInfo{
+      {}, size, vk::BufferUsageFlagBits::eTransferDst};
+  VmaAllocationCreateInfo createInfo{
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+          VMA_ALLOCATION_CREATE_MAPPED_BIT,
+      VMA_MEMORY_USAGE_AUTO};
+  VmaAllocation stagingAlloc;
+  VmaAllocationInfo stagingInfo;
+  vk::Buffer stagingBuf =
+      createBuffer(stagingAlloc, stagingInfo, bufferInfo, createInfo);
+
+  copyBuffer(vk::BufferCopy{offset, 0, size}, src, stagingBuf);
+  vmaInvalidateAllocation(vma_, stagingAlloc, 0, VK_WHOLE_SIZE);
+  memcpy(pData, stagingInfo.pMappedData, size);
+  destroyBuffer(stagingAlloc, stagingBuf);
+}
+
+void VMA::uploadBuffer(vk::Buffer dst, const void *pData, vk::DeviceSize size,
+                       vk::DeviceSize offset) {
+  if (size == 0) {
+    return;
+  }
+  VmaAllocation stagingAlloc;
+  VmaAllocationInfo stagingInfo;
+  vk::Buffer stagingBuf = stagingBuffer(size, stagingAlloc, stagingInfo);
+  memcpy(stagingInfo.pMappedData, pData, size);
+  copyBuffer(vk::BufferCopy{0, offset, size}, stagingBuf, dst);
+  destroyBuffer(stagingAlloc, stagingBuf);
+}
+
 vk::DeviceAddress VMA::getDeviceAddress(vk::Buffer buffer) {
   return dev.getBufferAddress(buffer);
 }
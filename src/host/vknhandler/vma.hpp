@@ -1,6 +1,7 @@
 #pragma once
 #include "vknhandler.hpp"
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 #include "glm/glm.hpp"
@@ -30,10 +31,31 @@ public:
                             VmaAllocation &alloc);
   vk::Buffer uploadIndices(const std::vector<uint32_t> &idx,
                            VmaAllocation &alloc);
-  vk::Buffer uploadInstanceB(const vk::AccelerationStructureInstanceKHR &instance,
-                             VmaAllocation &alloc);
+  // device local buffer that is only read through its device address
+  vk::Buffer uploadStorage(const void *pData, vk::DeviceSize size,
+                           VmaAllocation &alloc);
+  vk::Buffer uploadInstanceB(
+      const std::vector<vk::AccelerationStructureInstanceKHR> &instances,
+      VmaAllocation &alloc);
   void updateDescriptor(const void *pData, vk::DeviceSize size,
                         VmaAllocationInfo &info);
+  // device local buffer for shader scratch data, addressable and fillable
+  vk::Buffer createStorageBuffer(vk::DeviceSize size, VmaAllocation &alloc);
+  // copies size bytes from offset of src to pData, blocks until done
+  void downloadBuffer(vk::Buffer src, void *pData, vk::DeviceSize size,
+                      vk::DeviceSize offset = 0);
+  // copies size bytes from pData to offset of dst, blocks until done
+  void uploadBuffer(vk::Buffer dst, const void *pData, vk::DeviceSize size,
+                    vk::DeviceSize offset = 0);
+  // host visible and mapped, for callers that upload through the same
+  // staging memory again and again
+  vk::Buffer stagingBuffer(vk::DeviceSize size, VmaAllocation &alloc,
+                           VmaAllocationInfo &info);
+  // every (dst, region) copy out of src in a single submission, blocks
+  // until done
+  void copyRegions(
+      vk::Buffer src,
+      const std::vector<std::pair<vk::Buffer, vk::BufferCopy>> &copies);
 
   vk::DeviceAddress getDeviceAddress(vk::Buffer buffer);
 
@@ -57,9 +79,6 @@ private:
   vk::Image createImage(VmaAllocation &alloc, VmaAllocationInfo &allocInfo,
                         vk::ImageCreateInfo createInfo,
                         VmaAllocationCreateInfo &allocCreateInfo);
-
-  vk::Buffer stagingBuffer(vk::DeviceSize size, VmaAllocation &alloc,
-                           VmaAllocationInfo &info);
 };
 
 } // namespace rn
\ No newline at end of file
@@ -2,6 +2,7 @@
 #extension GL_EXT_scalar_block_layout : enable
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 #extension GL_EXT_buffer_reference2 : require
+#extension GL_EXT_shader_atomic_int64 : require
 
 struct RayPayload {
     vec2 uv;
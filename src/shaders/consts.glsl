@@ -0,0 +1,142 @@
+// push constants of the thermal ray tracing shaders.
+// has to match RaytracingPipeline::RtConsts in src/host/renderer/pipeline.hpp
+struct pushConsts {
+    uint64_t vertsBufferAddress;
+    uint64_t idxBufferAddress;
+    uint64_t outBufferAddress;
+    uint64_t oriBufferAddress;
+    uint64_t dirBufferAddress;
+    uint64_t hitBufferAddress;
+    uint64_t energyBufferAddress;
+    uint currentTri;
+    // launch rows of the ray query backend
+    uint rows;
+    uint flags;
+    uint nTris;
+    uint64_t binBufferAddress;
+    uint64_t emitterListAddress;
+    uint sampleOffset;
+    uint seed;
+    uint64_t frameBufferAddress;
+    uint64_t aliasBufferAddress;
+    uint batch;
+    // rays per launch row and the tlas of the ray query backend
+    uint width;
+    uint64_t tlasAddress;
+};
+
+// has to match Raytracer::ReduceConsts
+struct reduceConsts {
+    uint64_t hitBufferAddress;
+    uint64_t energyBufferAddress;
+    uint64_t vfBufferAddress;
+    uint64_t binBufferAddress;
+    uint nTris;
+    uint nRays;
+    uint currentTri;
+    uint flags;
+    uint64_t emitterListAddress;
+    uint64_t errorBufferAddress;
+    float tolerance;
+    uint nRows;
+};
+
+// has to match Raytracer::CorrectConsts
+struct correctConsts {
+    uint64_t vfBufferAddress;
+    uint64_t frameBufferAddress;
+    uint64_t targetBufferAddress;
+    uint64_t scaleBufferAddress;
+    uint64_t energyBufferAddress;
+    uint nTris;
+    uint mode;
+    uint flags;
+    uint currentTri;
+};
+
+// correctConsts.mode
+const uint CORRECT_TARGET = 0;
+const uint CORRECT_SYMMETRIZE = 1;
+const uint CORRECT_SCALE = 2;
+const uint CORRECT_APPLY = 3;
+// correctConsts.flags
+const uint CORRECT_CLOSED = 1;
+const uint CORRECT_LAST = 2;
+
+// has to match GebhartSolver::GebhartConsts
+struct gebhartConsts {
+    uint64_t rowAddress;
+    uint64_t colAddress;
+    uint64_t valAddress;
+    uint64_t emissivityAddress;
+    uint64_t srcAddress;
+    uint64_t dstAddress;
+    uint64_t residualAddress;
+    uint nTris;
+};
+
+// has to match Raytracer::MeshConsts
+struct meshConsts {
+    uint64_t vfBufferAddress;
+    uint64_t frameBufferAddress;
+    uint64_t offsetBufferAddress;
+    uint64_t tmpBufferAddress;
+    uint64_t meshBufferAddress;
+    uint nTris;
+    uint nMeshes;
+    uint mode;
+};
+
+// meshConsts.mode
+const uint MESH_RECEIVERS = 0;
+const uint MESH_EMITTERS = 1;
+
+// has to match GeometryHandler::TriFrame
+struct triFrame {
+    vec4 origin;
+    vec4 e1;
+    vec4 e2;
+    vec4 normal; // .w = area
+    vec4 tangent;
+    vec4 bitangent;
+};
+
+// has to match GeometryHandler::AliasEntry, slot i is kept with prob,
+// otherwise alias is emitted
+struct aliasEntry {
+    float prob;
+    uint alias;
+};
+
+// .tri holds the emitter in the upper and the receiver in the lower 32 bits
+struct hitInfo {
+    uint64_t tri;
+    float energy;
+};
+
+// per (emitter, receiver) accumulator, each row has nTris + 1 bins, the
+// last one collects the rays that escaped to space
+struct binInfo {
+    uint64_t energy;
+    uint64_t count;
+};
+
+// energies are accumulated as fixed point numbers
+const float BIN_SCALE = 1048576.0;
+
+// pushConsts.flags
+const uint TRACE_BATCH = 1;
+const uint TRACE_BINS = 2;
+const uint TRACE_LIST = 4;
+const uint TRACE_SOBOL = 8;
+const uint TRACE_GLOBAL = 16;
+
+// receiver index of rays that escaped to space
+const uint MISS_IDX = 0xffffffff;
+
+// size of the ori/dir buffers used to visualise the rays
+const uint MAX_VIS_RAYS = 1000;
+
+// view factors below this are judged by their absolute instead of their
+// relative standard error
+const float ERROR_FLOOR = 0.01;
@@ -0,0 +1,53 @@
+// shared parts of the sparse view factor matrix passes
+
+// has to match ViewFactorMatrix::CsrConsts
+struct csrConsts {
+    uint64_t srcAddress;
+    uint64_t dstAddress;
+    uint64_t histAddress;
+    uint64_t rowAddress;
+    uint64_t colAddress;
+    uint64_t sumAddress;
+    uint64_t valAddress;
+    uint64_t totalAddress;
+    uint64_t blockAddress;
+    uint nItems;
+    uint nRows;
+    uint nCols;
+    uint nGroups;
+    uint shift;
+    uint receiverBits;
+};
+
+layout(push_constant) uniform _csrConsts { csrConsts consts;};
+
+layout(buffer_reference, scalar) buffer HitBuffer{hitInfo hit[];};
+layout(buffer_reference, scalar) buffer UintBuffer{uint v[];};
+layout(buffer_reference, scalar) buffer U64Buffer{uint64_t v[];};
+layout(buffer_reference, scalar) buffer FloatBuffer{float v[];};
+
+// every workgroup handles one tile of items
+const uint TILE = 256;
+// 4 bit digits per radix sort pass
+const uint RADIX = 16;
+// consecutive items per invocation of the hierarchical scan, a workgroup
+// scans one block of SCAN_BLOCK items
+const uint SCAN_ITEMS = 16;
+const uint SCAN_BLOCK = TILE * SCAN_ITEMS;
+
+// more than 65535 workgroups are split along .y
+uint groupIndex() {
+    return gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+}
+
+// (emitter, receiver) packed into as few bits as the geometry needs,
+// misses are sorted behind the last receiver of their row
+uint64_t sortKey(uint64_t key) {
+    uint64_t emitter = key >> 32;
+    uint receiver = min(uint(key), consts.nCols);
+    return (emitter << consts.receiverBits) | receiver;
+}
+
+uint digit(uint64_t key) {
+    return uint(sortKey(key) >> consts.shift) & (RADIX - 1);
+}
@@ -0,0 +1,128 @@
+// emission and storage of the thermal rays, shared by the ray tracing
+// pipeline (rttri.rgen) and the ray query backend (rqtri.comp).
+// has to be included after the push constants, reads consts
+
+layout(buffer_reference, scalar) buffer OriBuffer{vec4 oris[];};
+layout(buffer_reference, scalar) buffer DirBuffer{vec4 dirs[];};
+layout(buffer_reference, scalar) buffer VertBuffer{vec4 verts[];};
+layout(buffer_reference, scalar) buffer IndexBuffer{uint idxs[];};
+layout(buffer_reference, scalar) buffer HitBuffer{hitInfo hits[];};
+layout(buffer_reference, scalar) buffer BinBuffer{binInfo bins[];};
+layout(buffer_reference, scalar) buffer FrameBuffer{triFrame frames[];};
+layout(buffer_reference, scalar) buffer AliasBuffer{aliasEntry entries[];};
+// emitters that still need rays in progressive mode
+layout(buffer_reference, scalar) buffer ListBuffer{uint count; uint emitters[];};
+
+// cosine weighted directions, so every ray carries the same energy
+const float RAY_ENERGY = 1.0;
+
+struct Emission {
+    uint tri;
+    // row of bins the ray is accumulated into
+    uint row;
+    uint sampleIdx;
+    // the ray is drawn in the visualisation
+    bool vis;
+    vec3 ori;
+    vec3 dir;
+};
+
+// emitter of launch row y, global launches draw theirs per ray
+uint launchEmitter(uint y) {
+    // batch launches trace all triangles, y selects the emitter
+    uint tri = (consts.flags & TRACE_BATCH) != 0 ? y : uint(consts.currentTri);
+    // progressive launches only trace the listed emitters
+    if ((consts.flags & TRACE_LIST) != 0) {
+        tri = ListBuffer(consts.emitterListAddress).emitters[y];
+    }
+    return tri;
+}
+
+// every emitter owns a row of bins, single triangle launches use the first
+uint binRow(uint tri) {
+    return (consts.flags & TRACE_BATCH) != 0 ? tri : 0;
+}
+
+// id.x = ray of the launch row, id.y = launch row
+Emission emitRay(uvec2 id) {
+    Emission e;
+    e.tri = launchEmitter(id.y);
+    // every ray draws from its own counter based stream, so it can be
+    // reproduced from (seed, emitter, batch, ray) alone
+    uvec2 key = uvec2(consts.seed, 0);
+    // global launches pick the emitter of every ray proportional to its power
+    if ((consts.flags & TRACE_GLOBAL) != 0) {
+        vec4 pick = uniformFloats(philox(uvec4(id.x, consts.batch, MISS_IDX, 0), key));
+        uint slot = min(uint(pick.x * float(consts.nTris)), consts.nTris - 1);
+        aliasEntry entry = AliasBuffer(consts.aliasBufferAddress).entries[slot];
+        e.tri = pick.y < entry.prob ? slot : entry.alias;
+    }
+    e.row = binRow(e.tri);
+
+    // successive batches have to draw different samples
+    e.sampleIdx = id.x + consts.sampleOffset;
+    // only the selected triangle is visualised, with the first samples of
+    // a streamed launch
+    e.vis = e.tri == uint(consts.currentTri) && e.sampleIdx < MAX_VIS_RAYS;
+
+    triFrame frame = FrameBuffer(consts.frameBufferAddress).frames[e.tri];
+
+    // random vals for random sampling, .xy = origin, .zw = direction
+    vec4 u;
+    if ((consts.flags & TRACE_SOBOL) != 0) {
+        // every triangle and launch get their own scrambling of the same sequence
+        uint scramble = tea(e.tri, consts.seed ^ 0x5eed);
+        u = vec4(sobolOwen(e.sampleIdx, 0, scramble), sobolOwen(e.sampleIdx, 1, scramble),
+                 sobolOwen(e.sampleIdx, 2, scramble), sobolOwen(e.sampleIdx, 3, scramble));
+    } else {
+        u = uniformFloats(philox(uvec4(id.x, consts.batch, e.tri, 0), key));
+    }
+    float sr1 = sqrt(u.x);
+    float r2 = u.y;
+
+    vec3 ori = frame.origin.xyz + frame.e1.xyz*sr1*(1-r2) + frame.e2.xyz*sr1*r2;
+
+    vec3 local = cosineHemisphere(u.zw);
+    e.dir = local.x*frame.tangent.xyz + local.y*frame.bitangent.xyz +
+            local.z*frame.normal.xyz;
+
+    // offset ori, to avoid self intersections
+    e.ori = offsetRay(ori, frame.normal.xyz);
+    if (e.vis) {
+        OriBuffer(consts.oriBufferAddress).oris[e.sampleIdx] = vec4(e.ori, 1);
+    }
+    return e;
+}
+
+// adds a ray to the global bins, misses go to the last column
+void addBin(uint row, uint receiver) {
+    BinBuffer binbuf = BinBuffer(consts.binBufferAddress);
+    uint bin = row * (consts.nTris + 1) + min(receiver, consts.nTris);
+    atomicAdd(binbuf.bins[bin].energy, uint64_t(RAY_ENERGY * BIN_SCALE));
+    atomicAdd(binbuf.bins[bin].count, 1ul);
+}
+
+// stores the hit record of unbinned launches and the visualised ray,
+// receiver is MISS_IDX for rays that escaped, uv the barycentrics of the hit
+void storeRay(Emission e, uint rayIdx, uint receiver, vec2 uv) {
+    if ((consts.flags & TRACE_BINS) == 0) {
+        // store hit to hitbuffer, misses are stored with the max val
+        HitBuffer(consts.hitBufferAddress).hits[rayIdx] =
+            hitInfo((uint64_t(e.tri) << 32) | receiver, RAY_ENERGY);
+    }
+
+    if (e.vis) {
+        vec4 hit;
+        if (receiver != MISS_IDX) {
+            VertBuffer vertbuf = VertBuffer(consts.vertsBufferAddress);
+            IndexBuffer idxbuf = IndexBuffer(consts.idxBufferAddress);
+            hit = (1-uv.x-uv.y)*vertbuf.verts[idxbuf.idxs[receiver*3 + 0]] +
+                           uv.x*vertbuf.verts[idxbuf.idxs[receiver*3 + 1]] +
+                           uv.y*vertbuf.verts[idxbuf.idxs[receiver*3 + 2]];
+            hit.w = 10;
+        } else {
+            hit = vec4(e.ori + e.dir*0.1, 5);
+        }
+        DirBuffer(consts.dirBufferAddress).dirs[e.sampleIdx] = hit;
+    }
+}
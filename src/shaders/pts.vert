@@ -19,7 +19,8 @@ struct pushConsts {
     uint64_t dirBufferAddress;
     uint64_t hitBufferAddress;
     uint64_t energyBufferAddress;
-    uint64_t currentTri;
+    uint currentTri;
+    uint rows;
 };
 
 
@@ -0,0 +1,5 @@
+// rows of workgroups dispatched by ComputePipeline::dispatchRows, more than
+// 65535 rows are continued along .z
+uint rowIndex() {
+    return gl_WorkGroupID.z * gl_NumWorkGroups.y + gl_WorkGroupID.y;
+}
@@ -14,7 +14,8 @@ struct pushConsts {
     uint64_t dirBufferAddress;
     uint64_t hitBufferAddress;
     uint64_t energyBufferAddress;
-    uint64_t currentTri;
+    uint currentTri;
+    uint rows;
 };
 
 layout (set = 0, binding = 0) uniform GlobalUbo {